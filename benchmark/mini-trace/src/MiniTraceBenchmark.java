@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import java.io.File;
+import java.io.FileDescriptor;
+import java.io.FileOutputStream;
+import java.lang.reflect.Method;
+import java.lang.reflect.Modifier;
+import java.util.ArrayList;
+import java.util.List;
+
+public class MiniTraceBenchmark {
+    public void timeLoop(int count) {
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            if ((i & 1) == 0) {
+                sum += i;
+            } else {
+                sum ^= i;
+            }
+        }
+        result = sum;
+    }
+
+    public void timeStaticCall(int count) {
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum = $noinline$add(sum, i);
+        }
+        result = sum;
+    }
+
+    public void timeVirtualCall(int count) {
+        Shape[] shapes = this.shapes;
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum += shapes[i & 3].sides();
+        }
+        result = sum;
+    }
+
+    public void timeDeepCall(int count) {
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum += $noinline$depth(8);
+        }
+        result = sum;
+    }
+
+    public void timeException(int count) {
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            try {
+                $noinline$throw(i);
+            } catch (IllegalStateException e) {
+                ++sum;
+            }
+        }
+        result = sum;
+    }
+
+    public void timeExceptionUnwind(int count) {
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            try {
+                $noinline$throwAtDepth(4);
+            } catch (IllegalStateException e) {
+                ++sum;
+            }
+        }
+        result = sum;
+    }
+
+    private static int $noinline$add(int a, int b) {
+        return a + b;
+    }
+
+    private static int $noinline$depth(int depth) {
+        return (depth == 0) ? 0 : $noinline$depth(depth - 1) + 1;
+    }
+
+    private static void $noinline$throw(int value) {
+        throw new IllegalStateException();
+    }
+
+    private static int $noinline$throwAtDepth(int depth) {
+        if (depth == 0) {
+            throw new IllegalStateException();
+        }
+        return $noinline$throwAtDepth(depth - 1) + 1;
+    }
+
+    abstract static class Shape {
+        abstract int sides();
+    }
+
+    static class Triangle extends Shape {
+        int sides() { return 3; }
+    }
+
+    static class Square extends Shape {
+        int sides() { return 4; }
+    }
+
+    static class Pentagon extends Shape {
+        int sides() { return 5; }
+    }
+
+    static class Hexagon extends Shape {
+        int sides() { return 6; }
+    }
+
+    private final Shape[] shapes = { new Triangle(), new Square(), new Pentagon(), new Hexagon() };
+
+    public static int result;
+
+    // Runs the benchmarks under each tracing mode and prints the slowdown.
+
+    private enum Mode {
+        NONE("none"),
+        MINI_TRACE("MiniTrace"),
+        METHOD_TRACE("Trace");
+
+        final String label;
+
+        Mode(String label) {
+            this.label = label;
+        }
+    }
+
+    private static final String[] DEFAULT_BENCHMARKS = {
+        "MiniTraceBenchmark",
+        "ConstClassBenchmark",
+        "ConstStringBenchmark",
+        "StringIndexOfBenchmark",
+        "TypeCheckBenchmark",
+    };
+
+    // The untraced run of a workload takes at least this long.
+    private static final long MIN_RUN_NS = 50 * 1000 * 1000;
+    private static final int RUNS = 5;
+    private static final int TRACE_BUFFER_SIZE = 8 * 1024 * 1024;
+
+    private static class Workload {
+        final String name;
+        final Object receiver;
+        final Method method;
+        int count;
+        final double[] nsPerOp = new double[Mode.values().length];
+
+        Workload(String name, Object receiver, Method method) {
+            this.name = name;
+            this.receiver = receiver;
+            this.method = method;
+        }
+
+        long run(int count) throws Exception {
+            long start = System.nanoTime();
+            method.invoke(receiver, count);
+            return System.nanoTime() - start;
+        }
+    }
+
+    private static Method vmDebugMethod(String name, Class<?>... parameterTypes) throws Exception {
+        Method method =
+            Class.forName("dalvik.system.VMDebug").getDeclaredMethod(name, parameterTypes);
+        method.setAccessible(true);
+        return method;
+    }
+
+    private static void addWorkloads(String className, List<Workload> workloads) {
+        Object receiver;
+        try {
+            receiver = Class.forName(className).newInstance();
+        } catch (ReflectiveOperationException | LinkageError e) {
+            System.out.println("Skipping " + className + ": " + e);
+            return;
+        }
+        for (Method method : receiver.getClass().getDeclaredMethods()) {
+            Class<?>[] parameterTypes = method.getParameterTypes();
+            if (method.getName().startsWith("time") &&
+                Modifier.isPublic(method.getModifiers()) &&
+                parameterTypes.length == 1 &&
+                parameterTypes[0] == int.class) {
+                String name = className + "." + method.getName().substring("time".length());
+                workloads.add(new Workload(name, receiver, method));
+            }
+        }
+    }
+
+    // Doubles the count until the untraced run takes MIN_RUN_NS, the other modes run as many.
+    private static void calibrate(Workload workload, int count) throws Exception {
+        if (count != 0) {
+            workload.count = count;
+            return;
+        }
+        workload.count = 1000;
+        while (workload.run(workload.count) < MIN_RUN_NS && workload.count < (1 << 30)) {
+            workload.count *= 2;
+        }
+    }
+
+    private static double measure(Workload workload) throws Exception {
+        workload.run(Math.max(workload.count / 10, 1));
+        long best = Long.MAX_VALUE;
+        for (int i = 0; i < RUNS; ++i) {
+            best = Math.min(best, workload.run(workload.count));
+        }
+        return (double) best / workload.count;
+    }
+
+    private static boolean startTracing(Mode mode, String miniTraceConfig, File traceFile)
+            throws Exception {
+        switch (mode) {
+            case MINI_TRACE:
+                return (Boolean) vmDebugMethod("startMiniTrace", String.class)
+                    .invoke(null, miniTraceConfig);
+            case METHOD_TRACE:
+                vmDebugMethod("startMethodTracing",
+                              String.class, int.class, int.class, boolean.class, int.class)
+                    .invoke(null, traceFile.getPath(), TRACE_BUFFER_SIZE, 0, false, 0);
+                return true;
+            default:
+                return true;
+        }
+    }
+
+    private static void stopTracing(Mode mode) throws Exception {
+        switch (mode) {
+            case MINI_TRACE:
+                vmDebugMethod("stopMiniTrace").invoke(null);
+                break;
+            case METHOD_TRACE:
+                vmDebugMethod("stopMethodTracing").invoke(null);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Dumps the coverage of the workloads and prints how long it took and its size.
+    private static void measureDump() throws Exception {
+        File file = File.createTempFile("mini_trace_benchmark", ".txt");
+        try (FileOutputStream out = new FileOutputStream(file)) {
+            FileDescriptor fd = out.getFD();
+            int fdInt = (Integer) FileDescriptor.class.getMethod("getInt$").invoke(fd);
+            Method dump = vmDebugMethod("dumpMiniTraceFd", int.class);
+            long start = System.nanoTime();
+            dump.invoke(null, fdInt);
+            long firstNs = System.nanoTime() - start;
+            long firstSize = file.length();
+            // Nothing ran since, the second dump is the fixed cost.
+            start = System.nanoTime();
+            dump.invoke(null, fdInt);
+            long secondNs = System.nanoTime() - start;
+            long secondSize = file.length() - firstSize;
+            System.out.println(String.format("MiniTrace dump\t%.3f ms\t%d bytes", firstNs / 1e6,
+                                             firstSize));
+            System.out.println(String.format("MiniTrace empty dump\t%.3f ms\t%d bytes",
+                                             secondNs / 1e6, secondSize));
+        } finally {
+            file.delete();
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        String miniTraceConfig = "";
+        int count = 0;
+        List<String> classNames = new ArrayList<>();
+        for (String arg : args) {
+            if (arg.startsWith("--mini-trace-config=")) {
+                miniTraceConfig = arg.substring("--mini-trace-config=".length()).replace(';', '\n');
+            } else if (arg.startsWith("--count=")) {
+                count = Integer.parseInt(arg.substring("--count=".length()));
+            } else {
+                classNames.add(arg);
+            }
+        }
+        if (classNames.isEmpty()) {
+            for (String className : DEFAULT_BENCHMARKS) {
+                classNames.add(className);
+            }
+        }
+
+        List<Workload> workloads = new ArrayList<>();
+        for (String className : classNames) {
+            addWorkloads(className, workloads);
+        }
+        for (Workload workload : workloads) {
+            calibrate(workload, count);
+        }
+
+        File traceFile = File.createTempFile("mini_trace_benchmark", ".trace");
+        boolean[] ran = new boolean[Mode.values().length];
+        for (Mode mode : Mode.values()) {
+            try {
+                ran[mode.ordinal()] = startTracing(mode, miniTraceConfig, traceFile);
+            } catch (ReflectiveOperationException e) {
+                System.out.println("Skipping " + mode.label + ": " + e);
+            }
+            if (!ran[mode.ordinal()]) {
+                continue;
+            }
+            try {
+                for (Workload workload : workloads) {
+                    workload.nsPerOp[mode.ordinal()] = measure(workload);
+                }
+                if (mode == Mode.MINI_TRACE) {
+                    measureDump();
+                }
+            } finally {
+                stopTracing(mode);
+            }
+        }
+        if (ran[Mode.METHOD_TRACE.ordinal()]) {
+            System.out.println(String.format("Trace file\t%d bytes", traceFile.length()));
+        }
+        traceFile.delete();
+
+        StringBuilder header = new StringBuilder("Benchmark\tops");
+        for (Mode mode : Mode.values()) {
+            if (ran[mode.ordinal()]) {
+                header.append('\t').append(mode.label).append(" ns/op");
+                if (mode != Mode.NONE) {
+                    header.append('\t').append(mode.label).append(" slowdown");
+                }
+            }
+        }
+        System.out.println(header);
+        for (Workload workload : workloads) {
+            StringBuilder line = new StringBuilder(workload.name);
+            line.append('\t').append(workload.count);
+            double base = workload.nsPerOp[Mode.NONE.ordinal()];
+            for (Mode mode : Mode.values()) {
+                if (ran[mode.ordinal()]) {
+                    double nsPerOp = workload.nsPerOp[mode.ordinal()];
+                    line.append(String.format("\t%.3f", nsPerOp));
+                    if (mode != Mode.NONE) {
+                        line.append(String.format("\t%.2fx", nsPerOp / base));
+                    }
+                }
+            }
+            System.out.println(line);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "block_builder.h"
+
+#include "base/arena_allocator.h"
+#include "dex/code_item_accessors-inl.h"
+#include "mini_trace.h"
+#include "nodes.h"
+#include "optimizing_unit_test.h"
+
+#include "gtest/gtest.h"
+
+namespace art {
+
+class BlockBuilderTest : public OptimizingUnitTest {
+ protected:
+  // Checks that MiniTrace records coverage for the blocks HBasicBlockBuilder creates, so
+  // that the coverage probes of JIT code line up with the blocks of the coverage data.
+  void TestCoverageBlocks(const std::vector<uint16_t>& data,
+                          const std::vector<uint32_t>& expected_blocks);
+};
+
+void BlockBuilderTest::TestCoverageBlocks(const std::vector<uint16_t>& data,
+                                          const std::vector<uint32_t>& expected_blocks) {
+  HGraph* graph = CreateGraph();
+  // The code item data might not aligned to 4 bytes, copy it to ensure that.
+  const size_t code_item_size = data.size() * sizeof(data.front());
+  void* aligned_data = GetAllocator()->Alloc(code_item_size);
+  memcpy(aligned_data, &data[0], code_item_size);
+  const DexFile::CodeItem* code_item = reinterpret_cast<const DexFile::CodeItem*>(aligned_data);
+  CodeItemDebugInfoAccessor accessor(graph->GetDexFile(), code_item, /*dex_method_idx*/ 0u);
+
+  ScopedArenaAllocator allocator(GetArenaStack());
+  HBasicBlockBuilder block_builder(graph, &graph->GetDexFile(), accessor, &allocator);
+  ASSERT_TRUE(block_builder.Build());
+  std::vector<uint32_t> branch_targets;
+  for (uint32_t dex_pc = 0; dex_pc != accessor.InsnsSizeInCodeUnits(); ++dex_pc) {
+    // The blocks of switch decision trees are kept at the dex pcs of the switch payload but
+    // belong to the switch instruction.
+    HBasicBlock* block = block_builder.GetBlockAt(dex_pc);
+    if (block != nullptr && block->GetDexPc() == dex_pc) {
+      branch_targets.push_back(dex_pc);
+    }
+  }
+
+  EXPECT_EQ(expected_blocks, branch_targets);
+  EXPECT_EQ(branch_targets, MiniTrace::FindCoverageBlocks(accessor));
+}
+
+TEST_F(BlockBuilderTest, MiniTraceCoverageBlocks) {
+  const std::vector<uint16_t> data = ONE_REGISTER_CODE_ITEM(
+    Instruction::CONST_4 | 0 | 0,
+    Instruction::IF_EQZ, 3,
+    Instruction::RETURN_VOID,
+    Instruction::GOTO | 0xFF00);
+
+  TestCoverageBlocks(data, {0u, 3u, 4u});
+}
+
+TEST_F(BlockBuilderTest, MiniTraceCoverageBlocksSwitchAndCatch) {
+  const std::vector<uint16_t> data = {
+    2, 0, 0, 1,  // registers, ins, outs, tries.
+    0, 0,        // debug_info_off.
+    32, 0,       // insns_size.
+    // 0: The small packed-switch builds a decision tree.
+    Instruction::CONST_4 | 0 | 0,
+    Instruction::PACKED_SWITCH, 13, 0,
+    // 4: The sparse-switch always does, one of its cases is the next instruction.
+    Instruction::SPARSE_SWITCH, 18, 0,
+    // 7:
+    Instruction::IF_EQZ, 6,
+    // 9: Try block.
+    Instruction::CONST_4 | 1 << 8 | 1 << 12,
+    Instruction::THROW | 1 << 8,
+    // 11: Catch-all handler.
+    Instruction::MOVE_EXCEPTION | 1 << 8,
+    // 12:
+    Instruction::RETURN_VOID,
+    // 13:
+    Instruction::RETURN_VOID,
+    // 14: Packed-switch payload: keys 0 and 1 go to 12 and 13.
+    Instruction::kPackedSwitchSignature, 2, 0, 0, 11, 0, 12, 0,
+    // 22: Sparse-switch payload: keys 1 and 5 go to 7 and 12.
+    Instruction::kSparseSwitchSignature, 2, 1, 0, 5, 0, 3, 0, 8, 0,
+    // Try item: start_addr, insn_count, handler_off.
+    9, 0, 2, 1,
+    // Catch handlers: one catch-all handler at 11.
+    1, 11,
+  };
+
+  // No block starts at the switch payloads.
+  TestCoverageBlocks(data, {0u, 4u, 7u, 9u, 11u, 12u, 13u});
+}
+
+}  // namespace art
@@ -3804,6 +3804,25 @@ void InstructionCodeGeneratorARM64::VisitNativeDebugInfo(HNativeDebugInfo*) {
   // MaybeRecordNativeDebugInfo is already called implicitly in CodeGenerator::Compile.
 }
 
+void LocationsBuilderARM64::VisitCoverageProbe(HCoverageProbe* probe) {
+  new (GetGraph()->GetAllocator()) LocationSummary(probe);
+}
+
+void InstructionCodeGeneratorARM64::VisitCoverageProbe(HCoverageProbe* probe) {
+  UseScratchRegisterScope temps(GetVIXLAssembler());
+  Register address = temps.AcquireX();
+  Register value = temps.AcquireW();
+  vixl::aarch64::Label done;
+  __ Mov(address, probe->GetAddress());
+  __ Ldrb(value, MemOperand(address));
+  // Only store when the bits are not set yet, to keep the cache line clean in hot code.
+  __ Tst(value, probe->GetMask());
+  __ B(ne, &done);
+  __ Orr(value, value, probe->GetMask());
+  __ Strb(value, MemOperand(address));
+  __ Bind(&done);
+}
+
 void CodeGeneratorARM64::GenerateNop() {
   __ Nop();
 }
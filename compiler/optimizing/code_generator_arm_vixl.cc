@@ -3193,6 +3193,27 @@ void InstructionCodeGeneratorARMVIXL::VisitNativeDebugInfo(HNativeDebugInfo*) {
   // MaybeRecordNativeDebugInfo is already called implicitly in CodeGenerator::Compile.
 }
 
+void LocationsBuilderARMVIXL::VisitCoverageProbe(HCoverageProbe* probe) {
+  LocationSummary* locations = new (GetGraph()->GetAllocator()) LocationSummary(probe);
+  locations->AddTemp(Location::RequiresRegister());
+  locations->AddTemp(Location::RequiresRegister());
+}
+
+void InstructionCodeGeneratorARMVIXL::VisitCoverageProbe(HCoverageProbe* probe) {
+  LocationSummary* locations = probe->GetLocations();
+  vixl32::Register address = RegisterFrom(locations->GetTemp(0));
+  vixl32::Register value = RegisterFrom(locations->GetTemp(1));
+  vixl32::Label done;
+  __ Mov(address, dchecked_integral_cast<uint32_t>(probe->GetAddress()));
+  __ Ldrb(value, MemOperand(address));
+  // Only store when the bits are not set yet, to keep the cache line clean in hot code.
+  __ Tst(value, probe->GetMask());
+  __ B(ne, &done, /* far_target */ false);
+  __ Orr(value, value, probe->GetMask());
+  __ Strb(value, MemOperand(address));
+  __ Bind(&done);
+}
+
 void CodeGeneratorARMVIXL::GenerateNop() {
   __ Nop();
 }
@@ -6410,6 +6410,23 @@ void InstructionCodeGeneratorMIPS::VisitNativeDebugInfo(HNativeDebugInfo*) {
   // MaybeRecordNativeDebugInfo is already called implicitly in CodeGenerator::Compile.
 }
 
+void LocationsBuilderMIPS::VisitCoverageProbe(HCoverageProbe* probe) {
+  LocationSummary* locations = new (GetGraph()->GetAllocator()) LocationSummary(probe);
+  locations->AddTemp(Location::RequiresRegister());
+}
+
+void InstructionCodeGeneratorMIPS::VisitCoverageProbe(HCoverageProbe* probe) {
+  Register value = probe->GetLocations()->GetTemp(0).AsRegister<Register>();
+  MipsLabel done;
+  __ LoadConst32(AT, dchecked_integral_cast<uint32_t>(probe->GetAddress()));
+  __ Lbu(TMP, AT, 0);
+  __ Ori(value, TMP, probe->GetMask());
+  // Only store when the bits are not set yet, to keep the cache line clean in hot code.
+  __ Beq(value, TMP, &done);
+  __ Sb(value, AT, 0);
+  __ Bind(&done);
+}
+
 void CodeGeneratorMIPS::GenerateNop() {
   __ Nop();
 }
@@ -4704,6 +4704,23 @@ void InstructionCodeGeneratorMIPS64::VisitNativeDebugInfo(HNativeDebugInfo*) {
   // MaybeRecordNativeDebugInfo is already called implicitly in CodeGenerator::Compile.
 }
 
+void LocationsBuilderMIPS64::VisitCoverageProbe(HCoverageProbe* probe) {
+  LocationSummary* locations = new (GetGraph()->GetAllocator()) LocationSummary(probe);
+  locations->AddTemp(Location::RequiresRegister());
+}
+
+void InstructionCodeGeneratorMIPS64::VisitCoverageProbe(HCoverageProbe* probe) {
+  GpuRegister value = probe->GetLocations()->GetTemp(0).AsRegister<GpuRegister>();
+  Mips64Label done;
+  __ LoadConst64(AT, static_cast<int64_t>(probe->GetAddress()));
+  __ Lbu(TMP, AT, 0);
+  __ Ori(value, TMP, probe->GetMask());
+  // Only store when the bits are not set yet, to keep the cache line clean in hot code.
+  __ Beqc(value, TMP, &done);
+  __ Sb(value, AT, 0);
+  __ Bind(&done);
+}
+
 void CodeGeneratorMIPS64::GenerateNop() {
   __ Nop();
 }
@@ -1861,6 +1861,21 @@ void InstructionCodeGeneratorX86::VisitNativeDebugInfo(HNativeDebugInfo*) {
   // MaybeRecordNativeDebugInfo is already called implicitly in CodeGenerator::Compile.
 }
 
+void LocationsBuilderX86::VisitCoverageProbe(HCoverageProbe* probe) {
+  new (GetGraph()->GetAllocator()) LocationSummary(probe);
+}
+
+void InstructionCodeGeneratorX86::VisitCoverageProbe(HCoverageProbe* probe) {
+  Address address = Address::Absolute(dchecked_integral_cast<uint32_t>(probe->GetAddress()));
+  Immediate mask(static_cast<int8_t>(probe->GetMask()));
+  NearLabel done;
+  // Only store when the bits are not set yet, to keep the cache line clean in hot code.
+  __ testb(address, mask);
+  __ j(kNotZero, &done);
+  __ orb(address, mask);
+  __ Bind(&done);
+}
+
 void CodeGeneratorX86::GenerateNop() {
   __ nop();
 }
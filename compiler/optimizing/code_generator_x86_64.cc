@@ -1860,6 +1860,24 @@ void InstructionCodeGeneratorX86_64::VisitNativeDebugInfo(HNativeDebugInfo*) {
   // MaybeRecordNativeDebugInfo is already called implicitly in CodeGenerator::Compile.
 }
 
+void LocationsBuilderX86_64::VisitCoverageProbe(HCoverageProbe* probe) {
+  LocationSummary* locations = new (GetGraph()->GetAllocator()) LocationSummary(probe);
+  locations->AddTemp(Location::RequiresRegister());
+}
+
+void InstructionCodeGeneratorX86_64::VisitCoverageProbe(HCoverageProbe* probe) {
+  CpuRegister temp = probe->GetLocations()->GetTemp(0).AsRegister<CpuRegister>();
+  Address address(temp, 0);
+  Immediate mask(static_cast<int8_t>(probe->GetMask()));
+  NearLabel done;
+  codegen_->Load64BitValue(temp, static_cast<int64_t>(probe->GetAddress()));
+  // Only store when the bits are not set yet, to keep the cache line clean in hot code.
+  __ testb(address, mask);
+  __ j(kNotZero, &done);
+  __ orb(address, mask);
+  __ Bind(&done);
+}
+
 void CodeGeneratorX86_64::GenerateNop() {
   __ nop();
 }
@@ -33,6 +33,7 @@
 #include "intrinsics.h"
 #include "jit/jit.h"
 #include "jit/jit_code_cache.h"
+#include "mini_trace.h"
 #include "mirror/class_loader.h"
 #include "mirror/dex_cache.h"
 #include "nodes.h"
@@ -1426,7 +1427,9 @@ bool HInliner::TryBuildAndInline(HInvoke* invoke_instruction,
   // dex file here (though the transitivity of an inline chain would allow checking the calller).
   if (!compiler_driver_->MayInline(method->GetDexFile(),
                                    outer_compilation_unit_.GetDexFile())) {
-    if (TryPatternSubstitution(invoke_instruction, method, return_replacement)) {
+    // A substituted pattern would not record the coverage of the callee.
+    if (!MiniTrace::RequiresCoverageProbes(method) &&
+        TryPatternSubstitution(invoke_instruction, method, return_replacement)) {
       LOG_SUCCESS() << "Successfully replaced pattern of invoke "
                     << method->PrettyMethod();
       MaybeRecordStat(stats_, MethodCompilationStat::kReplacedInvokeWithSimplePattern);
@@ -28,6 +28,7 @@
 #include "driver/dex_compilation_unit.h"
 #include "driver/compiler_options.h"
 #include "imtable-inl.h"
+#include "mini_trace.h"
 #include "mirror/dex_cache.h"
 #include "oat_file.h"
 #include "optimizing_compiler_stats.h"
@@ -310,6 +311,29 @@ static bool IsBlockPopulated(HBasicBlock* block) {
   }
 }
 
+// Returns the per-block coverage flags the compiled code of `method` should record into, or
+// null if no coverage probes are needed. Probes embed the address of the flags, so only JIT
+// code can use them.
+static uint8_t* GetCoverageBlockFlags(ArtMethod* method, std::vector<uint32_t>* blocks) {
+  if (method == nullptr ||
+      !MiniTrace::IsMiniTraceActive() ||
+      !Runtime::Current()->UseJitCompilation()) {
+    return nullptr;
+  }
+  ScopedObjectAccess soa(Thread::Current());
+  if (!MiniTrace::RequiresCoverageProbes(method)) {
+    return nullptr;
+  }
+  uint8_t* coverage_data = method->GetCoverageData();
+  if (coverage_data == nullptr) {
+    return nullptr;
+  }
+  MiniTrace::RecordCoverageProbes(coverage_data);
+  CodeItemDataAccessor accessor(method->DexInstructionData());
+  *blocks = MiniTrace::FindCoverageBlocks(accessor);
+  return coverage_data + MiniTrace::GetExecutedBitmapSize(accessor.InsnsSizeInCodeUnits());
+}
+
 bool HInstructionBuilder::Build() {
   DCHECK(code_item_accessor_.HasCodeItem());
   locals_for_.resize(
@@ -326,6 +350,11 @@ bool HInstructionBuilder::Build() {
     native_debug_info_locations = FindNativeDebugInfoLocations();
   }
 
+  // Record the entry of each basic block for MiniTrace coverage. The dex pcs of the rest of
+  // the block are derived from the block when the coverage data is dumped.
+  std::vector<uint32_t> coverage_blocks;
+  uint8_t* coverage_block_flags = GetCoverageBlockFlags(graph_->GetArtMethod(), &coverage_blocks);
+
   for (HBasicBlock* block : graph_->GetReversePostOrder()) {
     current_block_ = block;
     uint32_t block_dex_pc = current_block_->GetDexPc();
@@ -361,6 +390,7 @@ bool HInstructionBuilder::Build() {
       quicken_index = block_builder_->GetQuickenIndex(block_dex_pc);
     }
 
+    bool needs_coverage_probe = coverage_block_flags != nullptr;
     for (const DexInstructionPcPair& pair : code_item_accessor_.InstructionsFrom(block_dex_pc)) {
       if (current_block_ == nullptr) {
         // The previous instruction ended this block.
@@ -377,6 +407,13 @@ bool HInstructionBuilder::Build() {
         PropagateLocalsToCatchBlocks();
       }
 
+      // MOVE_EXCEPTION must stay the first instruction of its catch block.
+      if (needs_coverage_probe && pair.Inst().Opcode() != Instruction::MOVE_EXCEPTION) {
+        AppendCoverageProbe(
+            coverage_block_flags, ArrayRef<const uint32_t>(coverage_blocks), block_dex_pc);
+        needs_coverage_probe = false;
+      }
+
       if (native_debuggable && native_debug_info_locations->IsBitSet(dex_pc)) {
         AppendInstruction(new (allocator_) HNativeDebugInfo(dex_pc));
       }
@@ -395,6 +432,10 @@ bool HInstructionBuilder::Build() {
       // instruction of the current block is not a branching instruction.
       // We add an unconditional Goto to the next block.
       DCHECK_EQ(current_block_->GetSuccessors().size(), 1u);
+      if (needs_coverage_probe) {
+        AppendCoverageProbe(
+            coverage_block_flags, ArrayRef<const uint32_t>(coverage_blocks), block_dex_pc);
+      }
       AppendInstruction(new (allocator_) HGoto());
     }
   }
@@ -404,6 +445,19 @@ bool HInstructionBuilder::Build() {
   return true;
 }
 
+void HInstructionBuilder::AppendCoverageProbe(uint8_t* block_flags,
+                                              ArrayRef<const uint32_t> blocks,
+                                              uint32_t block_dex_pc) {
+  // MiniTrace finds the same blocks as HBasicBlockBuilder.
+  auto it = std::lower_bound(blocks.begin(), blocks.end(), block_dex_pc);
+  DCHECK(it != blocks.end() && *it == block_dex_pc) << "No coverage block at " << block_dex_pc;
+  if (it == blocks.end() || *it != block_dex_pc) {
+    return;
+  }
+  uint8_t* flag = block_flags + (it - blocks.begin());
+  AppendInstruction(new (allocator_) HCoverageProbe(flag, /* mask */ 1u, block_dex_pc));
+}
+
 void HInstructionBuilder::BuildIntrinsic(ArtMethod* method) {
   DCHECK(!code_item_accessor_.HasCodeItem());
   DCHECK(method->IsIntrinsic());
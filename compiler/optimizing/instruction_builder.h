@@ -91,6 +91,9 @@ class HInstructionBuilder : public ValueObject {
 
   void AppendInstruction(HInstruction* instruction);
   void InsertInstructionAtTop(HInstruction* instruction);
+  void AppendCoverageProbe(uint8_t* block_flags,
+                           ArrayRef<const uint32_t> blocks,
+                           uint32_t block_dex_pc);
   void InitializeInstruction(HInstruction* instruction);
 
   void InitializeParameters();
@@ -1354,6 +1354,7 @@ class HLoopInformationOutwardIterator : public ValueObject {
   M(ClinitCheck, Instruction)                                           \
   M(Compare, BinaryOperation)                                           \
   M(ConstructorFence, Instruction)                                      \
+  M(CoverageProbe, Instruction)                                         \
   M(CurrentMethod, Instruction)                                         \
   M(ShouldDeoptimizeFlag, Instruction)                                  \
   M(Deoptimize, Instruction)                                            \
@@ -2131,7 +2132,9 @@ class HInstruction : public ArenaObject<kArenaAllocInstruction> {
         !IsParameterValue() &&
         // If we added an explicit barrier then we should keep it.
         !IsMemoryBarrier() &&
-        !IsConstructorFence();
+        !IsConstructorFence() &&
+        // Coverage probes only write to MiniTrace's coverage data, which Java code never reads.
+        !IsCoverageProbe();
   }
 
   bool IsDeadAndRemovable() const {
@@ -6007,6 +6010,33 @@ class HNativeDebugInfo : public HTemplateInstruction<0> {
   DEFAULT_COPY_CONSTRUCTOR(NativeDebugInfo);
 };
 
+// Pseudo-instruction which records in MiniTrace's coverage data that its basic block has been
+// executed, by setting the bits of `mask` in the byte at `address` if they are not set already.
+// The coverage data is not visible to Java code, so the probe has no side effects as far as
+// the optimizations are concerned; it is only kept alive by IsRemovable().
+class HCoverageProbe FINAL : public HTemplateInstruction<0> {
+ public:
+  HCoverageProbe(const uint8_t* address, uint8_t mask, uint32_t dex_pc)
+      : HTemplateInstruction<0>(kCoverageProbe, SideEffects::None(), dex_pc),
+        address_(reinterpret_cast<uintptr_t>(address)),
+        mask_(mask) {
+  }
+
+  bool IsClonable() const OVERRIDE { return true; }
+
+  uint64_t GetAddress() const { return address_; }
+  uint8_t GetMask() const { return mask_; }
+
+  DECLARE_INSTRUCTION(CoverageProbe);
+
+ protected:
+  DEFAULT_COPY_CONSTRUCTOR(CoverageProbe);
+
+ private:
+  const uint64_t address_;
+  const uint8_t mask_;
+};
+
 /**
  * Instruction to load a Class object.
  */
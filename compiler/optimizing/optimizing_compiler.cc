@@ -50,6 +50,7 @@
 #include "jit/jit_code_cache.h"
 #include "jit/jit_logger.h"
 #include "jni/quick/jni_compiler.h"
+#include "mini_trace.h"
 #include "linker/linker_patch.h"
 #include "nodes.h"
 #include "oat_quick_method_header.h"
@@ -1201,6 +1202,8 @@ bool OptimizingCompiler::JitCompile(Thread* self,
 
   Runtime* runtime = Runtime::Current();
   ArenaAllocator allocator(runtime->GetJitArenaPool());
+  // Read before building the graph, which adds coverage probes of the active MiniTrace.
+  const uint32_t mini_trace_generation = MiniTrace::GetCodeGeneration();
 
   if (UNLIKELY(method->IsNative())) {
     JniCompiledMethod jni_compiled_method = ArtQuickJniCompileMethod(
@@ -1223,7 +1226,8 @@ bool OptimizingCompiler::JitCompile(Thread* self,
         osr,
         roots,
         /* has_should_deoptimize_flag */ false,
-        cha_single_implementation_list);
+        cha_single_implementation_list,
+        mini_trace_generation);
     if (code == nullptr) {
       return false;
     }
@@ -1344,7 +1348,8 @@ bool OptimizingCompiler::JitCompile(Thread* self,
       osr,
       roots,
       codegen->GetGraph()->HasShouldDeoptimizeFlag(),
-      codegen->GetGraph()->GetCHASingleImplementationList());
+      codegen->GetGraph()->GetCHASingleImplementationList(),
+      mini_trace_generation);
 
   if (code == nullptr) {
     MaybeRecordStat(compilation_stats_.get(), MethodCompilationStat::kJitOutOfMemoryForCommit);
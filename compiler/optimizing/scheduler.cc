@@ -711,6 +711,7 @@ bool HScheduler::IsSchedulable(const HInstruction* instruction) const {
       instruction->IsBoundsCheck() ||
       instruction->IsCheckCast() ||
       instruction->IsClassTableGet() ||
+      instruction->IsCoverageProbe() ||
       instruction->IsCurrentMethod() ||
       instruction->IsDivZeroCheck() ||
       (instruction->IsInstanceFieldGet() && !instruction->AsInstanceFieldGet()->IsVolatile()) ||
@@ -621,6 +621,7 @@ class X86Assembler FINAL : public Assembler {
   void andl(Register dst, const Address& address);
 
   void orl(Register dst, const Immediate& imm);
+  void orb(const Address& dst, const Immediate& imm);
   void orl(Register dst, Register src);
   void orl(Register dst, const Address& address);
 
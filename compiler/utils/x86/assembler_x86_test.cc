@@ -464,6 +464,10 @@ TEST_F(AssemblerX86Test, TestbAddressImmediate) {
   DriverStr(RepeatAI(&x86::X86Assembler::testb, /*imm_bytes*/ 1U, "testb ${imm}, {mem}"), "testb");
 }
 
+TEST_F(AssemblerX86Test, OrbAddressImmediate) {
+  DriverStr(RepeatAI(&x86::X86Assembler::orb, /*imm_bytes*/ 1U, "orb ${imm}, {mem}"), "orb");
+}
+
 TEST_F(AssemblerX86Test, TestlAddressImmediate) {
   DriverStr(RepeatAI(&x86::X86Assembler::testl, /*imm_bytes*/ 4U, "testl ${imm}, {mem}"), "testl");
 }
@@ -1957,6 +1957,12 @@ TEST_F(AssemblerX86_64Test, TestbAddressImmediate) {
                      "testb ${imm}, {mem}"), "testbi");
 }
 
+TEST_F(AssemblerX86_64Test, OrbAddressImmediate) {
+  DriverStr(RepeatAI(&x86_64::X86_64Assembler::orb,
+                     /*imm_bytes*/ 1U,
+                     "orb ${imm}, {mem}"), "orbi");
+}
+
 TEST_F(AssemblerX86_64Test, TestlAddressImmediate) {
   DriverStr(RepeatAI(&x86_64::X86_64Assembler::testl,
                      /*imm_bytes*/ 4U,
@@ -23,6 +23,7 @@
 
 #include <android-base/logging.h>
 
+#include "base/atomic.h"
 #include "base/globals.h"
 #include "base/iteration_range.h"
 #include "base/macros.h"
@@ -570,16 +571,35 @@ class DexFile {
 
   virtual uint32_t GetCodeItemSize(const DexFile::CodeItem& disk_code_item) const = 0;
 
-  uint8_t* GetCoverageData(const uint32_t code_off) const {
-    if (code_off == 0) {
-      return nullptr;  // native or abstract method
-    } else {
-      uint8_t* addr = coverage_data_begin_ + code_off;
-      return addr;
+  // Returns the MiniTrace coverage data of the method with index `method_idx`, or null if it
+  // has not been allocated. The layout of the data is defined by MiniTrace.
+  uint8_t* GetCoverageData(uint32_t method_idx) const {
+    Atomic<uint8_t*>* table = GetCoverageTable();
+    if (table == nullptr) {
+      return nullptr;  // No method of this dex file has been traced.
     }
+    return table[method_idx].LoadAcquire();
   }
 
-  void InitCoverageData();
+  // Returns the table of MiniTrace coverage data indexed by method id, or null. The table
+  // and the data it points to are owned by MiniTrace.
+  Atomic<uint8_t*>* GetCoverageTable() const {
+    return coverage_table_.LoadAcquire();
+  }
+
+  void SetCoverageTable(Atomic<uint8_t*>* table) const {
+    coverage_table_.StoreRelease(table);
+  }
+
+  // Returns the MiniTrace field coverage, one byte per field id, or null if no field of this
+  // dex file has been traced. The layout of the bytes is defined by MiniTrace.
+  Atomic<uint8_t>* GetFieldCoverage() const {
+    return field_coverage_.LoadAcquire();
+  }
+
+  void SetFieldCoverage(Atomic<uint8_t>* field_coverage) const {
+    field_coverage_.StoreRelease(field_coverage);
+  }
 
   // Returns the declaring class descriptor string of a field id.
   const char* GetFieldDeclaringClassDescriptor(const FieldId& field_id) const {
@@ -1055,8 +1075,11 @@ class DexFile {
   // The size of the underlying memory allocation in bytes.
   const size_t size_;
 
-  // Coverage data
-  uint8_t* coverage_data_begin_;
+  // MiniTrace coverage data of each method id, set up while tracing.
+  mutable Atomic<Atomic<uint8_t*>*> coverage_table_;
+
+  // MiniTrace field coverage of each field id, set up while tracing.
+  mutable Atomic<Atomic<uint8_t>*> field_coverage_;
 
   // The base address of the data section (same as Begin() for standard dex).
   const uint8_t* const data_begin_;
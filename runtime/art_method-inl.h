@@ -33,6 +33,7 @@
 #include "gc_root-inl.h"
 #include "intrinsics_enum.h"
 #include "jit/profiling_info.h"
+#include "mini_trace.h"
 #include "mirror/class-inl.h"
 #include "mirror/dex_cache-inl.h"
 #include "mirror/object-inl.h"
@@ -256,16 +257,17 @@ inline bool ArtMethod::IsMiniTraceable() {
 
 inline void ArtMethod::VisitPc(uint32_t dex_pc) {
   uint8_t* coverage_data = GetCoverageData();
-  if (coverage_data == nullptr) {
-    return;
+  if (coverage_data != nullptr) {
+    MiniTrace::RecordExecution(coverage_data, dex_pc);
   }
-  coverage_data[dex_pc] = 1;
-  uint8_t* addr = coverage_data + dex_pc;
-  *addr = 1;
 }
 
 inline uint8_t* ArtMethod::GetCoverageData() {
-  return GetDexFile()->GetCoverageData(GetCodeItemOffset());
+  uint8_t* coverage_data = GetDexFile()->GetCoverageData(GetDexMethodIndex());
+  if (UNLIKELY(coverage_data == nullptr)) {
+    coverage_data = MiniTrace::AllocateCoverageData(this);
+  }
+  return coverage_data;
 }
 
 inline bool ArtMethod::IsResolvedTypeIdx(dex::TypeIndex type_idx) {
@@ -134,7 +134,9 @@ class ArtMethod FINAL {
   // MiniTrace
   ALWAYS_INLINE bool IsMiniTraceable() REQUIRES_SHARED(Locks::mutator_lock_);
   ALWAYS_INLINE void VisitPc(uint32_t dex_pc) REQUIRES_SHARED(Locks::mutator_lock_);
-  uint8_t* GetCoverageData() REQUIRES_SHARED(Locks::mutator_lock_);
+  // Returns the coverage data of this method, allocating it on first use. Returns null if the
+  // coverage of this method is not recorded.
+  ALWAYS_INLINE uint8_t* GetCoverageData() REQUIRES_SHARED(Locks::mutator_lock_);
 
   // Returns true if the method is declared public.
   bool IsPublic() {
@@ -94,10 +94,14 @@ enum LockLevel {
   kOatFileManagerLock,
   kTracingUniqueMethodsLock,
   kTracingStreamingLock,
+  kMiniTraceCallEdgeLock,
+  kMiniTraceCoverageLock,
   kDeoptimizedMethodsLock,
   kClassLoaderClassesLock,
   kDefaultMutexLevel,
   kDexLock,
+  kMiniTraceDumpLock,
+  kMiniTraceWriterLock,
   kMarkSweepLargeObjectLock,
   kJdwpObjectRegistryLock,
   kModifyLdtLock,
@@ -125,6 +129,7 @@ enum LockLevel {
   kHeapBitmapLock,
   kMutatorLock,
   kUserCodeSuspensionLock,
+  kMiniTraceIoLock,
   kInstrumentEntrypointsLock,
   kZygoteCreationLock,
 
@@ -86,6 +86,7 @@
 #include "jit/profile_compilation_info.h"
 #include "jni_internal.h"
 #include "linear_alloc.h"
+#include "mini_trace.h"
 #include "mirror/call_site.h"
 #include "mirror/class-inl.h"
 #include "mirror/class.h"
@@ -2920,6 +2921,11 @@ bool ClassLinker::ShouldUseInterpreterEntrypoint(ArtMethod* method, const void*
     return true;
   }
 
+  if (MiniTrace::RequiresInterpreter(method, quick_code)) {
+    // Only the interpreter and JIT code with coverage probes record coverage of traced methods.
+    return true;
+  }
+
   if (runtime->GetClassLinker()->IsQuickToInterpreterBridge(quick_code)) {
     // Doing this check avoids doing compiled/interpreter transitions.
     return true;
@@ -140,7 +140,9 @@ class EntrypointsOrderTest : public CommonRuntimeTest {
     EXPECT_OFFSET_DIFFP(Thread, tlsPtr_, flip_function, method_verifier, sizeof(void*));
     EXPECT_OFFSET_DIFFP(Thread, tlsPtr_, method_verifier, thread_local_mark_stack, sizeof(void*));
     EXPECT_OFFSET_DIFFP(Thread, tlsPtr_, thread_local_mark_stack, async_exception, sizeof(void*));
-    EXPECT_OFFSET_DIFF(Thread, tlsPtr_.async_exception, Thread, wait_mutex_, sizeof(void*),
+    EXPECT_OFFSET_DIFFP(Thread, tlsPtr_, async_exception, mini_trace_data, sizeof(void*));
+    EXPECT_OFFSET_DIFFP(Thread, tlsPtr_, mini_trace_data, method_trace_buffer, sizeof(void*));
+    EXPECT_OFFSET_DIFF(Thread, tlsPtr_.method_trace_buffer, Thread, wait_mutex_, sizeof(void*),
                        thread_tlsptr_end);
   }
 
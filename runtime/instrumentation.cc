@@ -37,6 +37,7 @@
 #include "jit/jit.h"
 #include "jit/jit_code_cache.h"
 #include "jvalue-inl.h"
+#include "mini_trace.h"
 #include "mirror/class-inl.h"
 #include "mirror/dex_cache.h"
 #include "mirror/object-inl.h"
@@ -164,7 +165,9 @@ void Instrumentation::InstallStubsForMethod(ArtMethod* method) {
   ClassLinker* const class_linker = runtime->GetClassLinker();
   bool is_class_initialized = method->GetDeclaringClass()->IsInitialized();
   if (uninstall) {
-    if ((forced_interpret_only_ || IsDeoptimized(method)) && !method->IsNative()) {
+    if ((forced_interpret_only_ || IsDeoptimized(method) ||
+         MiniTrace::RequiresCoverageProbes(method))
+        && !method->IsNative()) {
       new_quick_code = GetQuickToInterpreterBridge();
     } else if (is_class_initialized || !method->IsStatic() || method->IsConstructor()) {
       if (NeedDebugVersionFor(method)) {
@@ -176,8 +179,8 @@ void Instrumentation::InstallStubsForMethod(ArtMethod* method) {
       new_quick_code = GetQuickResolutionStub();
     }
   } else {  // !uninstall
-    if ((interpreter_stubs_installed_ || forced_interpret_only_ || IsDeoptimized(method)) &&
-        !method->IsNative()) {
+    if ((interpreter_stubs_installed_ || forced_interpret_only_ || IsDeoptimized(method) ||
+         MiniTrace::RequiresCoverageProbes(method)) && !method->IsNative()) {
       new_quick_code = GetQuickToInterpreterBridge();
     } else {
       // Do not overwrite resolution trampoline. When the trampoline initializes the method's
@@ -321,7 +324,7 @@ static void InstrumentationInstallStack(Thread* thread, void* arg)
       ++instrumentation_stack_depth_;
       return true;  // Continue.
     }
-    std::deque<InstrumentationStackFrame>* const instrumentation_stack_;
+    InstrumentationStack* const instrumentation_stack_;
     std::vector<InstrumentationStackFrame> shadow_stack_;
     std::vector<uint32_t> dex_pcs_;
     const uintptr_t instrumentation_exit_pc_;
@@ -436,7 +439,7 @@ static void InstrumentationRestoreStack(Thread* thread, void* arg)
     Thread* const thread_;
     const uintptr_t instrumentation_exit_pc_;
     Instrumentation* const instrumentation_;
-    std::deque<instrumentation::InstrumentationStackFrame>* const instrumentation_stack_;
+    instrumentation::InstrumentationStack* const instrumentation_stack_;
     size_t frames_removed_;
   };
   if (kVerboseInstrumentation) {
@@ -444,7 +447,7 @@ static void InstrumentationRestoreStack(Thread* thread, void* arg)
     thread->GetThreadName(thread_name);
     LOG(INFO) << "Removing exit stubs in " << thread_name;
   }
-  std::deque<instrumentation::InstrumentationStackFrame>* stack = thread->GetInstrumentationStack();
+  instrumentation::InstrumentationStack* stack = thread->GetInstrumentationStack();
   if (stack->size() > 0) {
     Instrumentation* instrumentation = reinterpret_cast<Instrumentation*>(arg);
     uintptr_t instrumentation_exit_pc =
@@ -452,9 +455,7 @@ static void InstrumentationRestoreStack(Thread* thread, void* arg)
     RestoreStackVisitor visitor(thread, instrumentation_exit_pc, instrumentation);
     visitor.WalkStack(true);
     CHECK_EQ(visitor.frames_removed_, stack->size());
-    while (stack->size() > 0) {
-      stack->pop_front();
-    }
+    stack->clear();
   }
 }
 
@@ -462,9 +463,47 @@ static bool HasEvent(Instrumentation::InstrumentationEvent expected, uint32_t ev
   return (events & expected) != 0;
 }
 
+void InstrumentationListeners::Add(InstrumentationListener* listener) {
+  size_t index = std::find(slots_, slots_ + capacity_, nullptr) - slots_;
+  if (index == capacity_) {
+    // Mutators may be iterating over the full array, keep it.
+    size_t new_capacity = std::max<size_t>(2u * capacity_, 4u);
+    Array array;
+    array.slots.reset(new InstrumentationListener*[new_capacity]());
+    array.capacity = new_capacity;
+    std::copy(slots_, slots_ + capacity_, array.slots.get());
+    slots_ = array.slots.get();
+    capacity_ = new_capacity;
+    arrays_.push_back(std::move(array));
+  }
+  slots_[index] = listener;
+  ++size_;
+  single_ = (size_ == 1u) ? listener : nullptr;
+}
+
+void InstrumentationListeners::Remove(InstrumentationListener* listener) {
+  size_t index = std::find(slots_, slots_ + capacity_, listener) - slots_;
+  if (index == capacity_) {
+    return;
+  }
+  // Just clear the slot, in the old arrays too. Mutators may still be iterating over them.
+  for (const Array& array : arrays_) {
+    if (index < array.capacity && array.slots[index] == listener) {
+      array.slots[index] = nullptr;
+    }
+  }
+  --size_;
+  single_ = nullptr;
+  if (size_ == 1u) {
+    single_ = *std::find_if(slots_,
+                            slots_ + capacity_,
+                            [](InstrumentationListener* l) { return l != nullptr; });
+  }
+}
+
 static void PotentiallyAddListenerTo(Instrumentation::InstrumentationEvent event,
                                      uint32_t events,
-                                     std::list<InstrumentationListener*>& list,
+                                     InstrumentationListeners& listeners,
                                      InstrumentationListener* listener,
                                      bool* has_listener)
     REQUIRES(Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::classlinker_classes_lock_) {
@@ -472,14 +511,7 @@ static void PotentiallyAddListenerTo(Instrumentation::InstrumentationEvent event
   if (!HasEvent(event, events)) {
     return;
   }
-  // If there is a free slot in the list, we insert the listener in that slot.
-  // Otherwise we add it to the end of the list.
-  auto it = std::find(list.begin(), list.end(), nullptr);
-  if (it != list.end()) {
-    *it = listener;
-  } else {
-    list.push_back(listener);
-  }
+  listeners.Add(listener);
   *has_listener = true;
 }
 
@@ -545,7 +577,7 @@ void Instrumentation::AddListener(InstrumentationListener* listener, uint32_t ev
 
 static void PotentiallyRemoveListenerFrom(Instrumentation::InstrumentationEvent event,
                                           uint32_t events,
-                                          std::list<InstrumentationListener*>& list,
+                                          InstrumentationListeners& listeners,
                                           InstrumentationListener* listener,
                                           bool* has_listener)
     REQUIRES(Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::classlinker_classes_lock_) {
@@ -553,21 +585,8 @@ static void PotentiallyRemoveListenerFrom(Instrumentation::InstrumentationEvent
   if (!HasEvent(event, events)) {
     return;
   }
-  auto it = std::find(list.begin(), list.end(), listener);
-  if (it != list.end()) {
-    // Just update the entry, do not remove from the list. Removing entries in the list
-    // is unsafe when mutators are iterating over it.
-    *it = nullptr;
-  }
-
-  // Check if the list contains any non-null listener, and update 'has_listener'.
-  for (InstrumentationListener* l : list) {
-    if (l != nullptr) {
-      *has_listener = true;
-      return;
-    }
-  }
-  *has_listener = false;
+  listeners.Remove(listener);
+  *has_listener = !listeners.IsEmpty();
 }
 
 void Instrumentation::RemoveListener(InstrumentationListener* listener, uint32_t events) {
@@ -775,7 +794,10 @@ void Instrumentation::ResetQuickAllocEntryPoints() {
 
 void Instrumentation::UpdateMethodsCodeImpl(ArtMethod* method, const void* quick_code) {
   const void* new_quick_code;
-  if (LIKELY(!instrumentation_stubs_installed_)) {
+  if (UNLIKELY(MiniTrace::RequiresInterpreter(method, quick_code))) {
+    // Coverage of traced methods is only recorded by the interpreter and by JIT code.
+    new_quick_code = GetQuickToInterpreterBridge();
+  } else if (LIKELY(!instrumentation_stubs_installed_)) {
     new_quick_code = quick_code;
   } else {
     if ((interpreter_stubs_installed_ || IsDeoptimized(method)) && !method->IsNative()) {
@@ -1013,11 +1035,10 @@ void Instrumentation::MethodEnterEventImpl(Thread* thread,
     Thread* self = Thread::Current();
     StackHandleScope<1> hs(self);
     Handle<mirror::Object> thiz(hs.NewHandle(this_object));
-    for (InstrumentationListener* listener : method_entry_listeners_) {
-      if (listener != nullptr) {
-        listener->MethodEntered(thread, thiz, method, dex_pc);
-      }
-    }
+    method_entry_listeners_.ForEach([&](InstrumentationListener* listener)
+        REQUIRES_SHARED(Locks::mutator_lock_) {
+      listener->MethodEntered(thread, thiz, method, dex_pc);
+    });
   }
 }
 
@@ -1032,18 +1053,16 @@ void Instrumentation::MethodExitEventImpl(Thread* thread,
     Handle<mirror::Object> thiz(hs.NewHandle(this_object));
     if (method->GetInterfaceMethodIfProxy(kRuntimePointerSize)
               ->GetReturnTypePrimitive() != Primitive::kPrimNot) {
-      for (InstrumentationListener* listener : method_exit_listeners_) {
-        if (listener != nullptr) {
-          listener->MethodExited(thread, thiz, method, dex_pc, return_value);
-        }
-      }
+      method_exit_listeners_.ForEach([&](InstrumentationListener* listener)
+          REQUIRES_SHARED(Locks::mutator_lock_) {
+        listener->MethodExited(thread, thiz, method, dex_pc, return_value);
+      });
     } else {
       Handle<mirror::Object> ret(hs.NewHandle(return_value.GetL()));
-      for (InstrumentationListener* listener : method_exit_listeners_) {
-        if (listener != nullptr) {
-          listener->MethodExited(thread, thiz, method, dex_pc, ret);
-        }
-      }
+      method_exit_listeners_.ForEach([&](InstrumentationListener* listener)
+          REQUIRES_SHARED(Locks::mutator_lock_) {
+        listener->MethodExited(thread, thiz, method, dex_pc, ret);
+      });
     }
   }
 }
@@ -1056,11 +1075,10 @@ void Instrumentation::MethodUnwindEvent(Thread* thread,
     Thread* self = Thread::Current();
     StackHandleScope<1> hs(self);
     Handle<mirror::Object> thiz(hs.NewHandle(this_object));
-    for (InstrumentationListener* listener : method_unwind_listeners_) {
-      if (listener != nullptr) {
-        listener->MethodUnwind(thread, thiz, method, dex_pc);
-      }
-    }
+    method_unwind_listeners_.ForEach([&](InstrumentationListener* listener)
+        REQUIRES_SHARED(Locks::mutator_lock_) {
+      listener->MethodUnwind(thread, thiz, method, dex_pc);
+    });
   }
 }
 
@@ -1071,22 +1089,20 @@ void Instrumentation::DexPcMovedEventImpl(Thread* thread,
   Thread* self = Thread::Current();
   StackHandleScope<1> hs(self);
   Handle<mirror::Object> thiz(hs.NewHandle(this_object));
-  for (InstrumentationListener* listener : dex_pc_listeners_) {
-    if (listener != nullptr) {
-      listener->DexPcMoved(thread, thiz, method, dex_pc);
-    }
-  }
+  dex_pc_listeners_.ForEach([&](InstrumentationListener* listener)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    listener->DexPcMoved(thread, thiz, method, dex_pc);
+  });
 }
 
 void Instrumentation::BranchImpl(Thread* thread,
                                  ArtMethod* method,
                                  uint32_t dex_pc,
                                  int32_t offset) const {
-  for (InstrumentationListener* listener : branch_listeners_) {
-    if (listener != nullptr) {
-      listener->Branch(thread, method, dex_pc, offset);
-    }
-  }
+  branch_listeners_.ForEach([&](InstrumentationListener* listener)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    listener->Branch(thread, method, dex_pc, offset);
+  });
 }
 
 void Instrumentation::InvokeVirtualOrInterfaceImpl(Thread* thread,
@@ -1097,19 +1113,17 @@ void Instrumentation::InvokeVirtualOrInterfaceImpl(Thread* thread,
   Thread* self = Thread::Current();
   StackHandleScope<1> hs(self);
   Handle<mirror::Object> thiz(hs.NewHandle(this_object));
-  for (InstrumentationListener* listener : invoke_virtual_or_interface_listeners_) {
-    if (listener != nullptr) {
-      listener->InvokeVirtualOrInterface(thread, thiz, caller, dex_pc, callee);
-    }
-  }
+  invoke_virtual_or_interface_listeners_.ForEach([&](InstrumentationListener* listener)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    listener->InvokeVirtualOrInterface(thread, thiz, caller, dex_pc, callee);
+  });
 }
 
 void Instrumentation::WatchedFramePopImpl(Thread* thread, const ShadowFrame& frame) const {
-  for (InstrumentationListener* listener : watched_frame_pop_listeners_) {
-    if (listener != nullptr) {
-      listener->WatchedFramePop(thread, frame);
-    }
-  }
+  watched_frame_pop_listeners_.ForEach([&](InstrumentationListener* listener)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    listener->WatchedFramePop(thread, frame);
+  });
 }
 
 void Instrumentation::FieldReadEventImpl(Thread* thread,
@@ -1120,11 +1134,10 @@ void Instrumentation::FieldReadEventImpl(Thread* thread,
   Thread* self = Thread::Current();
   StackHandleScope<1> hs(self);
   Handle<mirror::Object> thiz(hs.NewHandle(this_object));
-  for (InstrumentationListener* listener : field_read_listeners_) {
-    if (listener != nullptr) {
-      listener->FieldRead(thread, thiz, method, dex_pc, field);
-    }
-  }
+  field_read_listeners_.ForEach([&](InstrumentationListener* listener)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    listener->FieldRead(thread, thiz, method, dex_pc, field);
+  });
 }
 
 void Instrumentation::FieldWriteEventImpl(Thread* thread,
@@ -1137,18 +1150,16 @@ void Instrumentation::FieldWriteEventImpl(Thread* thread,
   StackHandleScope<2> hs(self);
   Handle<mirror::Object> thiz(hs.NewHandle(this_object));
   if (field->IsPrimitiveType()) {
-    for (InstrumentationListener* listener : field_write_listeners_) {
-      if (listener != nullptr) {
-        listener->FieldWritten(thread, thiz, method, dex_pc, field, field_value);
-      }
-    }
+    field_write_listeners_.ForEach([&](InstrumentationListener* listener)
+        REQUIRES_SHARED(Locks::mutator_lock_) {
+      listener->FieldWritten(thread, thiz, method, dex_pc, field, field_value);
+    });
   } else {
     Handle<mirror::Object> val(hs.NewHandle(field_value.GetL()));
-    for (InstrumentationListener* listener : field_write_listeners_) {
-      if (listener != nullptr) {
-        listener->FieldWritten(thread, thiz, method, dex_pc, field, val);
-      }
-    }
+    field_write_listeners_.ForEach([&](InstrumentationListener* listener)
+        REQUIRES_SHARED(Locks::mutator_lock_) {
+      listener->FieldWritten(thread, thiz, method, dex_pc, field, val);
+    });
   }
 }
 
@@ -1160,11 +1171,10 @@ void Instrumentation::ExceptionThrownEvent(Thread* thread,
   if (HasExceptionThrownListeners()) {
     DCHECK_EQ(thread->GetException(), h_exception.Get());
     thread->ClearException();
-    for (InstrumentationListener* listener : exception_thrown_listeners_) {
-      if (listener != nullptr) {
-        listener->ExceptionThrown(thread, h_exception);
-      }
-    }
+    exception_thrown_listeners_.ForEach([&](InstrumentationListener* listener)
+        REQUIRES_SHARED(Locks::mutator_lock_) {
+      listener->ExceptionThrown(thread, h_exception);
+    });
     // See b/65049545 for discussion about this behavior.
     thread->AssertNoPendingException();
     thread->SetException(h_exception.Get());
@@ -1179,11 +1189,10 @@ void Instrumentation::ExceptionHandledEvent(Thread* thread,
   if (HasExceptionHandledListeners()) {
     // We should have cleared the exception so that callers can detect a new one.
     DCHECK(thread->GetException() == nullptr);
-    for (InstrumentationListener* listener : exception_handled_listeners_) {
-      if (listener != nullptr) {
-        listener->ExceptionHandled(thread, h_exception);
-      }
-    }
+    exception_handled_listeners_.ForEach([&](InstrumentationListener* listener)
+        REQUIRES_SHARED(Locks::mutator_lock_) {
+      listener->ExceptionHandled(thread, h_exception);
+    });
   }
 }
 
@@ -1212,7 +1221,7 @@ void Instrumentation::PushInstrumentationStackFrame(Thread* self, mirror::Object
                                                     ArtMethod* method,
                                                     uintptr_t lr, bool interpreter_entry) {
   DCHECK(!self->IsExceptionPending());
-  std::deque<instrumentation::InstrumentationStackFrame>* stack = self->GetInstrumentationStack();
+  instrumentation::InstrumentationStack* stack = self->GetInstrumentationStack();
   if (kVerboseInstrumentation) {
     LOG(INFO) << "Entering " << ArtMethod::PrettyMethod(method) << " from PC "
               << reinterpret_cast<void*>(lr);
@@ -1305,7 +1314,7 @@ TwoWordReturn Instrumentation::PopInstrumentationStackFrame(Thread* self,
   DCHECK(gpr_result != nullptr);
   DCHECK(fpr_result != nullptr);
   // Do the pop.
-  std::deque<instrumentation::InstrumentationStackFrame>* stack = self->GetInstrumentationStack();
+  instrumentation::InstrumentationStack* stack = self->GetInstrumentationStack();
   CHECK_GT(stack->size(), 0U);
   InstrumentationStackFrame instrumentation_frame = stack->front();
   stack->pop_front();
@@ -1416,7 +1425,7 @@ TwoWordReturn Instrumentation::PopInstrumentationStackFrame(Thread* self,
 
 uintptr_t Instrumentation::PopMethodForUnwind(Thread* self, bool is_deoptimization) const {
   // Do the pop.
-  std::deque<instrumentation::InstrumentationStackFrame>* stack = self->GetInstrumentationStack();
+  instrumentation::InstrumentationStack* stack = self->GetInstrumentationStack();
   CHECK_GT(stack->size(), 0U);
   size_t idx = stack->size();
   InstrumentationStackFrame instrumentation_frame = stack->front();
@@ -18,8 +18,9 @@
 #define ART_RUNTIME_INSTRUMENTATION_H_
 
 #include <stdint.h>
-#include <list>
+#include <memory>
 #include <unordered_set>
+#include <vector>
 
 #include "arch/instruction_set.h"
 #include "base/enums.h"
@@ -158,6 +159,64 @@ struct InstrumentationListener {
       REQUIRES_SHARED(Locks::mutator_lock_) = 0;
 };
 
+// The listeners of one event, in a flat array of slots.
+//
+// Written to with the mutator_lock_ exclusively held. Mutators must be able to iterate over the
+// listeners while listeners are added or removed, as a listener call back may suspend. Mutators
+// cannot copy the listeners before iterating either, as the listeners can also be deleted
+// concurrently. So the slots of an array never move and removing a listener clears its slot.
+// When the array is full it is copied to a larger one, and the old arrays are kept, with removed
+// listeners cleared in them too, for the mutators still iterating over them. That's acceptable
+// given the low number of listeners we have.
+class InstrumentationListeners {
+ public:
+  InstrumentationListeners() : slots_(nullptr), capacity_(0u), size_(0u), single_(nullptr) {}
+
+  bool IsEmpty() const {
+    return size_ == 0u;
+  }
+
+  // Adds `listener` in the first free slot.
+  void Add(InstrumentationListener* listener);
+
+  // Removes the first occurrence of `listener`, if any.
+  void Remove(InstrumentationListener* listener);
+
+  // Calls `fn` with each listener. The listener is called directly if it is the only one.
+  template <typename Fn>
+  ALWAYS_INLINE void ForEach(const Fn& fn) const {
+    InstrumentationListener* single = single_;
+    if (LIKELY(single != nullptr)) {
+      fn(single);
+      return;
+    }
+    InstrumentationListener* const* slots = slots_;
+    const size_t capacity = capacity_;
+    for (size_t i = 0; i != capacity; ++i) {
+      // Reload the slot, an earlier listener may have let the listener be removed.
+      InstrumentationListener* listener = slots[i];
+      if (listener != nullptr) {
+        fn(listener);
+      }
+    }
+  }
+
+ private:
+  struct Array {
+    std::unique_ptr<InstrumentationListener*[]> slots;
+    size_t capacity;
+  };
+
+  // The current array is the last one.
+  std::vector<Array> arrays_;
+  InstrumentationListener** slots_;
+  size_t capacity_;
+  size_t size_;  // Listeners in the current array.
+  InstrumentationListener* single_;  // The listener if there is exactly one, null otherwise.
+
+  DISALLOW_COPY_AND_ASSIGN(InstrumentationListeners);
+};
+
 // Instrumentation is a catch-all for when extra information is required from the runtime. The
 // typical use for instrumentation is for profiling and debugging. Instrumentation may add stubs
 // to method entry and exit, it may also force execution to be switched to the interpreter and
@@ -672,27 +731,18 @@ class Instrumentation {
   InstrumentationLevelTable requested_instrumentation_levels_ GUARDED_BY(Locks::mutator_lock_);
 
   // The event listeners, written to with the mutator_lock_ exclusively held.
-  // Mutators must be able to iterate over these lists concurrently, that is, with listeners being
-  // added or removed while iterating. The modifying thread holds exclusive lock,
-  // so other threads cannot iterate (i.e. read the data of the list) at the same time but they
-  // do keep iterators that need to remain valid. This is the reason these listeners are std::list
-  // and not for example std::vector: the existing storage for a std::list does not move.
-  // Note that mutators cannot make a copy of these lists before iterating, as the instrumentation
-  // listeners can also be deleted concurrently.
-  // As a result, these lists are never trimmed. That's acceptable given the low number of
-  // listeners we have.
-  std::list<InstrumentationListener*> method_entry_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> method_exit_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> method_unwind_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> branch_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> invoke_virtual_or_interface_listeners_
+  InstrumentationListeners method_entry_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners method_exit_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners method_unwind_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners branch_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners invoke_virtual_or_interface_listeners_
       GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> dex_pc_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> field_read_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> field_write_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> exception_thrown_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> watched_frame_pop_listeners_ GUARDED_BY(Locks::mutator_lock_);
-  std::list<InstrumentationListener*> exception_handled_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners dex_pc_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners field_read_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners field_write_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners exception_thrown_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners watched_frame_pop_listeners_ GUARDED_BY(Locks::mutator_lock_);
+  InstrumentationListeners exception_handled_listeners_ GUARDED_BY(Locks::mutator_lock_);
 
   // The set of methods being deoptimized (by the debugger) which must be executed with interpreter
   // only.
@@ -742,6 +792,67 @@ struct InstrumentationStackFrame {
   bool interpreter_entry_;
 };
 
+// The instrumentation frames of a thread, innermost first. The frames are kept outermost first
+// in a contiguous array that keeps its capacity, so that pushing and popping frames on method
+// entry and exit does not allocate once the thread reached its deepest stack.
+class InstrumentationStack {
+ public:
+  using Frames = std::vector<InstrumentationStackFrame>;
+  // Innermost frame first.
+  using iterator = Frames::reverse_iterator;
+  using const_iterator = Frames::const_reverse_iterator;
+  // Outermost frame first.
+  using reverse_iterator = Frames::iterator;
+
+  size_t size() const {
+    return frames_.size();
+  }
+
+  bool empty() const {
+    return frames_.empty();
+  }
+
+  // The innermost frame.
+  InstrumentationStackFrame& front() {
+    DCHECK(!frames_.empty());
+    return frames_.back();
+  }
+
+  // The frame `depth` frames out from the innermost one.
+  InstrumentationStackFrame& at(size_t depth) {
+    DCHECK_LT(depth, frames_.size());
+    return frames_[frames_.size() - 1u - depth];
+  }
+
+  void push_front(const InstrumentationStackFrame& frame) {
+    frames_.push_back(frame);
+  }
+
+  void pop_front() {
+    DCHECK(!frames_.empty());
+    frames_.pop_back();
+  }
+
+  // Inserts `frame` just inside of `position`.
+  void insert(iterator position, const InstrumentationStackFrame& frame) {
+    frames_.insert(position.base(), frame);
+  }
+
+  void clear() {
+    frames_.clear();
+  }
+
+  iterator begin() { return frames_.rbegin(); }
+  iterator end() { return frames_.rend(); }
+  const_iterator begin() const { return frames_.rbegin(); }
+  const_iterator end() const { return frames_.rend(); }
+  reverse_iterator rbegin() { return frames_.begin(); }
+  reverse_iterator rend() { return frames_.end(); }
+
+ private:
+  Frames frames_;
+};
+
 }  // namespace instrumentation
 }  // namespace art
 
@@ -1003,5 +1003,102 @@ TEST_F(InstrumentationTest, MultiConfigureStubs_InterpreterThenInstrumentationSt
   CHECK_INSTRUMENTATION(Instrumentation::InstrumentationLevel::kInstrumentNothing, 0U);
 }
 
+static std::vector<InstrumentationListener*> GetListeners(const InstrumentationListeners& list) {
+  std::vector<InstrumentationListener*> listeners;
+  list.ForEach([&](InstrumentationListener* listener) { listeners.push_back(listener); });
+  return listeners;
+}
+
+TEST(InstrumentationListenersTest, AddRemove) {
+  using Listeners = std::vector<InstrumentationListener*>;
+  TestInstrumentationListener listeners[6];
+  InstrumentationListeners list;
+  EXPECT_TRUE(list.IsEmpty());
+  EXPECT_EQ(Listeners(), GetListeners(list));
+
+  list.Add(&listeners[0]);
+  EXPECT_FALSE(list.IsEmpty());
+  EXPECT_EQ(Listeners({ &listeners[0] }), GetListeners(list));
+  // Outgrow the first array.
+  for (size_t i = 1; i != 6; ++i) {
+    list.Add(&listeners[i]);
+  }
+  EXPECT_EQ(Listeners({ &listeners[0], &listeners[1], &listeners[2], &listeners[3], &listeners[4],
+                        &listeners[5] }),
+            GetListeners(list));
+
+  list.Remove(&listeners[1]);
+  list.Remove(&listeners[1]);  // Not a listener any more.
+  EXPECT_EQ(Listeners({ &listeners[0], &listeners[2], &listeners[3], &listeners[4],
+                        &listeners[5] }),
+            GetListeners(list));
+  // Free slots are reused.
+  list.Add(&listeners[1]);
+  EXPECT_EQ(Listeners({ &listeners[0], &listeners[1], &listeners[2], &listeners[3], &listeners[4],
+                        &listeners[5] }),
+            GetListeners(list));
+
+  for (size_t i = 0; i != 5; ++i) {
+    list.Remove(&listeners[i]);
+  }
+  EXPECT_EQ(Listeners({ &listeners[5] }), GetListeners(list));
+  list.Remove(&listeners[5]);
+  EXPECT_TRUE(list.IsEmpty());
+  EXPECT_EQ(Listeners(), GetListeners(list));
+}
+
+TEST(InstrumentationListenersTest, RemoveWhileIterating) {
+  // A listener removed by an earlier one is not called, even after the array was replaced.
+  TestInstrumentationListener listeners[5];
+  InstrumentationListeners list;
+  for (size_t i = 0; i != 4; ++i) {
+    list.Add(&listeners[i]);
+  }
+  std::vector<InstrumentationListener*> called;
+  list.ForEach([&](InstrumentationListener* listener) {
+    called.push_back(listener);
+    if (listener == &listeners[0]) {
+      list.Add(&listeners[4]);
+      list.Remove(&listeners[2]);
+    }
+  });
+  EXPECT_EQ(std::vector<InstrumentationListener*>({ &listeners[0], &listeners[1], &listeners[3] }),
+            called);
+  EXPECT_EQ(std::vector<InstrumentationListener*>({ &listeners[0], &listeners[1], &listeners[3],
+                                                    &listeners[4] }),
+            GetListeners(list));
+}
+
+static std::vector<size_t> GetFrameIds(InstrumentationStack& stack) {
+  std::vector<size_t> frame_ids;
+  for (const InstrumentationStackFrame& frame : stack) {
+    frame_ids.push_back(frame.frame_id_);
+  }
+  return frame_ids;
+}
+
+TEST(InstrumentationStackTest, PushPopInsert) {
+  // Frames are innermost first, like the return pcs found by a stack walk.
+  InstrumentationStack stack;
+  for (size_t i = 1; i <= 100; ++i) {
+    stack.push_front(InstrumentationStackFrame(nullptr, nullptr, i, 10u * i, false));
+  }
+  for (size_t i = 100; i > 3; --i) {
+    EXPECT_EQ(10u * i, stack.front().frame_id_);
+    stack.pop_front();
+  }
+  EXPECT_EQ((std::vector<size_t>{30u, 20u, 10u}), GetFrameIds(stack));
+  EXPECT_EQ(20u, stack.at(1).frame_id_);
+  EXPECT_EQ(10u, stack.rbegin()->frame_id_);
+
+  // Frames are inserted where their frame id keeps the frame ids in descending order.
+  stack.insert(stack.begin() + 1, InstrumentationStackFrame(nullptr, nullptr, 0u, 25u, false));
+  stack.insert(stack.end(), InstrumentationStackFrame(nullptr, nullptr, 0u, 5u, false));
+  EXPECT_EQ((std::vector<size_t>{30u, 25u, 20u, 10u, 5u}), GetFrameIds(stack));
+
+  stack.clear();
+  EXPECT_TRUE(stack.empty());
+}
+
 }  // namespace instrumentation
 }  // namespace art
@@ -121,8 +121,8 @@ bool DoCall(ArtMethod* called_method, Thread* self, ShadowFrame& shadow_frame,
             const Instruction* inst, uint16_t inst_data, JValue* result);
 
 // Handles streamlined non-range invoke static, direct and virtual instructions originating in
-// mterp. Access checks and instrumentation other than jit profiling are not supported, but does
-// support interpreter intrinsics if applicable.
+// mterp. Access checks and instrumentation other than jit profiling and invoke listeners are not
+// supported, but does support interpreter intrinsics if applicable.
 // Returns true on success, otherwise throws an exception and returns false.
 template<InvokeType type>
 static inline bool DoFastInvoke(Thread* self,
@@ -152,6 +152,13 @@ static inline bool DoFastInvoke(Thread* self,
     if (jit != nullptr && type == kVirtual) {
       jit->InvokeVirtualOrInterface(receiver, sf_method, shadow_frame.GetDexPC(), called_method);
     }
+    if (type == kVirtual) {
+      instrumentation::Instrumentation* instrumentation = Runtime::Current()->GetInstrumentation();
+      if (UNLIKELY(instrumentation->HasInvokeVirtualOrInterfaceListeners())) {
+        instrumentation->InvokeVirtualOrInterface(
+            self, receiver.Ptr(), sf_method, shadow_frame.GetDexPC(), called_method);
+      }
+    }
     if (called_method->IsIntrinsic()) {
       if (MterpHandleIntrinsic(&shadow_frame, called_method, inst, inst_data,
                                shadow_frame.GetResultRegister())) {
@@ -23,6 +23,7 @@
 #include "interpreter_common.h"
 #include "jit/jit.h"
 #include "jvalue-inl.h"
+#include "mini_trace.h"
 #include "safe_math.h"
 
 namespace art {
@@ -210,7 +211,12 @@ void ExecuteSwitchImplCpp(SwitchImplContext* ctx) {
   self->VerifyStack();
 
   uint32_t dex_pc = shadow_frame.GetDexPC();
-  const bool mini_trace = shadow_frame.GetMethod()->IsMiniTraceable();
+  // Resolve the coverage data of the method once for the frame. If the trace stops before the
+  // frame returns, the data stays mapped (see MiniTrace::retired_coverage_maps_).
+  uint8_t* const coverage_data =
+      (MiniTrace::IsMiniTraceActive() && shadow_frame.GetMethod()->IsMiniTraceable())
+          ? shadow_frame.GetMethod()->GetCoverageData()
+          : nullptr;
   const auto* const instrumentation = Runtime::Current()->GetInstrumentation();
   const uint16_t* const insns = accessor.Insns();
   const Instruction* inst = Instruction::At(insns + dex_pc);
@@ -221,7 +227,7 @@ void ExecuteSwitchImplCpp(SwitchImplContext* ctx) {
     dex_pc = inst->GetDexPc(insns);
     shadow_frame.SetDexPC(dex_pc);
     TraceExecution(shadow_frame, inst, dex_pc);
-    if (UNLIKELY(mini_trace)) shadow_frame.GetMethod()->VisitPc(dex_pc);
+    if (UNLIKELY(coverage_data != nullptr)) MiniTrace::RecordExecution(coverage_data, dex_pc);
     inst_data = inst->Fetch16(0);
     switch (inst->Opcode(inst_data)) {
       case Instruction::NOP:
@@ -50,7 +50,18 @@ void CheckMterpAsmConstants() {
 void InitMterpTls(Thread* self) {
   self->SetMterpDefaultIBase(artMterpAsmInstructionStart);
   self->SetMterpAltIBase(artMterpAsmAltInstructionStart);
-  self->SetMterpCurrentIBase((kTraceExecutionEnabled || kTestExportPC) ?
+  UpdateMterpCurrentIBase(self);
+}
+
+/*
+ * MiniTrace records coverage from MterpCheckBefore, so while it is active every
+ * instruction is dispatched through the alternate handler table.  Mterp reloads
+ * rIBASE from the thread on method entry and in every alternate stub, so the
+ * switch takes effect without leaving the assembly interpreter.
+ */
+void UpdateMterpCurrentIBase(Thread* self) {
+  self->SetMterpCurrentIBase((kTraceExecutionEnabled || kTestExportPC ||
+                              MiniTrace::IsMiniTraceActive()) ?
                              artMterpAsmAltInstructionStart :
                              artMterpAsmInstructionStart);
 }
@@ -152,7 +163,6 @@ extern "C" size_t MterpShouldSwitchInterpreters()
   const instrumentation::Instrumentation* const instrumentation = runtime->GetInstrumentation();
   return instrumentation->NonJitProfilingActive() ||
       Dbg::IsDebuggerActive() ||
-      MiniTrace::IsMiniTraceActive() ||
       // An async exception has been thrown. We need to go to the switch interpreter. MTerp doesn't
       // know how to deal with these so we could end up never dealing with it if we are in an
       // infinite loop. Since this can be called in a tight loop and getting the current thread
@@ -339,6 +349,15 @@ extern "C" size_t MterpInvokeVirtualQuick(Thread* self,
           jit->InvokeVirtualOrInterface(
               receiver, shadow_frame->GetMethod(), shadow_frame->GetDexPC(), called_method);
         }
+        instrumentation::Instrumentation* instrumentation =
+            Runtime::Current()->GetInstrumentation();
+        if (UNLIKELY(instrumentation->HasInvokeVirtualOrInterfaceListeners())) {
+          instrumentation->InvokeVirtualOrInterface(self,
+                                                    receiver.Ptr(),
+                                                    shadow_frame->GetMethod(),
+                                                    shadow_frame->GetDexPC(),
+                                                    called_method);
+        }
         return !self->IsExceptionPending();
       }
     }
@@ -590,6 +609,12 @@ extern "C" void MterpCheckBefore(Thread* self, ShadowFrame* shadow_frame, uint16
     uint32_t dex_pc = dex_pc_ptr - shadow_frame->GetDexInstructions();
     TraceExecution(*shadow_frame, inst, dex_pc);
   }
+  if (UNLIKELY(MiniTrace::IsMiniTraceActive())) {
+    ArtMethod* method = shadow_frame->GetMethod();
+    if (method->IsMiniTraceable()) {
+      method->VisitPc(dex_pc_ptr - shadow_frame->GetDexInstructions());
+    }
+  }
   if (kTestExportPC) {
     // Save invalid dex pc to force segfault if improperly used.
     shadow_frame->SetDexPCPtr(reinterpret_cast<uint16_t*>(kExportPCPoison));
@@ -35,6 +35,7 @@ class Thread;
 namespace interpreter {
 
 void InitMterpTls(Thread* self);
+void UpdateMterpCurrentIBase(Thread* self);
 void CheckMterpAsmConstants();
 
 // The return type should be 'bool' but our assembly stubs expect 'bool'
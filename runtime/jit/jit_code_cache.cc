@@ -38,6 +38,7 @@
 #include "jit/profiling_info.h"
 #include "linear_alloc.h"
 #include "mem_map.h"
+#include "mini_trace.h"
 #include "oat_file-inl.h"
 #include "oat_quick_method_header.h"
 #include "object_callbacks.h"
@@ -396,7 +397,8 @@ uint8_t* JitCodeCache::CommitCode(Thread* self,
                                   bool osr,
                                   Handle<mirror::ObjectArray<mirror::Object>> roots,
                                   bool has_should_deoptimize_flag,
-                                  const ArenaSet<ArtMethod*>& cha_single_implementation_list) {
+                                  const ArenaSet<ArtMethod*>& cha_single_implementation_list,
+                                  uint32_t mini_trace_generation) {
   uint8_t* result = CommitCodeInternal(self,
                                        method,
                                        stack_map,
@@ -411,7 +413,8 @@ uint8_t* JitCodeCache::CommitCode(Thread* self,
                                        osr,
                                        roots,
                                        has_should_deoptimize_flag,
-                                       cha_single_implementation_list);
+                                       cha_single_implementation_list,
+                                       mini_trace_generation);
   if (result == nullptr) {
     // Retry.
     GarbageCollectCache(self);
@@ -429,7 +432,8 @@ uint8_t* JitCodeCache::CommitCode(Thread* self,
                                 osr,
                                 roots,
                                 has_should_deoptimize_flag,
-                                cha_single_implementation_list);
+                                cha_single_implementation_list,
+                                mini_trace_generation);
   }
   return result;
 }
@@ -737,7 +741,8 @@ uint8_t* JitCodeCache::CommitCodeInternal(Thread* self,
                                           Handle<mirror::ObjectArray<mirror::Object>> roots,
                                           bool has_should_deoptimize_flag,
                                           const ArenaSet<ArtMethod*>&
-                                              cha_single_implementation_list) {
+                                              cha_single_implementation_list,
+                                          uint32_t mini_trace_generation) {
   DCHECK_NE(stack_map != nullptr, method->IsNative());
   DCHECK(!method->IsNative() || !osr);
   size_t alignment = GetInstructionSetAlignment(kRuntimeISA);
@@ -810,6 +815,14 @@ uint8_t* JitCodeCache::CommitCodeInternal(Thread* self,
     DCHECK(cha_single_implementation_list.empty() || !Runtime::Current()->IsJavaDebuggable())
         << "Should not be using cha on debuggable apps/runs!";
 
+    // A MiniTrace that started during the compilation needs code with its own coverage probes.
+    // The generation only changes while all threads are suspended.
+    if (!method->IsNative() && mini_trace_generation != MiniTrace::GetCodeGeneration()) {
+      VLOG(jit) << "JIT discarded jitted code compiled before a MiniTrace started.";
+      ClearMethodCounter(method, /*was_warm*/ false);
+      return nullptr;
+    }
+
     for (ArtMethod* single_impl : cha_single_implementation_list) {
       Runtime::Current()->GetClassLinker()->GetClassHierarchyAnalysis()->AddDependency(
           single_impl, method, method_header);
@@ -850,6 +863,13 @@ uint8_t* JitCodeCache::CommitCodeInternal(Thread* self,
         number_of_osr_compilations_++;
         osr_code_map_.Put(method, code_ptr);
       } else {
+        if (MiniTrace::RequiresCoverageProbes(method)) {
+          // Let MiniTrace::RequiresInterpreter() tell this code from code without probes.
+          ProfilingInfo* info = method->GetProfilingInfo(kRuntimePointerSize);
+          if (info != nullptr) {
+            info->SetCoverageEntryPoint(mini_trace_generation, method_header->GetEntryPoint());
+          }
+        }
         Runtime::Current()->GetInstrumentation()->UpdateMethodsCode(
             method, method_header->GetEntryPoint());
       }
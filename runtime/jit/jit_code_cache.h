@@ -128,7 +128,8 @@ class JitCodeCache {
   // still valid), since the compiled code still needs to be invalidated if the
   // single-implementation assumptions are violated later. This needs to be done
   // even if `has_should_deoptimize_flag` is false, which can happen due to CHA
-  // guard elimination.
+  // guard elimination. `mini_trace_generation` is the MiniTrace code generation
+  // the compilation started in, the code is discarded if a trace started since.
   uint8_t* CommitCode(Thread* self,
                       ArtMethod* method,
                       uint8_t* stack_map,
@@ -143,7 +144,8 @@ class JitCodeCache {
                       bool osr,
                       Handle<mirror::ObjectArray<mirror::Object>> roots,
                       bool has_should_deoptimize_flag,
-                      const ArenaSet<ArtMethod*>& cha_single_implementation_list)
+                      const ArenaSet<ArtMethod*>& cha_single_implementation_list,
+                      uint32_t mini_trace_generation)
       REQUIRES_SHARED(Locks::mutator_lock_)
       REQUIRES(!lock_);
 
@@ -291,7 +293,8 @@ class JitCodeCache {
                               bool osr,
                               Handle<mirror::ObjectArray<mirror::Object>> roots,
                               bool has_should_deoptimize_flag,
-                              const ArenaSet<ArtMethod*>& cha_single_implementation_list)
+                              const ArenaSet<ArtMethod*>& cha_single_implementation_list,
+                              uint32_t mini_trace_generation)
       REQUIRES(!lock_)
       REQUIRES_SHARED(Locks::mutator_lock_);
 
@@ -31,7 +31,9 @@ ProfilingInfo::ProfilingInfo(ArtMethod* method, const std::vector<uint32_t>& ent
         is_method_being_compiled_(false),
         is_osr_method_being_compiled_(false),
         current_inline_uses_(0),
-        saved_entry_point_(nullptr) {
+        saved_entry_point_(nullptr),
+        coverage_generation_(0u),
+        coverage_entry_point_(nullptr) {
   memset(&cache_, 0, number_of_inline_caches_ * sizeof(InlineCache));
   for (size_t i = 0; i < number_of_inline_caches_; ++i) {
     cache_[i].dex_pc_ = entries[i];
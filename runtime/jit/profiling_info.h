@@ -99,6 +99,19 @@ class ProfilingInfo {
     return saved_entry_point_;
   }
 
+  // Records that `entry_point` has the coverage probes of MiniTrace code generation
+  // `generation`. Set under the JIT code cache lock.
+  void SetCoverageEntryPoint(uint32_t generation, const void* entry_point) {
+    coverage_generation_ = generation;
+    coverage_entry_point_ = entry_point;
+  }
+
+  bool HasCoverageProbes(uint32_t generation, const void* entry_point) const {
+    return entry_point != nullptr &&
+        coverage_entry_point_ == entry_point &&
+        coverage_generation_ == generation;
+  }
+
   void ClearGcRootsInInlineCaches() {
     for (size_t i = 0; i < number_of_inline_caches_; ++i) {
       InlineCache* cache = &cache_[i];
@@ -154,6 +167,10 @@ class ProfilingInfo {
   // is poking for the liveness of compiled code.
   const void* saved_entry_point_;
 
+  // Compiled code with MiniTrace coverage probes and the code generation of those probes.
+  uint32_t coverage_generation_;
+  const void* coverage_entry_point_;
+
   // Dynamically allocated array of size `number_of_inline_caches_`.
   InlineCache cache_[0];
 
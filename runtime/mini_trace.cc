@@ -17,21 +17,32 @@
 #include "mini_trace.h"
 
 
+#include <algorithm>
+#include <deque>
 #include <fstream>
+#include <iterator>
+#include <limits>
+#include <sys/mman.h>
 #include <sys/uio.h>
 #include <grp.h>
 #include <unistd.h>
 #include <stdlib.h>
 
+#include "android-base/parseint.h"
 #include "android-base/stringprintf.h"
+#include "android-base/strings.h"
 
+#include "base/file_utils.h"
 #include "base/os.h"
 #include "base/stl_util.h"
 #include "base/unix_file/fd_file.h"
 #include "class_linker.h"
 #include "common_throws.h"
 #include "debugger.h"
+#include "dex/bytecode_utils.h"
+#include "dex/code_item_accessors-inl.h"
 #include "dex/dex_file-inl.h"
+#include "dex/dex_file_exception_helpers.h"
 #include "dex/descriptors_names.h"
 #include "instrumentation.h"
 #include "art_method-inl.h"
@@ -41,6 +52,12 @@
 #include "mirror/object_array-inl.h"
 #include "mirror/object-inl.h"
 #include "gc/scoped_gc_critical_section.h"
+#include "interpreter/mterp/mterp.h"
+#include "jit/jit.h"
+#include "jit/jit_code_cache.h"
+#include "jit/profiling_info.h"
+#include "mem_map.h"
+#include "mini_trace_writer.h"
 #include "scoped_thread_state_change.h"
 #include "nativehelper/scoped_local_ref.h"
 #include "thread.h"
@@ -54,101 +71,765 @@ namespace art {
 
 using android::base::StringPrintf;
 
-// MiniTrace
+// Size of the maps coverage data is allocated from.
+static constexpr size_t kCoverageMapSize = 1 * MB;
+
+// How often the writer thread checks the amount of new coverage for `flush_new_coverage`.
+static constexpr int64_t kNewCoveragePollMs = 100;
+
+// Prefix of the config and output files.
+static constexpr const char* kTraceBaseFilename = "/data/mini_trace_";
+
+// How often the writer thread writes the recorded events.
+static constexpr int64_t kEventDrainMs = 50;
 
-static constexpr const char* kMiniTracerInstrumentationKey = "MiniTracer";
+// Returns the timestamp of events, cheap enough to take on every method entry.
+static inline uint64_t ReadTimestamp() {
+#if defined(__i386__) || defined(__x86_64__)
+  uint32_t low;
+  uint32_t high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return (static_cast<uint64_t>(high) << 32) | low;
+#elif defined(__aarch64__)
+  uint64_t value;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+#else
+  return NanoTime();
+#endif
+}
+
+// Writes the records naming method `method_idx` of `dex_file` unless they are live in the ring
+// already. Only the dex file is used, the method may belong to an unloaded class.
+static void WriteMethodNames(MiniTraceRingWriter* writer,
+                             const DexFile& dex_file,
+                             uint32_t method_idx) {
+  const uint32_t checksum = dex_file.GetLocationChecksum();
+  writer->MaybeWriteDexFile(checksum, dex_file.GetLocation().c_str());
+  if (writer->NeedsMethodNames(checksum, method_idx)) {
+    const DexFile::MethodId& method_id = dex_file.GetMethodId(method_idx);
+    const DexFile::ClassDef* class_def = dex_file.FindClassDef(method_id.class_idx_);
+    const char* source_file = (class_def != nullptr) ? dex_file.GetSourceFile(*class_def) : nullptr;
+    writer->WriteMethodNames(checksum,
+                             method_idx,
+                             PrettyDescriptor(dex_file.GetMethodDeclaringClassDescriptor(method_id))
+                                 .c_str(),
+                             dex_file.GetMethodName(method_id),
+                             dex_file.GetMethodSignature(method_id).ToString().c_str(),
+                             source_file != nullptr ? source_file : "");
+  }
+}
+
+// MiniTrace
 
 MiniTrace* volatile MiniTrace::the_trace_ = nullptr;
+uint32_t MiniTrace::code_generation_ = 0u;
+std::vector<std::unique_ptr<MemMap>>* MiniTrace::retired_coverage_maps_ = nullptr;
 MiniTrace::MiniTraceClassLoadCallback MiniTrace::class_load_callback_;
 
+// The rules of a trace applied to the loaded classes. Start() works them out before it
+// suspends all threads so that the pause only looks up the result for most classes. Classes
+// are identified by their dex file and class def, which the GC does not move.
+class MiniTraceClassRules {
+ public:
+  explicit MiniTraceClassRules(const MiniTraceOptions& options) : options_(options) {}
+
+  bool IsTraceable(mirror::Class* klass) REQUIRES_SHARED(Locks::mutator_lock_) {
+    const DexFile& dex_file = klass->GetDexFile();
+    auto it = dex_files_.find(&dex_file);
+    if (it == dex_files_.end()) {
+      DexFileRules rules;
+      rules.traceable = MiniTrace::IsDexFileTraceable(options_, dex_file.GetLocation().c_str());
+      if (rules.traceable) {
+        rules.classes.resize(dex_file.NumClassDefs(), kUnknown);
+      }
+      it = dex_files_.emplace(&dex_file, std::move(rules)).first;
+    }
+    if (!it->second.traceable) {
+      return false;
+    }
+    ClassVerdict& verdict = it->second.classes[klass->GetDexClassDefIndex()];
+    if (verdict == kUnknown) {
+      std::string temp;
+      verdict = MiniTrace::IsClassNameTraceable(options_, klass->GetDescriptor(&temp))
+          ? kTraceable
+          : kNotTraceable;
+    }
+    return verdict == kTraceable;
+  }
+
+ private:
+  enum ClassVerdict : uint8_t {
+    kUnknown,
+    kTraceable,
+    kNotTraceable,
+  };
+
+  struct DexFileRules {
+    bool traceable;
+    // Indexed by class def, only for traceable dex files.
+    std::vector<ClassVerdict> classes;
+  };
+
+  const MiniTraceOptions& options_;
+  std::unordered_map<const DexFile*, DexFileRules> dex_files_;
+};
+
+// Applies the rules to the classes loaded before Start(), without changing them.
+class ApplyClassRulesVisitor : public ClassVisitor {
+ public:
+  explicit ApplyClassRulesVisitor(MiniTraceClassRules* rules) : rules_(rules) {}
+
+  bool operator()(ObjPtr<mirror::Class> klass) OVERRIDE REQUIRES_SHARED(Locks::mutator_lock_) {
+    if (MiniTrace::CanTraceClass(klass.Ptr())) {
+      rules_->IsTraceable(klass.Ptr());
+    }
+    return true;
+  }
+
+ private:
+  MiniTraceClassRules* const rules_;
+};
+
+// Marks the classes selected by the rules as traceable, in the pause of Start().
 class PostClassPrepareClassVisitor : public ClassVisitor {
  public:
+  explicit PostClassPrepareClassVisitor(MiniTraceClassRules* rules) : rules_(rules) {}
+
   bool operator()(ObjPtr<mirror::Class> klass) OVERRIDE REQUIRES(Locks::mutator_lock_) {
-    MiniTrace::PostClassPrepare(klass.Ptr());
+    if (MiniTrace::CanTraceClass(klass.Ptr())) {
+      MiniTrace::SetClassTraceable(klass.Ptr(), rules_->IsTraceable(klass.Ptr()));
+    }
     return true;
   }
+
+ private:
+  MiniTraceClassRules* const rules_;
 };
 
-class DumpCoverageDataClassVisitor: public ClassVisitor {
+class RestoreStubsClassVisitor : public ClassVisitor {
  public:
-  explicit DumpCoverageDataClassVisitor(std::ostream* os)
-      : os_(os) {}
-
   bool operator()(ObjPtr<mirror::Class> klass) OVERRIDE REQUIRES(Locks::mutator_lock_) {
+    if (klass->IsMiniTraceable()) {
+      Runtime::Current()->GetInstrumentation()->InstallStubsForClass(klass.Ptr());
+    }
+    return true;
+  }
+};
+
+static void UpdateMterpCurrentIBase(Thread* thread, void* arg ATTRIBUTE_UNUSED) {
+  interpreter::UpdateMterpCurrentIBase(thread);
+}
+
+static void ClearMiniTraceData(Thread* thread, void* arg ATTRIBUTE_UNUSED) {
+  thread->SetMiniTraceData(nullptr);
+}
+
+class CollectTraceableMethodsClassVisitor : public ClassVisitor {
+ public:
+  explicit CollectTraceableMethodsClassVisitor(std::vector<ArtMethod*>* methods)
+      : methods_(methods) {}
+
+  bool operator()(ObjPtr<mirror::Class> klass) OVERRIDE REQUIRES_SHARED(Locks::mutator_lock_) {
     if (!klass->IsMiniTraceable()) {
       return true;
     }
-    ClassLinker* cl = Runtime::Current()->GetClassLinker();
-    auto pointer_size = cl->GetImagePointerSize();
-
+    auto pointer_size = Runtime::Current()->GetClassLinker()->GetImagePointerSize();
     for (ArtMethod& method : klass->GetDeclaredMethods(pointer_size)) {
-      MiniTrace::DumpCoverageData(*os_, &method);
+      if (method.IsInvokable() && !method.IsNative()) {
+        methods_->push_back(&method);
+      }
     }
-
     return true;
   }
 
  private:
-  std::ostream* os_;
+  std::vector<ArtMethod*>* methods_;
 };
 
-void MiniTrace::DumpCoverageData(std::ostream& os, ArtMethod* method) {
-  if (method == NULL) {
+// JIT code compiled before the trace started has no coverage probes. Traceable methods have
+// been sent to the interpreter bridge already and RequiresInterpreter() keeps that code from
+// being installed again. On-stack replacement does not go through the instrumentation, so drop
+// the OSR code, and the saved entry points so that the code cache does not try to restore them.
+static void DiscardJitCodeWithoutProbes(Thread* self) {
+  jit::Jit* jit = Runtime::Current()->GetJit();
+  if (jit == nullptr) {
     return;
   }
-  if (!method->IsMiniTraceable()) {
-    return;
+  ScopedObjectAccess soa(self);
+  std::vector<ArtMethod*> methods;
+  CollectTraceableMethodsClassVisitor visitor(&methods);
+  Runtime::Current()->GetClassLinker()->VisitClasses(&visitor);
+
+  jit::JitCodeCache* code_cache = jit->GetCodeCache();
+  for (ArtMethod* method : methods) {
+    ProfilingInfo* info = method->GetProfilingInfo(kRuntimePointerSize);
+    if (info != nullptr) {
+      info->SetSavedEntryPoint(nullptr);
+    }
+    OatQuickMethodHeader* osr_header = code_cache->LookupOsrMethodHeader(method);
+    if (osr_header != nullptr) {
+      code_cache->InvalidateCompiledCodeFor(method, osr_header);
+    }
   }
-  const DexFile::CodeItem* code_item = method->GetCodeItem();
-  if (code_item == nullptr) {
-    return;
+}
+
+std::vector<uint32_t> MiniTrace::FindCoverageBlocks(const CodeItemDataAccessor& accessor) {
+  const uint32_t insns_size = accessor.InsnsSizeInCodeUnits();
+  std::vector<bool> leaders(insns_size, false);
+  auto mark = [&](uint32_t dex_pc) {
+    if (dex_pc < insns_size) {
+      leaders[dex_pc] = true;
+    }
+  };
+  mark(0u);
+
+  // Same block boundaries as HBasicBlockBuilder::CreateBranchTargets.
+  if (accessor.TriesSize() != 0) {
+    for (const DexFile::TryItem& try_item : accessor.TryItems()) {
+      mark(try_item.start_addr_);
+      mark(try_item.start_addr_ + try_item.insn_count_);
+    }
+    const uint8_t* handlers_ptr = accessor.GetCatchHandlerData();
+    uint32_t handlers_size = DecodeUnsignedLeb128(&handlers_ptr);
+    for (uint32_t idx = 0; idx < handlers_size; ++idx) {
+      CatchHandlerIterator iterator(handlers_ptr);
+      for (; iterator.HasNext(); iterator.Next()) {
+        mark(iterator.GetHandlerAddress());
+      }
+      handlers_ptr = iterator.EndDataPointer();
+    }
   }
-  uint8_t* data = const_cast<uint8_t*>(method->GetCoverageData());
+
+  for (const DexInstructionPcPair& pair : accessor) {
+    const uint32_t dex_pc = pair.DexPc();
+    const Instruction& instruction = pair.Inst();
+    if (instruction.IsBranch()) {
+      mark(dex_pc + instruction.GetTargetOffset());
+    } else if (instruction.IsSwitch()) {
+      DexSwitchTable table(instruction, dex_pc);
+      for (DexSwitchTableIterator s_it(table); !s_it.Done(); s_it.Advance()) {
+        mark(dex_pc + s_it.CurrentTargetOffset());
+      }
+    } else if (instruction.Opcode() != Instruction::MOVE_EXCEPTION) {
+      continue;
+    }
+    if (instruction.CanFlowThrough()) {
+      mark(dex_pc + instruction.SizeInCodeUnits());
+    }
+  }
+
+  std::vector<uint32_t> blocks;
+  for (uint32_t dex_pc = 0; dex_pc != insns_size; ++dex_pc) {
+    if (leaders[dex_pc]) {
+      blocks.push_back(dex_pc);
+    }
+  }
+  return blocks;
+}
+
+uint8_t* MiniTrace::AllocateCoverageData(ArtMethod* method) {
+  MiniTrace* the_trace = the_trace_;
+  // Once the storage ran out, do not walk the method again on every instruction.
+  if (the_trace == nullptr || the_trace->coverage_exhausted_.LoadRelaxed()) {
+    return nullptr;
+  }
+  CodeItemDataAccessor accessor(method->DexInstructionData());
+  if (!accessor.HasCodeItem()) {
+    return nullptr;
+  }
+  size_t size = GetExecutedBitmapSize(accessor.InsnsSizeInCodeUnits()) +
+                FindCoverageBlocks(accessor).size();
+  return the_trace->InstallCoverageData(method, size);
+}
+
+uint8_t* MiniTrace::InstallCoverageData(ArtMethod* method, size_t size) {
+  const DexFile* dex_file = method->GetDexFile();
+  const uint32_t method_idx = method->GetDexMethodIndex();
+  MutexLock mu(Thread::Current(), coverage_lock_);
+  Atomic<uint8_t*>* table = dex_file->GetCoverageTable();
+  if (table == nullptr) {
+    table = reinterpret_cast<Atomic<uint8_t*>*>(
+        AllocateCoverageStorage(dex_file->NumMethodIds() * sizeof(Atomic<uint8_t*>)));
+    if (table == nullptr) {
+      return nullptr;
+    }
+    dex_file->SetCoverageTable(table);
+    if (dex_file->GetFieldCoverage() == nullptr) {
+      coverage_dex_files_.push_back(dex_file);
+    }
+  }
+  // Another thread may have been first.
+  uint8_t* data = table[method_idx].LoadRelaxed();
   if (data == nullptr) {
+    CoverageRecord* record = reinterpret_cast<CoverageRecord*>(
+        AllocateCoverageStorage(sizeof(CoverageRecord) + size));
+    if (record == nullptr) {
+      return nullptr;
+    }
+    // Copied methods share the coverage data of the method they were copied from.
+    record->method = method->GetCanonicalMethod();
+    record->dex_file = dex_file;
+    record->size = size;
+    data = reinterpret_cast<uint8_t*>(record + 1);
+    table[method_idx].StoreRelease(data);
+  }
+  return data;
+}
+
+Atomic<uint8_t>* MiniTrace::InstallFieldCoverage(const DexFile* dex_file) {
+  MutexLock mu(Thread::Current(), coverage_lock_);
+  // Another thread may have been first.
+  Atomic<uint8_t>* field_coverage = dex_file->GetFieldCoverage();
+  if (field_coverage == nullptr) {
+    field_coverage = reinterpret_cast<Atomic<uint8_t>*>(
+        AllocateCoverageStorage(dex_file->NumFieldIds() * sizeof(Atomic<uint8_t>)));
+    if (field_coverage == nullptr) {
+      return nullptr;
+    }
+    dex_file->SetFieldCoverage(field_coverage);
+    if (dex_file->GetCoverageTable() == nullptr) {
+      coverage_dex_files_.push_back(dex_file);
+    }
+  }
+  return field_coverage;
+}
+
+void MiniTrace::RecordFieldAccess(ArtField* field, uint8_t flag) {
+  if (!field->IsMiniTraceable()) {
     return;
   }
+  const DexFile* dex_file = field->GetDexFile();
+  Atomic<uint8_t>* field_coverage = dex_file->GetFieldCoverage();
+  if (UNLIKELY(field_coverage == nullptr)) {
+    if (coverage_exhausted_.LoadRelaxed()) {
+      return;
+    }
+    field_coverage = InstallFieldCoverage(dex_file);
+    if (field_coverage == nullptr) {
+      return;
+    }
+  }
+  // Only the first access after a dump pays for the atomic update, like VisitPc.
+  Atomic<uint8_t>* addr = &field_coverage[field->GetDexFieldIndex()];
+  if ((addr->LoadRelaxed() & flag) == 0) {
+    addr->FetchAndBitwiseOrSequentiallyConsistent(flag);
+  }
+}
+
+void MiniTrace::TakeFieldCoverage(std::vector<FieldCoverage>* field_coverage) {
+  Thread* self = Thread::Current();
+  std::vector<const DexFile*> dex_files;
+  {
+    MutexLock mu(self, coverage_lock_);
+    dex_files = coverage_dex_files_;
+  }
+  ClassLinker* class_linker = Runtime::Current()->GetClassLinker();
+  for (const DexFile* dex_file : dex_files) {
+    // The dex files of unloaded class loaders are gone already.
+    if (!class_linker->IsDexFileRegistered(self, *dex_file)) {
+      continue;
+    }
+    Atomic<uint8_t>* flags = dex_file->GetFieldCoverage();
+    if (flags == nullptr) {
+      continue;
+    }
+    for (uint32_t field_idx = 0, size = dex_file->NumFieldIds(); field_idx != size; ++field_idx) {
+      // Keep concurrent updates for the next snapshot, see SnapshotCoverageData.
+      uint8_t value = (flags[field_idx].LoadRelaxed() != 0) ? flags[field_idx].ExchangeRelaxed(0)
+                                                            : 0;
+      if (value != 0) {
+        field_coverage->push_back({dex_file, field_idx, value});
+      }
+    }
+  }
+}
+
+void MiniTrace::PushCoverageRecord(Atomic<CoverageRecord*>* list,
+                                   CoverageRecord* record,
+                                   CoverageRecord* CoverageRecord::* next) {
+  CoverageRecord* head;
+  do {
+    head = list->LoadRelaxed();
+    record->*next = head;
+  } while (!list->CompareAndSetWeakRelease(head, record));
+}
 
-  uint16_t insns_size = method->DexInstructions().InsnsSizeInCodeUnits();
-  if (insns_size == 0) {
+void MiniTrace::RecordFirstExecution(uint8_t* coverage_data) {
+  MiniTrace* the_trace = the_trace_;
+  if (the_trace == nullptr) {
     return;
   }
+  if (the_trace->options_.flush_new_coverage != 0u) {
+    the_trace->new_coverage_.FetchAndAddRelaxed(1u);
+  }
+  CoverageRecord* record = GetCoverageRecord(coverage_data);
+  if ((record->flags.LoadRelaxed() & kRecordDirty) == 0 &&
+      (record->flags.FetchAndBitwiseOrSequentiallyConsistent(kRecordDirty) & kRecordDirty) == 0) {
+    PushCoverageRecord(&the_trace->dirty_records_, record, &CoverageRecord::next_dirty);
+  }
+}
 
-  if (data[0] == 0) {
-    int length = (insns_size >> 1);
-    uint32_t* p = reinterpret_cast<uint32_t*>(data);
-    bool visited = false;
-    for (int i = 0; i <= length; i++) {
-      if (p[i] != 0) {
-        visited = true;
-        break;
+void MiniTrace::RecordCoverageProbes(uint8_t* coverage_data) {
+  MiniTrace* the_trace = the_trace_;
+  if (the_trace == nullptr) {
+    return;
+  }
+  CoverageRecord* record = GetCoverageRecord(coverage_data);
+  if ((record->flags.FetchAndBitwiseOrSequentiallyConsistent(kRecordProbed) & kRecordProbed) == 0) {
+    PushCoverageRecord(&the_trace->probed_records_, record, &CoverageRecord::next_probed);
+  }
+}
+
+bool MiniTrace::SnapshotCoverageData(CoverageRecord* record, std::vector<uint8_t>* data) {
+  // Take the data and clear it in one go so that concurrent updates are kept for the next dump.
+  // Most of the data of a method is usually clear, skip it a word at a time. The data starts
+  // and ends on a word boundary (see AllocateCoverageStorage).
+  static_assert(sizeof(CoverageRecord) % sizeof(uint64_t) == 0u, "Unaligned coverage data");
+  uint8_t* coverage_data = reinterpret_cast<uint8_t*>(record + 1);
+  const size_t offset = data->size();
+  data->resize(offset + record->size);
+  uint8_t* out = data->data() + offset;
+  bool visited = false;
+  for (size_t i = 0; i < record->size; i += sizeof(uint64_t)) {
+    if (reinterpret_cast<Atomic<uint64_t>*>(coverage_data + i)->LoadRelaxed() == 0u) {
+      continue;
+    }
+    const size_t end = std::min<size_t>(i + sizeof(uint64_t), record->size);
+    for (size_t j = i; j != end; ++j) {
+      Atomic<uint8_t>* addr = reinterpret_cast<Atomic<uint8_t>*>(coverage_data + j);
+      uint8_t value = (addr->LoadRelaxed() != 0) ? addr->ExchangeRelaxed(0) : 0;
+      out[j] = value;
+      visited |= value != 0;
+    }
+  }
+  if (!visited) {
+    data->resize(offset);
+  }
+  return visited;
+}
+
+std::unique_ptr<MiniTrace::CoverageSnapshot> MiniTrace::CreateSnapshot(bool start) {
+  std::unique_ptr<CoverageSnapshot> snapshot(new CoverageSnapshot());
+  snapshot->start = start;
+  snapshot->time_ms = MilliTime();
+  snapshot->epoch = epoch_;
+  last_snapshot_ms_ = snapshot->time_ms;
+  new_coverage_.StoreRelaxed(0u);
+  auto take_record = [&](CoverageRecord* record) {
+    size_t offset = snapshot->data.size();
+    if (SnapshotCoverageData(record, &snapshot->data)) {
+      snapshot->records.emplace_back(record, offset);
+    }
+  };
+
+  if (!start) {
+    // Methods with coverage probes do not queue themselves.
+    for (CoverageRecord* record = probed_records_.LoadAcquire();
+         record != nullptr;
+         record = record->next_probed) {
+      take_record(record);
+    }
+
+    CoverageRecord* record = dirty_records_.ExchangeAcquire(nullptr);
+    while (record != nullptr) {
+      // Read the link first, the record may be queued again as soon as it is marked clean.
+      CoverageRecord* next = record->next_dirty;
+      uint32_t flags = record->flags.FetchAndBitwiseAndSequentiallyConsistent(~kRecordDirty);
+      if ((flags & kRecordProbed) == 0) {
+        take_record(record);
       }
+      record = next;
     }
 
-    if (!visited) {
-      return;
+    if (options_.call_graph) {
+      TakeCallEdges(&snapshot->call_edges);
+    }
+    if (options_.field_coverage) {
+      TakeFieldCoverage(&snapshot->field_coverage);
     }
   }
+  return snapshot;
+}
 
-  os << StringPrintf("%p\t%s\t%s\t%s\t%s\t%d\t", method,
-      PrettyDescriptor(method->GetDeclaringClassDescriptor()).c_str(), method->GetName(),
-      method->GetSignature().ToString().c_str(), method->GetDeclaringClassSourceFile(), insns_size);
+void MiniTrace::TakeSnapshot(bool start) {
+  pending_snapshots_.push_back(CreateSnapshot(start));
+}
 
-  for (int i = 0; i < insns_size; i++) {
-    if (data[i] != 0) {
-      os << 1;
-      data[i] = 0;  // clear after dump
-    } else {
-      os << 0;
+uint8_t* MiniTrace::AllocateCoverageStorage(size_t size) {
+  size = RoundUp(size, sizeof(uint64_t));
+  if (size > static_cast<size_t>(coverage_end_ - coverage_top_)) {
+    if (coverage_exhausted_.LoadRelaxed()) {
+      return nullptr;
+    }
+    std::string error_msg;
+    std::unique_ptr<MemMap> map(MemMap::MapAnonymous("mini trace coverage",
+                                                     /* addr */ nullptr,
+                                                     std::max(kCoverageMapSize,
+                                                              RoundUp(size, kPageSize)),
+                                                     PROT_READ | PROT_WRITE,
+                                                     /* low_4gb */ false,
+                                                     /* reuse */ false,
+                                                     &error_msg));
+    if (map == nullptr) {
+      LOG(ERROR) << "MiniTrace: Failed to map coverage data, dropping new coverage: "
+                 << error_msg;
+      coverage_exhausted_.StoreRelaxed(true);
+      return nullptr;
+    }
+    coverage_top_ = map->Begin();
+    coverage_end_ = map->End();
+    coverage_maps_.push_back(std::move(map));
+  }
+  uint8_t* result = coverage_top_;
+  coverage_top_ += size;
+  return result;
+}
+
+void MiniTrace::ReleaseCoverageStorage() {
+  Thread* self = Thread::Current();
+  std::vector<const DexFile*> dex_files;
+  std::vector<std::unique_ptr<MemMap>> maps;
+  {
+    MutexLock mu(self, coverage_lock_);
+    dex_files.swap(coverage_dex_files_);
+    maps.swap(coverage_maps_);
+    coverage_top_ = nullptr;
+    coverage_end_ = nullptr;
+  }
+
+  ClassLinker* class_linker = Runtime::Current()->GetClassLinker();
+  for (const DexFile* dex_file : dex_files) {
+    // The dex files of unloaded class loaders are gone already.
+    if (class_linker->IsDexFileRegistered(self, *dex_file)) {
+      dex_file->SetCoverageTable(nullptr);
+      dex_file->SetFieldCoverage(nullptr);
     }
   }
+
+  for (std::unique_ptr<MemMap>& map : maps) {
+    map->MadviseDontNeedAndZero();
+  }
+  MutexLock mu(self, *Locks::trace_lock_);
+  if (retired_coverage_maps_ == nullptr) {
+    retired_coverage_maps_ = new std::vector<std::unique_ptr<MemMap>>();
+  }
+  std::move(maps.begin(), maps.end(), std::back_inserter(*retired_coverage_maps_));
+}
+
+void MiniTrace::ExpandCoverageData(ArtMethod* method,
+                                   const uint8_t* data,
+                                   std::vector<bool>* covered) {
+  CodeItemDataAccessor accessor(method->DexInstructionData());
+  const uint32_t insns_size = accessor.InsnsSizeInCodeUnits();
+  std::vector<uint32_t> blocks = FindCoverageBlocks(accessor);
+
+  // The interpreter records each instruction while compiled code only records the basic
+  // blocks it enters, which cover the instructions up to the next block.
+  covered->assign(insns_size, false);
+  for (uint32_t dex_pc = 0; dex_pc != insns_size; ++dex_pc) {
+    (*covered)[dex_pc] = (data[dex_pc / kBitsPerByte] & (1u << (dex_pc % kBitsPerByte))) != 0;
+  }
+  const uint8_t* entered_blocks = data + GetExecutedBitmapSize(insns_size);
+  auto block = blocks.begin();
+  bool in_entered_block = false;
+  for (const DexInstructionPcPair& pair : accessor) {
+    const uint32_t dex_pc = pair.DexPc();
+    if (block != blocks.end() && *block == dex_pc) {
+      in_entered_block = entered_blocks[block - blocks.begin()] != 0;
+      ++block;
+    }
+    if (in_entered_block) {
+      (*covered)[dex_pc] = true;
+      // Code following a goto, return or throw is only reached through another block.
+      in_entered_block = pair.Inst().CanFlowThrough();
+    }
+  }
+}
+
+void MiniTrace::DumpMethodNames(std::ostream& os,
+                                TextNames* names,
+                                const DexFile& dex_file,
+                                uint32_t method_idx) {
+  const uint32_t checksum = dex_file.GetLocationChecksum();
+  if (names->dex_files.insert(checksum).second) {
+    os << StringPrintf("DexFile\t%08x\t%s\n", checksum, dex_file.GetLocation().c_str());
+  }
+  if (names->methods.insert((static_cast<uint64_t>(checksum) << 32) | method_idx).second) {
+    const DexFile::MethodId& method_id = dex_file.GetMethodId(method_idx);
+    const DexFile::ClassDef* class_def = dex_file.FindClassDef(method_id.class_idx_);
+    const char* source_file = (class_def != nullptr) ? dex_file.GetSourceFile(*class_def) : nullptr;
+    os << StringPrintf("Method\t%08x:%u\t%s\t%s\t%s\t%s\n",
+                       checksum,
+                       method_idx,
+                       PrettyDescriptor(dex_file.GetMethodDeclaringClassDescriptor(method_id))
+                           .c_str(),
+                       dex_file.GetMethodName(method_id),
+                       dex_file.GetMethodSignature(method_id).ToString().c_str(),
+                       source_file != nullptr ? source_file : "");
+  }
+}
+
+void MiniTrace::DumpCoverageData(std::ostream& os,
+                                 TextNames* names,
+                                 ArtMethod* method,
+                                 const std::vector<bool>& covered) {
+  const DexFile& dex_file = *method->GetDexFile();
+  DumpMethodNames(os, names, dex_file, method->GetDexMethodIndex());
+  os << StringPrintf("%08x:%u\t%zu\t",
+                     dex_file.GetLocationChecksum(),
+                     method->GetDexMethodIndex(),
+                     covered.size());
+  for (bool executed : covered) {
+    os << (executed ? 1 : 0);
+  }
   os << '\n';
 }
 
-void MiniTrace::DumpCoverageData(bool start) {
-  if (!IsMiniTraceActive()) {
-    return;
+void MiniTrace::DumpFieldCoverage(std::ostream& os, const FieldCoverage& field) {
+  const DexFile::FieldId& field_id = field.dex_file->GetFieldId(field.field_idx);
+  os << "Field\t" << PrettyDescriptor(field.dex_file->GetFieldDeclaringClassDescriptor(field_id))
+     << '\t' << field.dex_file->GetFieldName(field_id)
+     << '\t' << field.dex_file->GetFieldTypeDescriptor(field_id)
+     << '\t' << (((field.flags & kMiniTraceFieldRead) != 0) ? 1 : 0)
+     << (((field.flags & kMiniTraceFieldWritten) != 0) ? 1 : 0) << '\n';
+}
+
+void MiniTrace::DumpCallEdge(std::ostream& os,
+                             TextNames* names,
+                             const DexFile& caller_dex_file,
+                             uint32_t caller_method_idx,
+                             const MiniTraceCallEdge& edge) {
+  DumpMethodNames(os, names, caller_dex_file, caller_method_idx);
+  DumpMethodNames(os, names, *edge.callee_dex_file, edge.callee_method_idx);
+  os << StringPrintf("Call\t%08x:%u\t%u\t%08x:%u\n",
+                     caller_dex_file.GetLocationChecksum(),
+                     caller_method_idx,
+                     edge.dex_pc,
+                     edge.callee_dex_file->GetLocationChecksum(),
+                     edge.callee_method_idx);
+}
+
+void MiniTrace::WriteCoverageData(MiniTraceRingWriter* writer,
+                                  ArtMethod* method,
+                                  const std::vector<bool>& covered) {
+  WriteMethodNames(writer, *method->GetDexFile(), method->GetDexMethodIndex());
+  writer->WriteCoverage(method->GetDexFile()->GetLocationChecksum(),
+                        method->GetDexMethodIndex(),
+                        covered);
+}
+
+void MiniTrace::WriteSnapshot(const CoverageSnapshot& snapshot,
+                              MiniTraceRingWriter* writer,
+                              TextNames* names,
+                              std::ostream& os) {
+  if (writer != nullptr) {
+    writer->WriteTimestamp(snapshot.start ? kMiniTraceRecordStart : kMiniTraceRecordDump,
+                           snapshot.time_ms,
+                           snapshot.epoch);
+  } else {
+    os << (snapshot.start ? "Start" : "Dump") << '\t' << getpid() << '\t' << snapshot.time_ms
+       << '\t' << snapshot.epoch << '\n';
+  }
+
+  Thread* self = Thread::Current();
+  ClassLinker* class_linker = Runtime::Current()->GetClassLinker();
+  std::unordered_map<const DexFile*, bool> registered_dex_files;
+  // Skip the methods of class loaders unloaded since the snapshot was taken.
+  auto is_registered = [&](const DexFile* dex_file) REQUIRES_SHARED(Locks::mutator_lock_) {
+    auto it = registered_dex_files.find(dex_file);
+    if (it == registered_dex_files.end()) {
+      bool registered = class_linker->IsDexFileRegistered(self, *dex_file);
+      it = registered_dex_files.emplace(dex_file, registered).first;
+    }
+    return it->second;
+  };
+  std::vector<bool> covered;
+  for (const std::pair<CoverageRecord*, size_t>& entry : snapshot.records) {
+    CoverageRecord* record = entry.first;
+    if (!is_registered(record->dex_file)) {
+      continue;
+    }
+    ExpandCoverageData(record->method, snapshot.data.data() + entry.second, &covered);
+    if (writer != nullptr) {
+      WriteCoverageData(writer, record->method, covered);
+    } else {
+      DumpCoverageData(os, names, record->method, covered);
+    }
   }
 
+  for (const FieldCoverage& field : snapshot.field_coverage) {
+    if (!is_registered(field.dex_file)) {
+      continue;
+    }
+    if (writer != nullptr) {
+      const DexFile::FieldId& field_id = field.dex_file->GetFieldId(field.field_idx);
+      writer->MaybeWriteDexFile(field.dex_file->GetLocationChecksum(),
+                                field.dex_file->GetLocation().c_str());
+      writer->WriteFieldCoverage(
+          field.dex_file->GetLocationChecksum(),
+          field.field_idx,
+          field.flags,
+          PrettyDescriptor(field.dex_file->GetFieldDeclaringClassDescriptor(field_id)).c_str(),
+          field.dex_file->GetFieldName(field_id),
+          field.dex_file->GetFieldTypeDescriptor(field_id));
+    } else {
+      DumpFieldCoverage(os, field);
+    }
+  }
+
+  for (const MiniTraceCallEdge& edge : snapshot.call_edges) {
+    CoverageRecord* caller = GetCoverageRecord(edge.caller_coverage_data);
+    if (!is_registered(caller->dex_file) || !is_registered(edge.callee_dex_file)) {
+      continue;
+    }
+    const uint32_t caller_method_idx = caller->method->GetDexMethodIndex();
+    if (writer != nullptr) {
+      WriteMethodNames(writer, *caller->dex_file, caller_method_idx);
+      WriteMethodNames(writer, *edge.callee_dex_file, edge.callee_method_idx);
+      writer->WriteCallEdge(caller->dex_file->GetLocationChecksum(),
+                            caller_method_idx,
+                            edge.dex_pc,
+                            edge.callee_dex_file->GetLocationChecksum(),
+                            edge.callee_method_idx);
+    } else {
+      DumpCallEdge(os, names, *caller->dex_file, caller_method_idx, edge);
+    }
+  }
+}
+
+void MiniTrace::WriteSnapshots(Thread* self) {
+  // The I/O lock keeps the dumps in order. Runnable threads take the writer lock, so it is
+  // released before the I/O, which is done in the native state so that it does not hold up the
+  // GC.
+  MutexLock io_mu(self, io_lock_);
+  std::ostringstream os;
+  std::deque<std::unique_ptr<CoverageSnapshot>> snapshots;
+  MiniTraceRingWriter* writer;
+  {
+    ScopedObjectAccess soa(self);
+    MutexLock mu(self, writer_lock_);
+    {
+      MutexLock mu2(self, dump_lock_);
+      snapshots.swap(pending_snapshots_);
+    }
+    for (const std::unique_ptr<CoverageSnapshot>& snapshot : snapshots) {
+      WriteSnapshot(*snapshot, writer_.get(), &text_names_, os);
+    }
+    // Nothing else writes to the ring file, and syncing it only reads the mapping.
+    writer = writer_.get();
+  }
+
+  if (!snapshots.empty()) {
+    if (writer != nullptr) {
+      writer->Sync();
+    } else {
+      AppendToCoverageFile(os.str());
+    }
+  }
+}
+
+void MiniTrace::AppendToCoverageFile(const std::string& data) {
   std::string coverage_data_filename(StringPrintf("/data/mini_trace_%d_coverage.dat",
                                          getuid()));
 
@@ -164,92 +845,612 @@ void MiniTrace::DumpCoverageData(bool start) {
     return;
   }
 
+  if (!file->WriteFully(data.c_str(), data.length())) {
+    LOG(INFO) << "Failed to write coverage data file " << coverage_data_filename;
+    file->Erase();
+    return;
+  }
+  // Sync before the dump counts as written, like Sync() does for the ring file. The file holds
+  // the earlier dumps too, so it is not erased if that fails.
+  if (file->Flush() != 0) {
+    PLOG(WARNING) << "Failed to sync coverage data file " << coverage_data_filename;
+  }
+  if (file->Close() != 0) {
+    LOG(INFO) << "Failed to close coverage data file " << coverage_data_filename;
+    return;
+  }
+}
 
-  std::ostringstream os;
-  if (start) {
-    LOG(INFO) << "MiniTrace: Try to start coverage data";
-    os << "Start\t" << getpid() << '\t' << MilliTime() << '\n';
+uint32_t MiniTrace::GetInstrumentationEvents(const MiniTraceOptions& options) {
+  uint32_t events = 0u;
+  if ((options.events & MiniTraceOptions::kMethodEvents) != 0u) {
+    events |= instrumentation::Instrumentation::kMethodEntered |
+              instrumentation::Instrumentation::kMethodExited |
+              instrumentation::Instrumentation::kMethodUnwind;
+  }
+  if ((options.events & MiniTraceOptions::kExceptionEvents) != 0u) {
+    events |= instrumentation::Instrumentation::kExceptionThrown |
+              instrumentation::Instrumentation::kExceptionHandled;
+  }
+  if ((options.events & MiniTraceOptions::kInvokeEvents) != 0u || options.call_graph) {
+    events |= instrumentation::Instrumentation::kInvokeVirtualOrInterface;
+  }
+  if ((options.events & MiniTraceOptions::kFieldEvents) != 0u || options.field_coverage) {
+    events |= instrumentation::Instrumentation::kFieldRead |
+              instrumentation::Instrumentation::kFieldWritten;
+  }
+  if (!options.edge_map.empty()) {
+    events |= instrumentation::Instrumentation::kBranch;
+  }
+  return events;
+}
+
+std::unique_ptr<MemMap> MiniTrace::MapEdgeMap(const MiniTraceOptions& options,
+                                              std::string* error_msg) {
+  const char* filename = options.edge_map.c_str();
+  // Keep the file of a fuzzer that mapped it already.
+  std::unique_ptr<File> file(OS::OpenFileReadWrite(filename));
+  if (file == nullptr) {
+    file.reset(OS::CreateEmptyFile(filename));
+  }
+  if (file == nullptr) {
+    *error_msg = StringPrintf("Failed to open %s: %s", filename, strerror(errno));
+    return nullptr;
+  }
+  // The file belongs to the fuzzer, leave its contents alone on failure.
+  std::unique_ptr<MemMap> map;
+  int64_t length = file->GetLength();
+  int result = (length >= 0 && static_cast<uint64_t>(length) < options.edge_map_size)
+      ? file->SetLength(options.edge_map_size)
+      : 0;
+  if (length < 0) {
+    *error_msg = StringPrintf("Failed to get the size of %s: %s", filename, strerror(-length));
+  } else if (result != 0) {
+    *error_msg = StringPrintf("Failed to resize %s: %s", filename, strerror(-result));
   } else {
-    LOG(INFO) << "MiniTrace: Try to dump coverage data";
+    map.reset(MemMap::MapFile(options.edge_map_size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED,
+                              file->Fd(),
+                              /* start */ 0,
+                              /* low_4gb */ false,
+                              filename,
+                              error_msg));
+  }
+  // The mapping stays valid after the file is closed.
+  if (file->FlushClose() != 0) {
+    PLOG(WARNING) << "Failed to close " << filename;
+  }
+  return map;
+}
 
-    os << "Dump\t" << getpid() << '\t' << MilliTime() << '\n';
+MiniTraceThreadData* MiniTrace::AllocateThreadData(Thread* self) {
+  size_t capacity = 0u;
+  if (options_.events != 0u) {
+    capacity = RoundUpToPowerOfTwo(
+        std::max<size_t>(options_.event_buffer_size / sizeof(MiniTraceEvent), 1u));
+  }
+  std::unique_ptr<MiniTraceThreadData> data(new MiniTraceThreadData(self->GetTid(), capacity));
+  MiniTraceThreadData* result = data.get();
+  {
+    MutexLock mu(self, coverage_lock_);
+    thread_data_.push_back(std::move(data));
+  }
+  self->SetMiniTraceData(result);
+  return result;
+}
 
-    ScopedObjectAccess soa(Thread::Current());
-    Runtime* runtime = Runtime::Current();
-    DumpCoverageDataClassVisitor visitor(&os);
-    runtime->GetClassLinker()->VisitClasses(&visitor);
+void MiniTrace::RecordEvent(Thread* self, ArtMethod* method, MiniTraceEventType type) {
+  static_assert(kMiniTraceEventFieldWritten <= kEventTypeMask, "Event types do not fit");
+  if (method == nullptr || !method->IsMiniTraceable()) {
+    return;
   }
+  // The coverage record identifies the method until the trace stops, even if its class is
+  // unloaded before the event is written.
+  uint8_t* coverage_data = method->GetCoverageData();
+  if (coverage_data == nullptr) {
+    return;
+  }
+  MiniTraceThreadData* data = self->GetMiniTraceData();
+  if (UNLIKELY(data == nullptr)) {
+    data = AllocateThreadData(self);
+  }
+  uint64_t head = data->head.LoadRelaxed();
+  if (head - data->tail.LoadAcquire() == data->capacity) {
+    data->dropped.FetchAndAddRelaxed(1u);
+    return;
+  }
+  MiniTraceEvent& event = data->events[head & (data->capacity - 1u)];
+  event.timestamp = ReadTimestamp();
+  event.data = reinterpret_cast<uintptr_t>(GetCoverageRecord(coverage_data)) | type;
+  data->head.StoreRelease(head + 1u);
+}
 
-  std::string data(os.str());
-  if (!file->WriteFully(data.c_str(), data.length())) {
-    LOG(INFO) << "Failed to write coverage data file " << coverage_data_filename;
-    file->Erase();
+void MiniTrace::RecordCallEdge(Thread* self,
+                               ArtMethod* caller,
+                               uint32_t dex_pc,
+                               ArtMethod* callee) {
+  if (!caller->IsMiniTraceable()) {
+    return;
+  }
+  MiniTraceCallEdge edge;
+  edge.caller_coverage_data = caller->GetCoverageData();
+  if (edge.caller_coverage_data == nullptr) {
+    return;
+  }
+  callee = callee->GetInterfaceMethodIfProxy(kRuntimePointerSize);
+  edge.dex_pc = dex_pc;
+  edge.callee_method_idx = callee->GetDexMethodIndex();
+  edge.callee_dex_file = callee->GetDexFile();
+  MiniTraceThreadData* data = self->GetMiniTraceData();
+  if (UNLIKELY(data == nullptr)) {
+    data = AllocateThreadData(self);
+  }
+  if (data->call_edges.insert(edge).second) {
+    MutexLock mu(self, data->call_edge_lock);
+    data->new_call_edges.push_back(edge);
+  }
+}
+
+void MiniTrace::TakeCallEdges(std::vector<MiniTraceCallEdge>* call_edges) {
+  Thread* self = Thread::Current();
+  std::vector<MiniTraceThreadData*> thread_data;
+  {
+    MutexLock mu(self, coverage_lock_);
+    for (const std::unique_ptr<MiniTraceThreadData>& data : thread_data_) {
+      thread_data.push_back(data.get());
+    }
+  }
+  std::vector<MiniTraceCallEdge> new_call_edges;
+  for (MiniTraceThreadData* data : thread_data) {
+    {
+      MutexLock mu(self, data->call_edge_lock);
+      new_call_edges.swap(data->new_call_edges);
+    }
+    for (const MiniTraceCallEdge& edge : new_call_edges) {
+      if (dumped_call_edges_.insert(edge).second) {
+        call_edges->push_back(edge);
+      }
+    }
+    new_call_edges.clear();
+  }
+}
+
+void MiniTrace::DrainEvents(Thread* self) {
+  std::vector<MiniTraceThreadData*> thread_data;
+  {
+    MutexLock mu(self, coverage_lock_);
+    for (const std::unique_ptr<MiniTraceThreadData>& data : thread_data_) {
+      thread_data.push_back(data.get());
+    }
+  }
+
+  MutexLock mu(self, writer_lock_);
+  ClassLinker* class_linker = Runtime::Current()->GetClassLinker();
+  std::unordered_map<const DexFile*, bool> registered_dex_files;
+  std::vector<MiniTraceEventRecord> records;
+  for (MiniTraceThreadData* data : thread_data) {
+    uint64_t tail = data->tail.LoadRelaxed();
+    const uint64_t head = data->head.LoadAcquire();
+    const uint32_t dropped = data->dropped.ExchangeRelaxed(0u);
+    if (tail == head && dropped == 0u) {
+      continue;
+    }
+    records.clear();
+    for (; tail != head; ++tail) {
+      const MiniTraceEvent& event = data->events[tail & (data->capacity - 1u)];
+      CoverageRecord* record = reinterpret_cast<CoverageRecord*>(event.data & ~kEventTypeMask);
+      // Skip the methods of class loaders unloaded since the event was recorded.
+      auto it = registered_dex_files.find(record->dex_file);
+      if (it == registered_dex_files.end()) {
+        bool registered = class_linker->IsDexFileRegistered(self, *record->dex_file);
+        it = registered_dex_files.emplace(record->dex_file, registered).first;
+      }
+      if (!it->second) {
+        continue;
+      }
+      const uint32_t method_idx = record->method->GetDexMethodIndex();
+      WriteMethodNames(event_writer_.get(), *record->dex_file, method_idx);
+      MiniTraceEventRecord event_record;
+      event_record.timestamp = event.timestamp;
+      event_record.checksum = record->dex_file->GetLocationChecksum();
+      event_record.method_idx = method_idx;
+      event_record.type = static_cast<uint8_t>(event.data & kEventTypeMask);
+      event_record.reserved = 0u;
+      records.push_back(event_record);
+    }
+    // The slots can be reused now.
+    data->tail.StoreRelease(head);
+    event_writer_->WriteEvents(data->tid, dropped, records);
+  }
+}
+
+void MiniTrace::ReleaseThreadData() {
+  Thread* self = Thread::Current();
+  {
+    MutexLock mu(self, *Locks::thread_list_lock_);
+    Runtime::Current()->GetThreadList()->ForEach(ClearMiniTraceData, nullptr);
+  }
+  MutexLock mu(self, coverage_lock_);
+  thread_data_.clear();
+}
+
+void* MiniTrace::RunWriterThread(void* arg) {
+  Runtime* runtime = Runtime::Current();
+  bool attached = runtime->AttachCurrentThread("MiniTrace writer",
+                                               /* as_daemon */ true,
+                                               runtime->GetSystemThreadGroup(),
+                                               /* create_peer */ true);
+  if (!attached) {
+    CHECK(runtime->IsShuttingDown(Thread::Current()));
+    return nullptr;
+  }
+
+  MiniTrace* the_trace = reinterpret_cast<MiniTrace*>(arg);
+  Thread* self = Thread::Current();
+  while (true) {
+    bool flush_due = false;
+    {
+      MutexLock mu(self, the_trace->dump_lock_);
+      while (the_trace->pending_snapshots_.empty() && !the_trace->shutting_down_) {
+        int64_t wait_ms;
+        if (the_trace->IsFlushDue(&wait_ms)) {
+          // Taking the snapshot needs the mutator lock, see TakeFieldCoverage().
+          flush_due = true;
+          break;
+        } else if (the_trace->options_.events != 0u) {
+          // Drain the events after every wait.
+          wait_ms = (wait_ms == 0) ? kEventDrainMs : std::min(wait_ms, kEventDrainMs);
+          the_trace->dump_cond_.TimedWait(self, wait_ms, 0);
+          break;
+        } else if (wait_ms == 0) {
+          the_trace->dump_cond_.Wait(self);
+        } else {
+          the_trace->dump_cond_.TimedWait(self, wait_ms, 0);
+        }
+      }
+      if (the_trace->pending_snapshots_.empty() && the_trace->shutting_down_) {
+        break;
+      }
+    }
+    if (flush_due || the_trace->options_.events != 0u) {
+      ScopedObjectAccess soa(self);
+      if (flush_due) {
+        MutexLock mu(self, the_trace->dump_lock_);
+        the_trace->TakeSnapshot(/* start */ false);
+      }
+      if (the_trace->options_.events != 0u) {
+        the_trace->DrainEvents(self);
+      }
+    }
+    the_trace->WriteSnapshots(self);
+  }
+
+  runtime->DetachCurrentThread();
+  return nullptr;
+}
+
+bool MiniTrace::StartWriterThread() {
+  if (writer_pthread_started_) {
+    return true;
+  }
+  // The zygote has to stay single threaded for forking.
+  if (Runtime::Current()->IsZygote() || shutting_down_) {
+    return false;
+  }
+  CHECK_PTHREAD_CALL(pthread_create,
+                     (&writer_pthread_, nullptr, &RunWriterThread, reinterpret_cast<void*>(this)),
+                     "MiniTrace writer thread");
+  writer_pthread_started_ = true;
+  return true;
+}
+
+bool MiniTrace::IsFlushDue(int64_t* wait_ms) {
+  *wait_ms = 0;
+  if (options_.flush_interval_ms != 0u) {
+    uint64_t due_ms = last_snapshot_ms_ + options_.flush_interval_ms;
+    uint64_t now_ms = MilliTime();
+    if (now_ms >= due_ms) {
+      return true;
+    }
+    *wait_ms = due_ms - now_ms;
+  }
+  if (options_.flush_new_coverage != 0u) {
+    if (new_coverage_.LoadRelaxed() >= options_.flush_new_coverage) {
+      return true;
+    }
+    *wait_ms = (*wait_ms == 0) ? kNewCoveragePollMs : std::min(*wait_ms, kNewCoveragePollMs);
+  }
+  return false;
+}
+
+void MiniTrace::StopWriterThread(Thread* self) {
+  bool started;
+  pthread_t writer_pthread;
+  {
+    MutexLock mu(self, dump_lock_);
+    shutting_down_ = true;
+    started = writer_pthread_started_;
+    writer_pthread = writer_pthread_;
+    dump_cond_.Signal(self);
+  }
+  if (started) {
+    CHECK_PTHREAD_CALL(pthread_join, (writer_pthread, nullptr), "MiniTrace writer thread shutdown");
+  }
+}
+
+void MiniTrace::RequestCoverageDump() {
+  RequestSnapshot(/* next_epoch */ false);
+}
+
+int64_t MiniTrace::NextEpoch() {
+  return RequestSnapshot(/* next_epoch */ true);
+}
+
+int64_t MiniTrace::RequestSnapshot(bool next_epoch) {
+  if (!IsMiniTraceActive()) {
+    return -1;
+  }
+  Thread* self = Thread::Current();
+  MiniTrace* the_trace;
+  bool write_now;
+  int64_t epoch;
+  {
+    ScopedObjectAccess soa(self);
+    the_trace = BeginInlineWrite(self);
+    if (the_trace == nullptr) {
+      return -1;
+    }
+    MutexLock mu(self, the_trace->dump_lock_);
+    the_trace->TakeSnapshot(/* start */ false);
+    if (next_epoch) {
+      ++the_trace->epoch_;
+    }
+    epoch = static_cast<int64_t>(the_trace->epoch_);
+    write_now = !the_trace->StartWriterThread();
+    if (!write_now) {
+      the_trace->dump_cond_.Signal(self);
+    }
+  }
+  if (write_now) {
+    the_trace->WriteSnapshots(self);
+  }
+  the_trace->EndInlineWrite(self);
+  return epoch;
+}
+
+void MiniTrace::DumpCoverageData(bool start) {
+  if (!IsMiniTraceActive()) {
+    return;
+  }
+  Thread* self = Thread::Current();
+  MiniTrace* the_trace;
+  {
+    ScopedObjectAccess soa(self);
+    the_trace = BeginInlineWrite(self);
+    if (the_trace == nullptr) {
+      return;
+    }
+    MutexLock mu(self, the_trace->dump_lock_);
+    the_trace->TakeSnapshot(start);
+  }
+  the_trace->WriteSnapshots(self);
+  the_trace->EndInlineWrite(self);
+}
+
+MiniTrace* MiniTrace::BeginInlineWrite(Thread* self) {
+  // Stop() clears the_trace_ under the trace lock, so it waits for every writer counted here.
+  MutexLock mu(self, *Locks::trace_lock_);
+  MiniTrace* the_trace = the_trace_;
+  if (the_trace != nullptr) {
+    MutexLock mu2(self, the_trace->dump_lock_);
+    ++the_trace->inline_writers_;
+  }
+  return the_trace;
+}
+
+void MiniTrace::EndInlineWrite(Thread* self) {
+  MutexLock mu(self, dump_lock_);
+  DCHECK_NE(inline_writers_, 0u);
+  --inline_writers_;
+  if (inline_writers_ == 0u && shutting_down_) {
+    dump_cond_.Broadcast(self);
+  }
+}
+
+void MiniTrace::ResetCoverageData() {
+  if (!IsMiniTraceActive()) {
     return;
   }
-  if (file->FlushCloseOrErase() != 0) {
-    LOG(INFO) << "Failed to flush coverage data file " << coverage_data_filename;
+  Thread* self = Thread::Current();
+  ScopedObjectAccess soa(self);
+  MiniTrace* the_trace = the_trace_;
+  if (the_trace == nullptr) {
     return;
   }
+  MutexLock mu(self, the_trace->dump_lock_);
+  // Take the coverage and drop it.
+  the_trace->CreateSnapshot(/* start */ false);
+}
+
+bool MiniTrace::DumpCoverageDataToFd(int fd, std::string* error_msg) {
+  Thread* self = Thread::Current();
+  std::ostringstream os;
+  {
+    ScopedObjectAccess soa(self);
+    MiniTrace* the_trace = the_trace_;
+    if (the_trace == nullptr) {
+      *error_msg = "MiniTrace is not active";
+      return false;
+    }
+    std::unique_ptr<CoverageSnapshot> snapshot;
+    {
+      MutexLock mu(self, the_trace->dump_lock_);
+      snapshot = the_trace->CreateSnapshot(/* start */ false);
+    }
+    // The output names all its methods.
+    TextNames names;
+    MutexLock mu(self, the_trace->writer_lock_);
+    the_trace->WriteSnapshot(*snapshot, /* writer */ nullptr, &names, os);
+  }
+
+  // The caller keeps the fd.
+  File file(fd, "[fd]", /* check_usage */ false);
+  file.DisableAutoClose();
+  const std::string data = os.str();
+  if (!file.WriteFully(data.c_str(), data.length())) {
+    *error_msg = StringPrintf("Failed to write coverage data to fd %d: %s", fd, strerror(errno));
+    return false;
+  }
+  return true;
 }
 
 void MiniTrace::Start() {
   LOG(INFO) << "MiniTrace: Try to start";
-  Thread* self = Thread::Current();
   {
-    MutexLock mu(self, *Locks::trace_lock_);
+    MutexLock mu(Thread::Current(), *Locks::trace_lock_);
     if (the_trace_ != nullptr) {
       LOG(ERROR) << "Trace already in progress, ignoring this request";
       return;
     }
   }
 
-  const char* trace_base_filename = "/data/mini_trace_";
-
+  MiniTraceOptions options;
   {
     std::ostringstream os;
-    os << trace_base_filename << getuid()  << "_config.in";
+    os << kTraceBaseFilename << getuid()  << "_config.in";
     std::string trace_config_filename(os.str());
 
     if (OS::FileExists(trace_config_filename.c_str())) {
-      std::ifstream in(trace_config_filename.c_str());
-      if (!in) {
+      std::string config;
+      if (!ReadFileToString(trace_config_filename, &config)) {
         LOG(INFO) << "MiniTrace: config file " << trace_config_filename << " exists but can't be opened";
         return;
       }
+      std::string error_msg;
+      if (!ParseOptions(config, &options, &error_msg)) {
+        LOG(ERROR) << "MiniTrace: config file " << trace_config_filename << ": " << error_msg;
+        return;
+      }
     } else {
       LOG(INFO) << "MiniTrace: config file " << trace_config_filename << " does not exist";
       return;
     }
   }
+  Start(options);
+}
+
+bool MiniTrace::Start(const MiniTraceOptions& options) {
+  Thread* self = Thread::Current();
+  {
+    MutexLock mu(self, *Locks::trace_lock_);
+    if (the_trace_ != nullptr) {
+      LOG(ERROR) << "Trace already in progress, ignoring this request";
+      return false;
+    }
+  }
+
+  std::unique_ptr<MiniTraceRingWriter> writer;
+  if (options.binary_output) {
+    std::string ring_filename(StringPrintf("%s%d_%d_coverage.bin",
+                                           kTraceBaseFilename, getuid(), getpid()));
+    std::string error_msg;
+    writer = MiniTraceRingWriter::Create(ring_filename, options.ring_size, &error_msg);
+    if (writer == nullptr) {
+      LOG(ERROR) << "MiniTrace: " << error_msg;
+      return false;
+    }
+  }
+  std::unique_ptr<MemMap> edge_map;
+  if (!options.edge_map.empty()) {
+    std::string error_msg;
+    edge_map = MapEdgeMap(options, &error_msg);
+    if (edge_map == nullptr) {
+      LOG(ERROR) << "MiniTrace: " << error_msg;
+      return false;
+    }
+  }
+  std::unique_ptr<MiniTraceRingWriter> event_writer;
+  if (options.events != 0u) {
+    std::string ring_filename(StringPrintf("%s%d_%d_events.bin",
+                                           kTraceBaseFilename, getuid(), getpid()));
+    std::string error_msg;
+    event_writer = MiniTraceRingWriter::Create(ring_filename, options.ring_size, &error_msg);
+    if (event_writer == nullptr) {
+      LOG(ERROR) << "MiniTrace: " << error_msg;
+      return false;
+    }
+  }
 
   // Create Trace object.
   {
-    // Required since EnableMethodTracing calls ConfigureStubs which visits class linker classes.
+    // Required since installing stubs visits class linker classes. It also keeps class loaders
+    // and their dex files from being unloaded until the rules have been applied.
     gc::ScopedGCCriticalSection gcs(self,
         gc::kGcCauseInstrumentation,
         gc::kCollectorTypeInstrumentation);
+    // Match the loaded classes against the rules while the threads still run. Classes loaded
+    // until the threads are suspended are matched in the pause.
+    MiniTraceClassRules rules(options);
+    {
+      ScopedObjectAccess soa(self);
+      ApplyClassRulesVisitor visitor(&rules);
+      Runtime::Current()->GetClassLinker()->VisitClasses(&visitor);
+    }
     ScopedSuspendAll ssa(__FUNCTION__);
-    MutexLock mu(self, *Locks::trace_lock_);
+    {
+      MutexLock mu(self, *Locks::trace_lock_);
 
-    if (the_trace_ != nullptr) {
-      LOG(ERROR) << "Trace already in progress, ignoring this request";
-    } else {
-      the_trace_ = new MiniTrace();
+      if (the_trace_ != nullptr) {
+        LOG(ERROR) << "Trace already in progress, ignoring this request";
+        return false;
+      }
+      the_trace_ = new MiniTrace(options,
+                                 std::move(writer),
+                                 std::move(event_writer),
+                                 std::move(edge_map));
+      // Compilations in flight have no coverage probes or those of an earlier trace.
+      ++code_generation_;
 
+      // Coverage is recorded by the interpreters and by coverage probes in JIT code, so no
+      // method entry/exit stubs are needed: traceable methods are routed to the interpreter
+      // bridge until the JIT compiles them again (see RequiresInterpreter) and everything
+      // else keeps running compiled code. Events are only reported by the interpreter.
       Runtime* runtime = Runtime::Current();
-      runtime->GetInstrumentation()->AddListener(the_trace_, 0);
-      runtime->GetInstrumentation()->EnableMethodTracing(kMiniTracerInstrumentationKey);
+      runtime->GetInstrumentation()->AddListener(the_trace_, the_trace_->instrumentation_events_);
 
-      PostClassPrepareClassVisitor visitor;
+      PostClassPrepareClassVisitor visitor(&rules);
       runtime->GetClassLinker()->VisitClasses(&visitor);
     }
+    // Let mterp record coverage through its alternate handler table.
+    MutexLock mu(self, *Locks::thread_list_lock_);
+    Runtime::Current()->GetThreadList()->ForEach(UpdateMterpCurrentIBase, nullptr);
   }
+  DiscardJitCodeWithoutProbes(self);
   DumpCoverageData(true);
+
+  // Flushing and recording events in the background need the writer thread from the start.
+  if (options.flush_interval_ms != 0u ||
+      options.flush_new_coverage != 0u ||
+      options.events != 0u) {
+    ScopedObjectAccess soa(self);
+    MiniTrace* the_trace = the_trace_;
+    if (the_trace != nullptr) {
+      MutexLock mu(self, the_trace->dump_lock_);
+      if (!the_trace->StartWriterThread()) {
+        LOG(WARNING) << "MiniTrace: Not flushing coverage data in the background";
+      }
+    }
+  }
+  return true;
 }
 
 void MiniTrace::Stop() {
   Thread* self = Thread::Current();
 
+  // Dump while the coverage data is still around.
+  DumpCoverageData(false);
+
   Runtime* runtime = Runtime::Current();
   MiniTrace* the_trace = nullptr;
   {
@@ -262,17 +1463,48 @@ void MiniTrace::Stop() {
     }
   }
   if (the_trace != nullptr) {
-    gc::ScopedGCCriticalSection gcs(self,
-                                    gc::kGcCauseInstrumentation,
-                                    gc::kCollectorTypeInstrumentation);
-    ScopedSuspendAll ssa(__FUNCTION__);
+    // Pending dumps were written by DumpCoverageData() above.
+    the_trace->StopWriterThread(self);
+    // Other threads, including an overlapping Stop(), may still be writing their dumps. No new
+    // ones start now that the_trace_ is null.
+    {
+      MutexLock mu(self, the_trace->dump_lock_);
+      while (the_trace->inline_writers_ != 0u) {
+        the_trace->dump_cond_.Wait(self);
+      }
+    }
+
+    {
+      gc::ScopedGCCriticalSection gcs(self,
+                                      gc::kGcCauseInstrumentation,
+                                      gc::kCollectorTypeInstrumentation);
+      ScopedSuspendAll ssa(__FUNCTION__);
+
+      runtime->GetInstrumentation()->RemoveListener(the_trace, the_trace->instrumentation_events_);
 
-    runtime->GetInstrumentation()->DisableMethodTracing(kMiniTracerInstrumentationKey);
-    runtime->GetInstrumentation()->RemoveListener(the_trace, 0);
+      // Let traceable methods go back to their compiled code.
+      RestoreStubsClassVisitor visitor;
+      runtime->GetClassLinker()->VisitClasses(&visitor);
+      {
+        MutexLock mu(self, *Locks::thread_list_lock_);
+        runtime->GetThreadList()->ForEach(UpdateMterpCurrentIBase, nullptr);
+      }
 
+      // The writer thread is gone and no thread can record events any more. The events refer
+      // to the coverage records, write them first.
+      if (the_trace->options_.events != 0u) {
+        the_trace->DrainEvents(self);
+      }
+      the_trace->ReleaseThreadData();
+      the_trace->ReleaseCoverageStorage();
+    }
+
+    if (the_trace->options_.events != 0u) {
+      MutexLock mu(self, the_trace->writer_lock_);
+      the_trace->event_writer_->Sync();
+    }
     delete the_trace;
   }
-  DumpCoverageData(false);
 }
 
 void MiniTrace::Shutdown() {
@@ -281,7 +1513,245 @@ void MiniTrace::Shutdown() {
   }
 }
 
-MiniTrace::MiniTrace() {}
+static bool MatchesGlob(const char* pattern, const char* str) {
+  // Where to continue if the current match fails: after the last '*' and one character further
+  // into `str` than before.
+  const char* star = nullptr;
+  const char* retry = nullptr;
+  while (*str != '\0') {
+    if (*pattern == '*') {
+      star = pattern++;
+      retry = str;
+    } else if (*pattern == '?' || *pattern == *str) {
+      ++pattern;
+      ++str;
+    } else if (star != nullptr) {
+      pattern = star + 1;
+      str = ++retry;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+static bool MatchesAnyPrefix(const std::vector<std::string>& prefixes, const char* str) {
+  return std::any_of(prefixes.begin(), prefixes.end(), [str](const std::string& prefix) {
+    return strncmp(str, prefix.c_str(), prefix.size()) == 0;
+  });
+}
+
+static bool MatchesAnyGlob(const std::vector<std::string>& globs, const char* str) {
+  return std::any_of(globs.begin(), globs.end(), [str](const std::string& glob) {
+    return MatchesGlob(glob.c_str(), str);
+  });
+}
+
+bool MiniTrace::IsClassTraceable(const MiniTraceOptions& options,
+                                 const char* descriptor,
+                                 const char* dex_location) {
+  return IsDexFileTraceable(options, dex_location) && IsClassNameTraceable(options, descriptor);
+}
+
+bool MiniTrace::IsDexFileTraceable(const MiniTraceOptions& options, const char* dex_location) {
+  if (!options.include_dex_locations.empty() &&
+      !MatchesAnyPrefix(options.include_dex_locations, dex_location)) {
+    return false;
+  }
+  return !MatchesAnyPrefix(options.exclude_dex_locations, dex_location);
+}
+
+bool MiniTrace::IsClassNameTraceable(const MiniTraceOptions& options, const char* descriptor) {
+  if ((!options.include_packages.empty() || !options.include_classes.empty()) &&
+      !MatchesAnyPrefix(options.include_packages, descriptor) &&
+      !MatchesAnyGlob(options.include_classes, descriptor)) {
+    return false;
+  }
+  return !MatchesAnyPrefix(options.exclude_packages, descriptor) &&
+         !MatchesAnyGlob(options.exclude_classes, descriptor);
+}
+
+bool MiniTrace::ParseOptions(const std::string& config,
+                             MiniTraceOptions* options,
+                             std::string* error_msg) {
+  // The default dex rule only applies to configs without dex rules.
+  bool default_dex_rules = true;
+  auto add_dex_rule = [&](std::vector<std::string>* rules, const std::string& value) {
+    if (default_dex_rules) {
+      options->include_dex_locations.clear();
+      options->exclude_dex_locations.clear();
+      default_dex_rules = false;
+    }
+    rules->push_back(value);
+  };
+  for (const std::string& raw_line : android::base::Split(config, "\n")) {
+    std::string line = android::base::Trim(raw_line.substr(0, raw_line.find('#')));
+    if (line.empty()) {
+      continue;
+    }
+    size_t separator = line.find('=');
+    if (separator == std::string::npos) {
+      // Older configs only had to exist, keep accepting whatever they contain.
+      LOG(WARNING) << "MiniTrace: Ignoring config line '" << line << "'";
+      continue;
+    }
+    std::string key = android::base::Trim(line.substr(0, separator));
+    std::string value = android::base::Trim(line.substr(separator + 1));
+    if (key == "output_format") {
+      if (value == "text") {
+        options->binary_output = false;
+      } else if (value == "binary") {
+        options->binary_output = true;
+      } else {
+        *error_msg = StringPrintf("Unknown output_format '%s'", value.c_str());
+        return false;
+      }
+    } else if (key == "include_dex") {
+      add_dex_rule(&options->include_dex_locations, value);
+    } else if (key == "exclude_dex") {
+      add_dex_rule(&options->exclude_dex_locations, value);
+    } else if (key == "include_package" || key == "exclude_package") {
+      if (value.empty()) {
+        *error_msg = StringPrintf("Empty %s", key.c_str());
+        return false;
+      }
+      std::string descriptor = "L" + value + "/";
+      std::replace(descriptor.begin(), descriptor.end(), '.', '/');
+      (key == "include_package" ? options->include_packages : options->exclude_packages)
+          .push_back(descriptor);
+    } else if (key == "include_class" || key == "exclude_class") {
+      if (value.empty()) {
+        *error_msg = StringPrintf("Empty %s", key.c_str());
+        return false;
+      }
+      (key == "include_class" ? options->include_classes : options->exclude_classes)
+          .push_back(DotToDescriptor(value.c_str()));
+    } else if (key == "flush_interval_ms") {
+      if (!android::base::ParseUint(value, &options->flush_interval_ms)) {
+        *error_msg = StringPrintf("Invalid flush_interval_ms '%s'", value.c_str());
+        return false;
+      }
+    } else if (key == "flush_new_coverage") {
+      if (!android::base::ParseUint(value, &options->flush_new_coverage)) {
+        *error_msg = StringPrintf("Invalid flush_new_coverage '%s'", value.c_str());
+        return false;
+      }
+    } else if (key == "events") {
+      options->events = 0u;
+      for (const std::string& raw_kind : android::base::Split(value, ",")) {
+        std::string kind = android::base::Trim(raw_kind);
+        if (kind == "method") {
+          options->events |= MiniTraceOptions::kMethodEvents;
+        } else if (kind == "exception") {
+          options->events |= MiniTraceOptions::kExceptionEvents;
+        } else if (kind == "invoke") {
+          options->events |= MiniTraceOptions::kInvokeEvents;
+        } else if (kind == "field") {
+          options->events |= MiniTraceOptions::kFieldEvents;
+        } else if (!kind.empty()) {
+          *error_msg = StringPrintf("Unknown event kind '%s'", kind.c_str());
+          return false;
+        }
+      }
+    } else if (key == "event_buffer_kb") {
+      size_t event_buffer_kb;
+      if (!android::base::ParseUint(value,
+                                    &event_buffer_kb,
+                                    std::numeric_limits<size_t>::max() / KB) ||
+          event_buffer_kb == 0u) {
+        *error_msg = StringPrintf("Invalid event_buffer_kb '%s'", value.c_str());
+        return false;
+      }
+      options->event_buffer_size = event_buffer_kb * KB;
+    } else if (key == "call_graph" || key == "field_coverage") {
+      if (value != "true" && value != "false") {
+        *error_msg = StringPrintf("Invalid %s '%s'", key.c_str(), value.c_str());
+        return false;
+      }
+      (key == "call_graph" ? options->call_graph : options->field_coverage) = (value == "true");
+    } else if (key == "edge_map") {
+      options->edge_map = value;
+    } else if (key == "edge_map_size_kb") {
+      size_t edge_map_size_kb;
+      if (!android::base::ParseUint(value,
+                                    &edge_map_size_kb,
+                                    std::numeric_limits<uint32_t>::max() / KB) ||
+          edge_map_size_kb == 0u ||
+          !IsPowerOfTwo(edge_map_size_kb)) {
+        *error_msg = StringPrintf("Invalid edge_map_size_kb '%s'", value.c_str());
+        return false;
+      }
+      options->edge_map_size = edge_map_size_kb * KB;
+    } else if (key == "ring_size_mb") {
+      size_t ring_size_mb;
+      if (!android::base::ParseUint(value, &ring_size_mb, std::numeric_limits<size_t>::max() / MB) ||
+          ring_size_mb == 0u) {
+        *error_msg = StringPrintf("Invalid ring_size_mb '%s'", value.c_str());
+        return false;
+      }
+      options->ring_size = ring_size_mb * MB;
+    } else {
+      LOG(WARNING) << "MiniTrace: Ignoring unknown config key '" << key << "'";
+    }
+  }
+  return true;
+}
+
+MiniTrace::MiniTrace(const MiniTraceOptions& options,
+                     std::unique_ptr<MiniTraceRingWriter> writer,
+                     std::unique_ptr<MiniTraceRingWriter> event_writer,
+                     std::unique_ptr<MemMap> edge_map)
+    : options_(options),
+      instrumentation_events_(GetInstrumentationEvents(options)),
+      edge_map_(std::move(edge_map)),
+      edge_counts_(edge_map_ != nullptr ? reinterpret_cast<Atomic<uint8_t>*>(edge_map_->Begin())
+                                        : nullptr),
+      io_lock_("MiniTrace I/O lock", kMiniTraceIoLock),
+      writer_lock_("MiniTrace writer lock", kMiniTraceWriterLock),
+      writer_(std::move(writer)),
+      event_writer_(std::move(event_writer)),
+      dump_lock_("MiniTrace dump lock", kMiniTraceDumpLock),
+      dump_cond_("MiniTrace dump condition", dump_lock_),
+      writer_pthread_started_(false),
+      shutting_down_(false),
+      inline_writers_(0u),
+      last_snapshot_ms_(0u),
+      epoch_(0u),
+      new_coverage_(0u),
+      coverage_lock_("MiniTrace coverage lock", kMiniTraceCoverageLock),
+      coverage_top_(nullptr),
+      coverage_end_(nullptr),
+      coverage_exhausted_(false),
+      dirty_records_(nullptr),
+      probed_records_(nullptr) {}
+
+MiniTrace::~MiniTrace() {}
+
+bool MiniTrace::RequiresCoverageProbes(ArtMethod* method) {
+  return IsMiniTraceActive() && !method->IsNative() && method->IsMiniTraceable();
+}
+
+bool MiniTrace::RequiresInterpreter(ArtMethod* method, const void* quick_code) {
+  if (!RequiresCoverageProbes(method)) {
+    return false;
+  }
+  // Only the interpreter reports events.
+  MiniTrace* the_trace = the_trace_;
+  if (the_trace != nullptr && the_trace->instrumentation_events_ != 0u) {
+    return true;
+  }
+  // The code cache tags the code it commits with the coverage probes of this trace. Other code,
+  // e.g. code compiled before Start(), stays in the code cache but has no probes.
+  jit::Jit* jit = Runtime::Current()->GetJit();
+  if (jit == nullptr || !jit->GetCodeCache()->ContainsPc(quick_code)) {
+    return true;
+  }
+  ProfilingInfo* info = method->GetProfilingInfo(kRuntimePointerSize);
+  return info == nullptr || !info->HasCoverageProbes(code_generation_, quick_code);
+}
 
 void MiniTrace::DexPcMoved(Thread* thread, Handle<mirror::Object> this_object,
                        ArtMethod* method, uint32_t new_dex_pc) {
@@ -290,72 +1760,130 @@ void MiniTrace::DexPcMoved(Thread* thread, Handle<mirror::Object> this_object,
 
 void MiniTrace::FieldRead(Thread* thread, Handle<mirror::Object> this_object,
                        ArtMethod* method, uint32_t dex_pc, ArtField* field) {
-  UNUSED(thread, this_object, method, dex_pc, field);
+  UNUSED(this_object, dex_pc);
+  if ((options_.events & MiniTraceOptions::kFieldEvents) != 0u) {
+    RecordEvent(thread, method, kMiniTraceEventFieldRead);
+  }
+  if (options_.field_coverage) {
+    RecordFieldAccess(field, kMiniTraceFieldRead);
+  }
 }
 
 void MiniTrace::FieldWritten(Thread* thread, Handle<mirror::Object> this_object,
                           ArtMethod* method, uint32_t dex_pc, ArtField* field,
                           const JValue& field_value) {
-  UNUSED(thread, this_object, method, dex_pc, field, field_value);
+  UNUSED(this_object, dex_pc, field_value);
+  if ((options_.events & MiniTraceOptions::kFieldEvents) != 0u) {
+    RecordEvent(thread, method, kMiniTraceEventFieldWritten);
+  }
+  if (options_.field_coverage) {
+    RecordFieldAccess(field, kMiniTraceFieldWritten);
+  }
 }
 
 void MiniTrace::MethodEntered(Thread* thread, Handle<mirror::Object> this_object,
                           ArtMethod* method, uint32_t dex_pc) {
-  UNUSED(thread, this_object, method, dex_pc);
+  UNUSED(this_object, dex_pc);
+  RecordEvent(thread, method, kMiniTraceEventMethodEntered);
 }
 
 void MiniTrace::MethodExited(Thread* thread, Handle<mirror::Object> this_object,
                          ArtMethod* method, uint32_t dex_pc,
                          Handle<mirror::Object> return_value) {
-  UNUSED(thread, this_object, method, dex_pc, return_value);
+  UNUSED(this_object, dex_pc, return_value);
+  RecordEvent(thread, method, kMiniTraceEventMethodExited);
 }
 
 void MiniTrace::MethodExited(Thread* thread, Handle<mirror::Object> this_object,
                          ArtMethod* method, uint32_t dex_pc,
                          const JValue& return_value) {
-  UNUSED(thread, this_object, method, dex_pc, return_value);
+  UNUSED(this_object, dex_pc, return_value);
+  RecordEvent(thread, method, kMiniTraceEventMethodExited);
 }
 
 void MiniTrace::MethodUnwind(Thread* thread, Handle<mirror::Object> this_object,
                          ArtMethod* method, uint32_t dex_pc) {
-  UNUSED(thread, this_object, method, dex_pc);
+  UNUSED(this_object, dex_pc);
+  RecordEvent(thread, method, kMiniTraceEventMethodUnwind);
 }
 
 void MiniTrace::ExceptionThrown(Thread* thread, Handle<mirror::Throwable> exception_object) {
-  UNUSED(thread, exception_object);
+  UNUSED(exception_object);
+  // Exceptions are rare enough to walk the stack for the method throwing.
+  ArtMethod* method = thread->GetCurrentMethod(/* dex_pc */ nullptr,
+                                               /* check_suspended */ true,
+                                               /* abort_on_error */ false);
+  RecordEvent(thread, method, kMiniTraceEventExceptionThrown);
 }
 
 void MiniTrace::ExceptionHandled(Thread* thread, Handle<mirror::Throwable> exception_object) {
-  UNUSED(thread, exception_object);
+  UNUSED(exception_object);
+  ArtMethod* method = thread->GetCurrentMethod(/* dex_pc */ nullptr,
+                                               /* check_suspended */ true,
+                                               /* abort_on_error */ false);
+  RecordEvent(thread, method, kMiniTraceEventExceptionHandled);
 }
 
 void MiniTrace::Branch(Thread* thread, ArtMethod* method, uint32_t dex_pc, int32_t dex_pc_offset) {
-  UNUSED(thread, method, dex_pc, dex_pc_offset);
+  UNUSED(thread);
+  if (edge_counts_ == nullptr || !method->IsMiniTraceable()) {
+    return;
+  }
+  uint32_t hash = HashEdge(method->GetDexFile()->GetLocationChecksum(),
+                           method->GetDexMethodIndex(),
+                           dex_pc,
+                           dex_pc + dex_pc_offset);
+  Atomic<uint8_t>* counter = &edge_counts_[hash & (options_.edge_map_size - 1u)];
+  // Like AFL, racing increments may get lost. The count saturates instead of wrapping to 0.
+  uint8_t count = counter->LoadRelaxed();
+  if (count != std::numeric_limits<uint8_t>::max()) {
+    counter->StoreRelaxed(count + 1u);
+  }
 }
 
 void MiniTrace::InvokeVirtualOrInterface(Thread* thread, Handle<mirror::Object> this_object, ArtMethod* caller, uint32_t dex_pc, ArtMethod* callee) {
-  UNUSED(thread, this_object, caller, dex_pc, callee);
+  UNUSED(this_object);
+  if ((options_.events & MiniTraceOptions::kInvokeEvents) != 0u) {
+    RecordEvent(thread, caller, kMiniTraceEventInvokeVirtualOrInterface);
+  }
+  if (options_.call_graph) {
+    RecordCallEdge(thread, caller, dex_pc, callee);
+  }
 }
 
 void MiniTrace::WatchedFramePop(Thread* thread ATTRIBUTE_UNUSED, const ShadowFrame& frame ATTRIBUTE_UNUSED) {}
 
-void MiniTrace::PostClassPrepare(mirror::Class* klass) {
-  if (klass->IsArrayClass() || klass->IsInterface() || klass->IsPrimitive() || klass->IsProxyClass()) {
+bool MiniTrace::CanTraceClass(mirror::Class* klass) {
+  return !klass->IsArrayClass() &&
+         !klass->IsInterface() &&
+         !klass->IsPrimitive() &&
+         !klass->IsProxyClass();
+}
+
+void MiniTrace::SetClassTraceable(mirror::Class* klass, bool traceable) {
+  if (!traceable) {
+    // A previous trace with other rules may have traced the class.
+    klass->ClearIsMiniTraceable();
     return;
   }
+  klass->SetIsMiniTraceable();
+  Runtime::Current()->GetInstrumentation()->InstallStubsForClass(klass);
+}
 
-  const char* prefix = "/system/framework/";
-  const char* location = klass->GetDexFile().GetLocation().c_str();
-  if (strncmp(location, prefix, strlen(prefix)) == 0) {
+void MiniTrace::PostClassPrepare(mirror::Class* klass) {
+  // Start() visits the classes loaded before it.
+  MiniTrace* the_trace = the_trace_;
+  if (the_trace == nullptr || !CanTraceClass(klass)) {
     return;
   }
-
-  // Set flags
-  klass->SetIsMiniTraceable();
-  if (IsMiniTraceActive()) {
-    // Install Stubs
-    Runtime::Current()->GetInstrumentation()->InstallStubsForClass(klass);
+  // Check the dex file first, most classes are excluded by it without building the descriptor.
+  bool traceable =
+      IsDexFileTraceable(the_trace->options_, klass->GetDexFile().GetLocation().c_str());
+  if (traceable) {
+    std::string temp;
+    traceable = IsClassNameTraceable(the_trace->options_, klass->GetDescriptor(&temp));
   }
+  SetClassTraceable(klass, traceable);
 }
 
 void MiniTrace::MiniTraceClassLoadCallback::ClassLoad(Handle<mirror::Class> klass ATTRIBUTE_UNUSED) {
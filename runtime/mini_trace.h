@@ -17,6 +17,9 @@
 #ifndef ART_RUNTIME_MINI_TRACE_H_
 #define ART_RUNTIME_MINI_TRACE_H_
 
+#include <pthread.h>
+
+#include <deque>
 #include <memory>
 #include <ostream>
 #include <set>
@@ -24,8 +27,10 @@
 #include <vector>
 #include <queue>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "base/atomic.h"
+#include "base/bit_utils.h"
 #include "base/macros.h"
 #include "base/os.h"
 #include "base/safe_map.h"
@@ -34,6 +39,7 @@
 #include "globals.h"
 #include "instrumentation.h"
 #include "class_linker.h"
+#include "mini_trace_format.h"
 #include "trace.h"
 
 namespace art {
@@ -45,12 +51,143 @@ class Class;
 class Thread;
 class ArtField;
 class ArtMethod;
+class CodeItemDataAccessor;
+class DexFile;
+class MemMap;
+class MiniTraceRingWriter;
+
+// Options read from /data/mini_trace_<uid>_config.in, one `key=value` per line. Text after a
+// '#' is ignored.
+struct MiniTraceOptions {
+  // `output_format=binary` writes the coverage to a memory-mapped ring file (see
+  // mini_trace_format.h) instead of appending text to the coverage data file.
+  bool binary_output = false;
+  // `ring_size_mb`: size of the ring file.
+  size_t ring_size = 64 * MB;
+  // `flush_interval_ms`: dump in the background at this interval, 0 to only dump on request.
+  uint32_t flush_interval_ms = 0;
+  // `flush_new_coverage`: dump in the background once this many instructions executed for the
+  // first time since the last dump, 0 to disable. JIT-compiled code is not counted.
+  uint32_t flush_new_coverage = 0;
+
+  // `events`: comma-separated kinds of events of traced methods to record per thread, `method`
+  // (entry, exit, unwind), `exception` (thrown, caught), `invoke` (virtual and interface
+  // calls) and `field` (reads, writes). The events are written to a ring file of `ring_size`
+  // next to the coverage. Traced methods run in the interpreter while events are recorded.
+  static constexpr uint32_t kMethodEvents = 1;
+  static constexpr uint32_t kExceptionEvents = 2;
+  static constexpr uint32_t kInvokeEvents = 4;
+  static constexpr uint32_t kFieldEvents = 8;
+  uint32_t events = 0;
+  // `event_buffer_kb`: size of the event buffer of each thread. Events recorded while the
+  // buffer is full are counted and dropped.
+  size_t event_buffer_size = 64 * KB;
+
+  // `edge_map`: file to share branch coverage with a fuzzer through, as an AFL-style map of
+  // one-byte saturating hit counts indexed by HashEdge(). The file is created if needed but not
+  // cleared, the fuzzer resets it between inputs. Traced methods run in the interpreter.
+  std::string edge_map;
+  // `edge_map_size_kb`: size of the map, a power of two.
+  size_t edge_map_size = 64 * KB;
+
+  // `call_graph=true` records the distinct virtual and interface calls made by traced methods,
+  // with their call site and resolved callee, and dumps the new ones with the coverage.
+  bool call_graph = false;
+
+  // `field_coverage=true` records whether the fields declared by traced classes are read and
+  // written, and dumps the accessed fields with the method coverage.
+  bool field_coverage = false;
+
+  // Classes to trace. `include_dex` and `exclude_dex` take dex location prefixes,
+  // `include_package` and `exclude_package` Java packages (with their subpackages), and
+  // `include_class` and `exclude_class` class name globs where `*` matches any run of
+  // characters and `?` any one character, e.g. `com.example.*Activity`. Each key may be given
+  // several times. A class is traced if it matches no exclude rule, and, if there are include
+  // rules for dex files or for names, one of each. Without dex rules, /system/framework/ is
+  // excluded.
+  std::vector<std::string> include_dex_locations;
+  std::vector<std::string> exclude_dex_locations = { "/system/framework/" };
+  // Packages and globs are kept as class descriptors, e.g. "Lcom/example/".
+  std::vector<std::string> include_packages;
+  std::vector<std::string> exclude_packages;
+  std::vector<std::string> include_classes;
+  std::vector<std::string> exclude_classes;
+};
+
+// An event in the buffer of a thread.
+struct MiniTraceEvent {
+  uint64_t timestamp;
+  // The CoverageRecord of the method, which is 8-byte aligned, or'ed with the
+  // MiniTraceEventType.
+  uintptr_t data;
+};
+
+// A virtual or interface call from a traced method.
+struct MiniTraceCallEdge {
+  // The coverage data of the caller, which identifies it like the data of events does.
+  uint8_t* caller_coverage_data;
+  uint32_t dex_pc;
+  uint32_t callee_method_idx;
+  // The resolved callee is kept by dex file and index, it may be unloaded before the dump.
+  const DexFile* callee_dex_file;
+
+  bool operator==(const MiniTraceCallEdge& other) const {
+    return caller_coverage_data == other.caller_coverage_data &&
+           dex_pc == other.dex_pc &&
+           callee_method_idx == other.callee_method_idx &&
+           callee_dex_file == other.callee_dex_file;
+  }
+};
+
+struct MiniTraceCallEdgeHash {
+  size_t operator()(const MiniTraceCallEdge& edge) const {
+    size_t hash = reinterpret_cast<uintptr_t>(edge.caller_coverage_data);
+    hash = hash * 31u + edge.dex_pc;
+    hash = hash * 31u + reinterpret_cast<uintptr_t>(edge.callee_dex_file);
+    return hash * 31u + edge.callee_method_idx;
+  }
+};
+
+using MiniTraceCallEdgeSet = std::unordered_set<MiniTraceCallEdge, MiniTraceCallEdgeHash>;
+
+// Events and calls recorded by one thread. Only that thread adds events and only the writer
+// thread, or Stop() once it is gone, takes them out, so the buffer needs no locks.
+struct MiniTraceThreadData {
+  MiniTraceThreadData(uint32_t tid_in, size_t capacity_in)
+      : tid(tid_in),
+        capacity(capacity_in),
+        events(capacity_in != 0u ? new MiniTraceEvent[capacity_in] : nullptr),
+        head(0u),
+        tail(0u),
+        dropped(0u),
+        call_edge_lock("MiniTrace call edge lock", kMiniTraceCallEdgeLock) {}
+
+  const uint32_t tid;
+  const size_t capacity;  // A power of two, 0 if no events are recorded.
+  const std::unique_ptr<MiniTraceEvent[]> events;
+  Atomic<uint64_t> head;  // Index of the next event to record.
+  Atomic<uint64_t> tail;  // Index of the next event to write.
+  Atomic<uint32_t> dropped;  // Events dropped since the last write.
+
+  // The calls made by the thread, only used by the thread. A call is looked up here first and
+  // only takes `call_edge_lock` the first time the thread makes it.
+  MiniTraceCallEdgeSet call_edges;
+  Mutex call_edge_lock;
+  // The calls first made since the last dump.
+  std::vector<MiniTraceCallEdge> new_call_edges GUARDED_BY(call_edge_lock);
+};
 
 class MiniTrace : public instrumentation::InstrumentationListener {
  public:
+  // Starts tracing with the options of the config file of the app, if there is one.
   static void Start()
       REQUIRES(!Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::thread_suspend_count_lock_,
                !Locks::trace_lock_);
+  // Starts tracing with `options`. Returns false if a trace is running already or the output
+  // files could not be created.
+  static bool Start(const MiniTraceOptions& options)
+      REQUIRES(!Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::thread_suspend_count_lock_,
+               !Locks::trace_lock_);
   static void Stop()
       REQUIRES(!Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::trace_lock_);
   static void Shutdown() REQUIRES(!Locks::trace_lock_);
@@ -129,13 +266,118 @@ class MiniTrace : public instrumentation::InstrumentationListener {
                                const ShadowFrame& frame ATTRIBUTE_UNUSED)
       REQUIRES_SHARED(Locks::mutator_lock_) OVERRIDE;
 
-  static void DumpCoverageData(std::ostream& os, ArtMethod* method) REQUIRES_SHARED(Locks::mutator_lock_);
+  // Writes the coverage recorded since the last dump before returning.
   static void DumpCoverageData(bool start = false) REQUIRES(!Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::thread_suspend_count_lock_);
 
+  // Takes the coverage recorded since the last dump and leaves writing it to a background
+  // thread. Used by the signal catcher.
+  static void RequestCoverageDump() REQUIRES(!Locks::mutator_lock_);
+
+  // Ends the current epoch: takes the coverage recorded in it like RequestCoverageDump() and
+  // records the following coverage in a new epoch. Dumps are tagged with the epoch they were
+  // recorded in, so a test runner can attribute coverage to tests by starting an epoch per
+  // test. Returns the new epoch, or -1 if no trace is active.
+  static int64_t NextEpoch() REQUIRES(!Locks::mutator_lock_);
+
+  // Drops the coverage recorded since the last dump, e.g. before a test starts. Calls and
+  // events are not reset, calls are still only reported the first time they are made.
+  static void ResetCoverageData() REQUIRES(!Locks::mutator_lock_);
+
+  // Writes the coverage recorded since the last dump to `fd` in the text format, whatever
+  // the output format, instead of to the coverage file. Returns false if no trace is active
+  // or writing failed.
+  static bool DumpCoverageDataToFd(int fd, std::string* error_msg)
+      REQUIRES(!Locks::mutator_lock_);
+
   static ClassLoadCallback* GetClassLoadCallback() { return &class_load_callback_; }
 
   static bool IsMiniTraceActive() { return the_trace_ != nullptr; }
 
+  // Parses the contents of a config file. Unknown keys and lines are ignored with a warning.
+  static bool ParseOptions(const std::string& config,
+                           MiniTraceOptions* options,
+                           std::string* error_msg);
+
+  // Index of the edge from `source_dex_pc` to `target_dex_pc` of a method in the edge map,
+  // before masking with the map size.
+  static uint32_t HashEdge(uint32_t dex_checksum,
+                           uint32_t method_idx,
+                           uint32_t source_dex_pc,
+                           uint32_t target_dex_pc) {
+    uint64_t method = (static_cast<uint64_t>(dex_checksum) << 32) | method_idx;
+    uint64_t edge = (static_cast<uint64_t>(source_dex_pc) << 32) | target_dex_pc;
+    uint64_t hash = (method * UINT64_C(0x9e3779b97f4a7c15)) ^ (edge * UINT64_C(0xc2b2ae3d27d4eb4f));
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+  }
+
+  // Whether the class with `descriptor` from the dex file at `dex_location` passes the
+  // include and exclude rules of `options`.
+  static bool IsClassTraceable(const MiniTraceOptions& options,
+                               const char* descriptor,
+                               const char* dex_location);
+
+  // The dex file and the name parts of IsClassTraceable().
+  static bool IsDexFileTraceable(const MiniTraceOptions& options, const char* dex_location);
+  static bool IsClassNameTraceable(const MiniTraceOptions& options, const char* descriptor);
+
+  // Whether `klass` has code of its own whose coverage can be recorded.
+  static bool CanTraceClass(mirror::Class* klass) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Marks `klass` as traced or not and routes its methods accordingly.
+  static void SetClassTraceable(mirror::Class* klass, bool traceable)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Coverage data of a method, allocated when the method first runs while tracing: one bit
+  // per code unit, set when the interpreter executes the instruction there, followed by one
+  // byte per basic block (see FindCoverageBlocks), set when compiled code enters the block.
+  static uint8_t* AllocateCoverageData(ArtMethod* method) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  static size_t GetExecutedBitmapSize(uint32_t insns_size) {
+    return RoundUp(insns_size, kBitsPerByte) / kBitsPerByte;
+  }
+
+  // Returns the sorted dex pcs of the basic blocks whose entry compiled code records. These
+  // are the blocks the optimizing compiler builds for the method.
+  static std::vector<uint32_t> FindCoverageBlocks(const CodeItemDataAccessor& accessor);
+
+  // Records the execution of the instruction at `dex_pc` in `coverage_data`. Interpreters
+  // that run a whole frame resolve the coverage data of its method once and call this for
+  // each instruction.
+  ALWAYS_INLINE static void RecordExecution(uint8_t* coverage_data, uint32_t dex_pc) {
+    // One bit per code unit. Check first so that only the first execution of an instruction
+    // pays for the atomic update and hot code does not keep dirtying the cache line.
+    Atomic<uint8_t>* addr =
+        reinterpret_cast<Atomic<uint8_t>*>(coverage_data + dex_pc / kBitsPerByte);
+    const uint8_t mask = 1u << (dex_pc % kBitsPerByte);
+    if ((addr->LoadRelaxed() & mask) == 0 &&
+        (addr->FetchAndBitwiseOrSequentiallyConsistent(mask) & mask) == 0) {
+      RecordFirstExecution(coverage_data);
+    }
+  }
+
+  // Called when the interpreter records the first execution of an instruction in
+  // `coverage_data`. Queues the method for the next dump if it is not queued yet.
+  static void RecordFirstExecution(uint8_t* coverage_data);
+
+  // Called when JIT code records into `coverage_data`. Such code does not queue its method,
+  // so the method is checked by every dump instead.
+  static void RecordCoverageProbes(uint8_t* coverage_data);
+
+  // Whether the coverage of `method` is recorded. Compiled code for such methods is only
+  // allowed if it was JIT-compiled with coverage probes.
+  static bool RequiresCoverageProbes(ArtMethod* method) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Whether `method` must run in the interpreter instead of `quick_code` so that its coverage
+  // is recorded. Only JIT code compiled while the trace is active has coverage probes.
+  static bool RequiresInterpreter(ArtMethod* method, const void* quick_code)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Changes every time a trace starts. JIT compilations read it before they build the graph,
+  // code from a compilation that started in an earlier generation is not committed.
+  static uint32_t GetCodeGeneration() REQUIRES_SHARED(Locks::mutator_lock_) {
+    return code_generation_;
+  }
+
  private:
   class MiniTraceClassLoadCallback : public ClassLoadCallback {
    public:
@@ -146,11 +388,283 @@ class MiniTrace : public instrumentation::InstrumentationListener {
 
   static MiniTraceClassLoadCallback class_load_callback_;
 
-  MiniTrace();
+  // Header in front of the coverage data of each method.
+  struct CoverageRecord {
+    ArtMethod* method;
+    const DexFile* dex_file;
+    CoverageRecord* next_dirty;   // Next record in dirty_records_.
+    CoverageRecord* next_probed;  // Next record in probed_records_.
+    Atomic<uint32_t> flags;
+    uint32_t size;  // Size of the coverage data.
+  };
+
+  static constexpr uint32_t kRecordDirty = 1;   // In dirty_records_.
+  static constexpr uint32_t kRecordProbed = 2;  // In probed_records_.
+
+  // Coverage of a field taken by a snapshot.
+  struct FieldCoverage {
+    const DexFile* dex_file;
+    uint32_t field_idx;
+    uint8_t flags;  // kMiniTraceFieldRead, kMiniTraceFieldWritten.
+  };
+
+  static CoverageRecord* GetCoverageRecord(uint8_t* coverage_data) {
+    return reinterpret_cast<CoverageRecord*>(coverage_data) - 1;
+  }
+
+  // Coverage records are 8-byte aligned (see AllocateCoverageStorage), events keep their type
+  // in the low bits of the record address.
+  static constexpr uintptr_t kEventTypeMask = 7;
+
+  MiniTrace(const MiniTraceOptions& options,
+            std::unique_ptr<MiniTraceRingWriter> writer,
+            std::unique_ptr<MiniTraceRingWriter> event_writer,
+            std::unique_ptr<MemMap> edge_map);
+  ~MiniTrace();
+
+  // Returns the coverage data of `method`, allocating `size` bytes for it (and the coverage
+  // table of its dex file) on first use.
+  uint8_t* InstallCoverageData(ArtMethod* method, size_t size)
+      REQUIRES(!coverage_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Returns the field coverage of `dex_file`, allocating it on first use.
+  Atomic<uint8_t>* InstallFieldCoverage(const DexFile* dex_file) REQUIRES(!coverage_lock_);
+
+  // Sets `flag` in the field coverage of `field` if its class is traced. Field coverage uses
+  // the flags of the binary format.
+  void RecordFieldAccess(ArtField* field, uint8_t flag)
+      REQUIRES(!coverage_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Adds the field coverage recorded since the last snapshot to `field_coverage` and clears it.
+  void TakeFieldCoverage(std::vector<FieldCoverage>* field_coverage)
+      REQUIRES(!coverage_lock_, !Locks::dex_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  static void PushCoverageRecord(Atomic<CoverageRecord*>* list,
+                                 CoverageRecord* record,
+                                 CoverageRecord* CoverageRecord::* next);
+
+  // Coverage data taken from the trace by one dump, waiting to be written.
+  struct CoverageSnapshot {
+    bool start;
+    uint64_t time_ms;
+    uint64_t epoch;  // The epoch the coverage was recorded in.
+    // The methods that recorded coverage, with the offset of their data in `data`.
+    std::vector<std::pair<CoverageRecord*, size_t>> records;
+    std::vector<uint8_t> data;
+    // The calls first made since the last snapshot.
+    std::vector<MiniTraceCallEdge> call_edges;
+    // The fields accessed since the last snapshot.
+    std::vector<FieldCoverage> field_coverage;
+  };
+
+  // Appends the coverage data of `record` to `data` and clears it. Returns false, leaving
+  // `data` unchanged, if nothing was recorded since the last dump.
+  static bool SnapshotCoverageData(CoverageRecord* record, std::vector<uint8_t>* data);
+
+  // Queues a snapshot for the writer thread, or writes it if there is none, and starts the
+  // next epoch if `next_epoch`. Returns the current epoch, or -1 if no trace is active.
+  static int64_t RequestSnapshot(bool next_epoch) REQUIRES(!Locks::mutator_lock_);
+
+  // Takes the coverage recorded since the last dump.
+  std::unique_ptr<CoverageSnapshot> CreateSnapshot(bool start)
+      REQUIRES(dump_lock_, !Locks::dex_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Queues the coverage recorded since the last dump for writing.
+  void TakeSnapshot(bool start)
+      REQUIRES(dump_lock_, !Locks::dex_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Converts the coverage `data` of `method` to one flag per code unit.
+  static void ExpandCoverageData(ArtMethod* method,
+                                 const uint8_t* data,
+                                 std::vector<bool>* covered)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // The dex files and methods named in a text output already.
+  struct TextNames {
+    std::unordered_set<uint32_t> dex_files;
+    std::unordered_set<uint64_t> methods;
+  };
+
+  // Writes the DexFile and Method rows naming method `method_idx` of `dex_file` unless
+  // `names` has them.
+  static void DumpMethodNames(std::ostream& os,
+                              TextNames* names,
+                              const DexFile& dex_file,
+                              uint32_t method_idx);
+
+  static void DumpCoverageData(std::ostream& os,
+                               TextNames* names,
+                               ArtMethod* method,
+                               const std::vector<bool>& covered)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  static void DumpFieldCoverage(std::ostream& os, const FieldCoverage& field_coverage);
+
+  static void DumpCallEdge(std::ostream& os,
+                           TextNames* names,
+                           const DexFile& caller_dex_file,
+                           uint32_t caller_method_idx,
+                           const MiniTraceCallEdge& edge);
+
+  static void WriteCoverageData(MiniTraceRingWriter* writer,
+                                ArtMethod* method,
+                                const std::vector<bool>& covered)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Writes `snapshot` to the ring file of `writer` if there is one and to `os` otherwise,
+  // naming the methods `names` does not have yet.
+  void WriteSnapshot(const CoverageSnapshot& snapshot,
+                     MiniTraceRingWriter* writer,
+                     TextNames* names,
+                     std::ostream& os)
+      REQUIRES(writer_lock_, !Locks::dex_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Writes the queued snapshots and syncs them to disk.
+  void WriteSnapshots(Thread* self)
+      REQUIRES(!io_lock_, !writer_lock_, !dump_lock_, !Locks::mutator_lock_);
+
+  // Returns the active trace, or null, for a thread that writes snapshots itself. Stop() does
+  // not delete the trace before the thread calls EndInlineWrite().
+  static MiniTrace* BeginInlineWrite(Thread* self) REQUIRES(!Locks::trace_lock_);
+  void EndInlineWrite(Thread* self) REQUIRES(!dump_lock_);
+
+  static void AppendToCoverageFile(const std::string& data);
+
+  // Instrumentation events the listener needs for `options`. They are only reported by the
+  // interpreter.
+  static uint32_t GetInstrumentationEvents(const MiniTraceOptions& options);
+
+  // Maps the `edge_map` file of `options`, creating or growing it as needed.
+  static std::unique_ptr<MemMap> MapEdgeMap(const MiniTraceOptions& options,
+                                            std::string* error_msg);
+
+  // Adds an event of `type` in `method` to the buffer of `self`.
+  void RecordEvent(Thread* self, ArtMethod* method, MiniTraceEventType type)
+      REQUIRES(!coverage_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  MiniTraceThreadData* AllocateThreadData(Thread* self) REQUIRES(!coverage_lock_);
+
+  // Remembers the call at `dex_pc` of `caller` to `callee` for the next dump.
+  void RecordCallEdge(Thread* self, ArtMethod* caller, uint32_t dex_pc, ArtMethod* callee)
+      REQUIRES(!coverage_lock_) REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Moves the calls first made by any thread since the last dump to `call_edges`.
+  void TakeCallEdges(std::vector<MiniTraceCallEdge>* call_edges)
+      REQUIRES(dump_lock_, !coverage_lock_);
+
+  // Writes the events recorded by all threads to the event ring file.
+  void DrainEvents(Thread* self)
+      REQUIRES(!writer_lock_, !coverage_lock_, !Locks::dex_lock_)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Detaches the event buffers from the threads. Must not race with RecordEvent().
+  void ReleaseThreadData() REQUIRES(!coverage_lock_, Locks::mutator_lock_);
+
+  static void* RunWriterThread(void* arg);
+
+  // Starts the writer thread unless it runs already. Returns false if dumps have to be
+  // written by the requesting thread.
+  bool StartWriterThread() REQUIRES(dump_lock_);
+
+  // Whether the options ask for a dump now. Otherwise returns in `wait_ms` how long the writer
+  // thread may sleep before checking again, 0 for no limit.
+  bool IsFlushDue(int64_t* wait_ms) REQUIRES(dump_lock_);
+
+  void StopWriterThread(Thread* self) REQUIRES(!dump_lock_);
+
+  // Returns `size` zeroed bytes of coverage storage, or null if it could not be mapped.
+  uint8_t* AllocateCoverageStorage(size_t size) REQUIRES(coverage_lock_);
+
+  // Detaches the coverage tables from the dex files and gives the coverage storage back to the
+  // system.
+  void ReleaseCoverageStorage() REQUIRES(!coverage_lock_, !Locks::trace_lock_)
+      REQUIRES(Locks::mutator_lock_);
 
   // Singleton instance of the Trace or NULL when no method tracing is active.
   static MiniTrace* volatile the_trace_;
 
+  // Incremented by Start() while all threads are suspended.
+  static uint32_t code_generation_ GUARDED_BY(Locks::mutator_lock_);
+
+  // Coverage storage released by previous traces. JIT code compiled while tracing may still
+  // execute coverage probes, so the address space stays reserved.
+  static std::vector<std::unique_ptr<MemMap>>* retired_coverage_maps_
+      GUARDED_BY(Locks::trace_lock_);
+
+  const MiniTraceOptions options_;
+
+  // GetInstrumentationEvents(options_).
+  const uint32_t instrumentation_events_;
+
+  // The shared edge map, null if not configured.
+  const std::unique_ptr<MemMap> edge_map_;
+  Atomic<uint8_t>* const edge_counts_;
+
+  // Serializes writing the dumps out to storage. Only taken in the native state, before the
+  // mutator lock, so that runnable threads never wait for the I/O.
+  Mutex io_lock_;
+
+  // Serializes writing the dumps.
+  Mutex writer_lock_;
+
+  // Writer of the ring file, null for text output.
+  const std::unique_ptr<MiniTraceRingWriter> writer_ PT_GUARDED_BY(writer_lock_);
+
+  // Writer of the event ring file, null unless events are recorded.
+  const std::unique_ptr<MiniTraceRingWriter> event_writer_ PT_GUARDED_BY(writer_lock_);
+
+  // The names written to the coverage data file by this process.
+  TextNames text_names_ GUARDED_BY(writer_lock_);
+
+  // Guards the queue of snapshots and the writer thread.
+  Mutex dump_lock_;
+  ConditionVariable dump_cond_ GUARDED_BY(dump_lock_);
+  std::deque<std::unique_ptr<CoverageSnapshot>> pending_snapshots_ GUARDED_BY(dump_lock_);
+  pthread_t writer_pthread_ GUARDED_BY(dump_lock_);
+  bool writer_pthread_started_ GUARDED_BY(dump_lock_);
+  bool shutting_down_ GUARDED_BY(dump_lock_);
+  // Threads between BeginInlineWrite() and EndInlineWrite().
+  uint32_t inline_writers_ GUARDED_BY(dump_lock_);
+
+  // The calls dumped already, to leave out calls made first by one thread and then another.
+  MiniTraceCallEdgeSet dumped_call_edges_ GUARDED_BY(dump_lock_);
+
+  // Time of the last snapshot, for `flush_interval_ms`.
+  uint64_t last_snapshot_ms_ GUARDED_BY(dump_lock_);
+
+  // Epoch of the coverage recorded now, see NextEpoch().
+  uint64_t epoch_ GUARDED_BY(dump_lock_);
+
+  // Instructions executed for the first time since the last snapshot, for
+  // `flush_new_coverage`.
+  Atomic<uint32_t> new_coverage_;
+
+  // Guards the allocation of coverage data. Readers do not need it.
+  Mutex coverage_lock_;
+
+  // Maps the coverage data is bump-allocated from.
+  std::vector<std::unique_ptr<MemMap>> coverage_maps_ GUARDED_BY(coverage_lock_);
+  uint8_t* coverage_top_ GUARDED_BY(coverage_lock_);
+  uint8_t* coverage_end_ GUARDED_BY(coverage_lock_);
+  // Set when mapping more coverage storage failed. Methods and dex files without coverage
+  // data then stay without it, instead of retrying the allocation on every instruction.
+  Atomic<bool> coverage_exhausted_;
+
+  // Dex files with a coverage table or field coverage.
+  std::vector<const DexFile*> coverage_dex_files_ GUARDED_BY(coverage_lock_);
+
+  // Event buffers of the threads that recorded events.
+  std::vector<std::unique_ptr<MiniTraceThreadData>> thread_data_ GUARDED_BY(coverage_lock_);
+
+  // Lock-free stack of the methods that ran in the interpreter since the last dump.
+  Atomic<CoverageRecord*> dirty_records_;
+
+  // Lock-free stack of the methods with JIT-compiled coverage probes.
+  Atomic<CoverageRecord*> probed_records_;
+
+  ART_FRIEND_TEST(MiniTraceCoverageTest, ExpandCoverageData);
+  ART_FRIEND_TEST(MiniTraceCoverageTest, DumpsOnlyDirtyMethods);
+
   DISALLOW_COPY_AND_ASSIGN(MiniTrace);
 };
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ART_RUNTIME_MINI_TRACE_FORMAT_H_
+#define ART_RUNTIME_MINI_TRACE_FORMAT_H_
+
+#include <stdint.h>
+
+// Binary MiniTrace coverage file. This header is shared with the host tools and must not
+// depend on the rest of the runtime.
+//
+// The file is a MiniTraceFileHeader followed by a ring of kMiniTraceChunkSize chunks. Each
+// chunk starts with a MiniTraceChunkHeader and holds whole records. When the ring is full the
+// chunk with the lowest sequence number is overwritten, so readers sort the chunks by sequence
+// number and may find that the names of some methods have been overwritten.
+//
+// A record is a MiniTraceRecordHeader followed by its payload and padding to a multiple of
+// kMiniTraceRecordAlignment. All values are little-endian, strings are NUL-terminated.
+//
+//   Start, Dump:    uint64_t time in milliseconds, uint64_t epoch the coverage up to the next
+//                   Dump record was recorded in (missing in files of older runtimes).
+//   DexFile:        uint32_t checksum, location.
+//   Method:         uint32_t checksum, uint32_t method_idx, class descriptor, name,
+//                   signature, source file.
+//   Coverage:       uint32_t checksum, uint32_t method_idx, uint32_t number of code units,
+//                   one bit per code unit (LSB first) set if the instruction there executed.
+//   Events:         uint32_t thread id, uint32_t number of events of the thread dropped since
+//                   its previous Events record, MiniTraceEventRecords in the order the thread
+//                   recorded them.
+//   CallEdge:       uint32_t caller checksum, uint32_t caller method_idx, uint32_t dex pc of
+//                   the call, uint32_t callee checksum, uint32_t callee method_idx. Written
+//                   once per trace for each distinct virtual or interface call.
+//   FieldCoverage:  uint32_t checksum, uint32_t field_idx, uint8_t flags (kMiniTraceFieldRead,
+//                   kMiniTraceFieldWritten) of the accesses since the previous dump, class
+//                   descriptor, name, type descriptor.
+//
+// Methods are identified by the location checksum of their dex file and their method index.
+// The DexFile and Method records of a method precede the first record referring to it and
+// are written again once their chunk has been overwritten.
+
+namespace art {
+
+static constexpr uint32_t kMiniTraceMagic = 0x5643544d;  // "MTCV"
+static constexpr uint16_t kMiniTraceVersion = 1;
+
+static constexpr uint32_t kMiniTraceChunkSize = 64 * 1024;
+static constexpr uint32_t kMiniTraceRecordAlignment = 8;
+
+enum MiniTraceRecordType : uint16_t {
+  kMiniTraceRecordStart = 1,
+  kMiniTraceRecordDump = 2,
+  kMiniTraceRecordDexFile = 3,
+  kMiniTraceRecordMethod = 4,
+  kMiniTraceRecordCoverage = 5,
+  kMiniTraceRecordEvents = 6,
+  kMiniTraceRecordCallEdge = 7,
+  kMiniTraceRecordFieldCoverage = 8,
+};
+
+// Flags of FieldCoverage records.
+static constexpr uint8_t kMiniTraceFieldRead = 1;
+static constexpr uint8_t kMiniTraceFieldWritten = 2;
+
+enum MiniTraceEventType : uint8_t {
+  kMiniTraceEventMethodEntered = 0,
+  kMiniTraceEventMethodExited = 1,
+  kMiniTraceEventMethodUnwind = 2,
+  kMiniTraceEventExceptionThrown = 3,
+  kMiniTraceEventExceptionHandled = 4,
+  kMiniTraceEventInvokeVirtualOrInterface = 5,
+  kMiniTraceEventFieldRead = 6,
+  kMiniTraceEventFieldWritten = 7,
+};
+
+struct MiniTraceFileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;     // sizeof(MiniTraceFileHeader), the first chunk follows.
+  uint32_t pid;
+  uint32_t chunk_size;
+  uint32_t num_chunks;
+  uint32_t reserved;
+  uint64_t next_sequence;   // Sequence number of the next chunk to be started.
+};
+
+struct MiniTraceChunkHeader {
+  uint64_t sequence;        // 0 for chunks that have not been written yet.
+  uint32_t used;            // Bytes of records in the chunk, including this header.
+  uint32_t reserved;
+};
+
+struct MiniTraceRecordHeader {
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t size;            // Size of the record including this header and the padding.
+};
+
+struct MiniTraceEventRecord {
+  // CPU timestamp counter (x86 TSC, arm64 virtual counter), nanoseconds on other ISAs.
+  uint64_t timestamp;
+  // Method the event happened in: the caller for invokes, the method throwing or catching
+  // for exceptions.
+  uint32_t checksum;
+  uint16_t method_idx;
+  uint8_t type;             // MiniTraceEventType.
+  uint8_t reserved;
+};
+
+}  // namespace art
+
+#endif  // ART_RUNTIME_MINI_TRACE_FORMAT_H_
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mini_trace.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "art_method-inl.h"
+#include "class_linker.h"
+#include "common_runtime_test.h"
+#include "dex/code_item_accessors-inl.h"
+#include "handle_scope-inl.h"
+#include "mirror/class-inl.h"
+#include "mirror/class_loader.h"
+#include "scoped_thread_state_change-inl.h"
+
+namespace art {
+
+static bool IsTraceable(const MiniTraceOptions& options,
+                        const char* descriptor,
+                        const char* dex_location = "/data/app/com.example-1/base.apk") {
+  return MiniTrace::IsClassTraceable(options, descriptor, dex_location);
+}
+
+TEST(MiniTraceTest, ParseOptions) {
+  MiniTraceOptions options;
+  std::string error_msg;
+  ASSERT_TRUE(MiniTrace::ParseOptions("# comment\n"
+                                      "\n"
+                                      "output_format = binary  # trailing comment\n"
+                                      "ring_size_mb=2\n"
+                                      "flush_interval_ms=500\n"
+                                      "flush_new_coverage=1000\n"
+                                      "events=method, invoke\n"
+                                      "event_buffer_kb=16\n"
+                                      "edge_map=/dev/shm/fuzz_edges\n"
+                                      "edge_map_size_kb=256\n"
+                                      "call_graph=true\n"
+                                      "field_coverage=true\n"
+                                      "unknown_key=1\n",
+                                      &options,
+                                      &error_msg)) << error_msg;
+  EXPECT_TRUE(options.binary_output);
+  EXPECT_EQ(2 * MB, options.ring_size);
+  EXPECT_EQ(500u, options.flush_interval_ms);
+  EXPECT_EQ(1000u, options.flush_new_coverage);
+  EXPECT_EQ(MiniTraceOptions::kMethodEvents | MiniTraceOptions::kInvokeEvents, options.events);
+  EXPECT_EQ(16 * KB, options.event_buffer_size);
+  EXPECT_EQ("/dev/shm/fuzz_edges", options.edge_map);
+  EXPECT_EQ(256 * KB, options.edge_map_size);
+  EXPECT_TRUE(options.call_graph);
+  EXPECT_TRUE(options.field_coverage);
+}
+
+TEST(MiniTraceTest, ParseOptionsDefaults) {
+  // Configs used to only have to exist.
+  MiniTraceOptions options;
+  std::string error_msg;
+  ASSERT_TRUE(MiniTrace::ParseOptions("anything\n", &options, &error_msg)) << error_msg;
+  EXPECT_FALSE(options.binary_output);
+  EXPECT_EQ(0u, options.flush_interval_ms);
+  EXPECT_EQ(0u, options.flush_new_coverage);
+  EXPECT_EQ(0u, options.events);
+  EXPECT_TRUE(options.edge_map.empty());
+  EXPECT_FALSE(options.call_graph);
+  EXPECT_FALSE(options.field_coverage);
+  EXPECT_FALSE(IsTraceable(options, "Ljava/lang/Object;", "/system/framework/core-oj.jar"));
+  EXPECT_TRUE(IsTraceable(options, "Lcom/example/Main;"));
+}
+
+TEST(MiniTraceTest, ParseOptionsErrors) {
+  std::string error_msg;
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("output_format=xml\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("ring_size_mb=0\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("flush_interval_ms=-1\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("include_class=\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("events=method,branch\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("event_buffer_kb=0\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("edge_map_size_kb=48\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("call_graph=yes\n", &options, &error_msg));
+  }
+  {
+    MiniTraceOptions options;
+    EXPECT_FALSE(MiniTrace::ParseOptions("field_coverage=1\n", &options, &error_msg));
+  }
+}
+
+TEST(MiniTraceTest, HashEdge) {
+  // Edges are directed and belong to their method.
+  uint32_t forward = MiniTrace::HashEdge(0x12345678u, 42u, 4u, 10u);
+  EXPECT_EQ(forward, MiniTrace::HashEdge(0x12345678u, 42u, 4u, 10u));
+  EXPECT_NE(forward, MiniTrace::HashEdge(0x12345678u, 42u, 10u, 4u));
+  EXPECT_NE(forward, MiniTrace::HashEdge(0x12345678u, 43u, 4u, 10u));
+  EXPECT_NE(forward, MiniTrace::HashEdge(0x87654321u, 42u, 4u, 10u));
+  // Neighbouring edges spread over a small map.
+  constexpr uint32_t kMask = 64 * KB - 1u;
+  EXPECT_NE(forward & kMask, MiniTrace::HashEdge(0x12345678u, 42u, 4u, 12u) & kMask);
+  EXPECT_NE(forward & kMask, MiniTrace::HashEdge(0x12345678u, 42u, 6u, 10u) & kMask);
+}
+
+TEST(MiniTraceTest, DexRules) {
+  MiniTraceOptions options;
+  std::string error_msg;
+  ASSERT_TRUE(MiniTrace::ParseOptions("include_dex=/system/framework/framework.jar\n"
+                                      "include_dex=/data/app/\n"
+                                      "exclude_dex=/data/app/com.other\n",
+                                      &options,
+                                      &error_msg)) << error_msg;
+  EXPECT_TRUE(IsTraceable(options, "Landroid/app/Activity;", "/system/framework/framework.jar"));
+  EXPECT_FALSE(IsTraceable(options, "Ljava/lang/Object;", "/system/framework/core-oj.jar"));
+  EXPECT_TRUE(IsTraceable(options, "Lcom/example/Main;"));
+  EXPECT_FALSE(IsTraceable(options, "Lcom/other/Main;", "/data/app/com.other-1/base.apk"));
+  // Dex rules do not depend on the class.
+  EXPECT_TRUE(MiniTrace::IsDexFileTraceable(options, "/data/app/com.example-1/base.apk"));
+  EXPECT_FALSE(MiniTrace::IsDexFileTraceable(options, "/data/app/com.other-1/base.apk"));
+  EXPECT_TRUE(MiniTrace::IsClassNameTraceable(options, "Lcom/other/Main;"));
+}
+
+TEST(MiniTraceTest, NameRules) {
+  MiniTraceOptions options;
+  std::string error_msg;
+  ASSERT_TRUE(MiniTrace::ParseOptions("include_package=com.example\n"
+                                      "include_class=org.*.Tested?\n"
+                                      "exclude_package=com.example.generated\n"
+                                      "exclude_class=*$$Lambda*\n",
+                                      &options,
+                                      &error_msg)) << error_msg;
+  EXPECT_TRUE(IsTraceable(options, "Lcom/example/Main;"));
+  EXPECT_TRUE(IsTraceable(options, "Lcom/example/ui/Main$1;"));
+  EXPECT_FALSE(IsTraceable(options, "Lcom/examples/Main;"));
+  EXPECT_FALSE(IsTraceable(options, "Lcom/example/generated/R;"));
+  EXPECT_FALSE(IsTraceable(options, "Lcom/example/Main$$Lambda$0;"));
+  EXPECT_TRUE(IsTraceable(options, "Lorg/foo/bar/Tested1;"));
+  EXPECT_FALSE(IsTraceable(options, "Lorg/foo/Tested;"));
+  EXPECT_FALSE(IsTraceable(options, "Lorg/foo/Tested12;"));
+  // The default dex rule still applies.
+  EXPECT_FALSE(IsTraceable(options, "Lcom/example/Main;", "/system/framework/example.jar"));
+}
+
+TEST(MiniTraceTest, RecordExecution) {
+  // One bit per code unit.
+  EXPECT_EQ(0u, MiniTrace::GetExecutedBitmapSize(0u));
+  EXPECT_EQ(1u, MiniTrace::GetExecutedBitmapSize(8u));
+  EXPECT_EQ(2u, MiniTrace::GetExecutedBitmapSize(9u));
+
+  // Without a trace nothing is queued for the next dump.
+  uint8_t data[3] = {};
+  MiniTrace::RecordExecution(data, 0u);
+  MiniTrace::RecordExecution(data, 7u);
+  MiniTrace::RecordExecution(data, 8u);
+  MiniTrace::RecordExecution(data, 8u);
+  MiniTrace::RecordExecution(data, 17u);
+  EXPECT_EQ(0x81u, data[0]);
+  EXPECT_EQ(0x01u, data[1]);
+  EXPECT_EQ(0x02u, data[2]);
+}
+
+class MiniTraceCoverageTest : public CommonRuntimeTest {};
+
+TEST_F(MiniTraceCoverageTest, ExpandCoverageData) {
+  ScopedObjectAccess soa(Thread::Current());
+  jobject jclass_loader = LoadDex("ExceptionHandle");
+  StackHandleScope<1> hs(soa.Self());
+  Handle<mirror::ClassLoader> class_loader(
+      hs.NewHandle(soa.Decode<mirror::ClassLoader>(jclass_loader)));
+  mirror::Class* klass = class_linker_->FindClass(soa.Self(), "LExceptionHandle;", class_loader);
+  ASSERT_TRUE(klass != nullptr);
+  ArtMethod* method = klass->FindClassMethod("g", "(I)V", kRuntimePointerSize);
+  ASSERT_TRUE(method != nullptr);
+  CodeItemDataAccessor accessor(method->DexInstructionData());
+  const uint32_t insns_size = accessor.InsnsSizeInCodeUnits();
+  const std::vector<uint32_t> blocks = MiniTrace::FindCoverageBlocks(accessor);
+  // g() branches on its argument and throws on two of the paths.
+  ASSERT_GE(blocks.size(), 3u);
+  EXPECT_EQ(0u, blocks[0]);
+
+  // The bitmap of the instructions the interpreter executed comes first, then one flag per
+  // block compiled code entered.
+  const size_t bitmap_size = MiniTrace::GetExecutedBitmapSize(insns_size);
+  std::vector<uint8_t> data(bitmap_size + blocks.size(), 0u);
+  MiniTrace::RecordExecution(data.data(), 0u);
+  data[bitmap_size + 1u] = 1u;
+  std::vector<bool> covered;
+  MiniTrace::ExpandCoverageData(method, data.data(), &covered);
+
+  ASSERT_EQ(insns_size, covered.size());
+  for (const DexInstructionPcPair& pair : accessor) {
+    const uint32_t dex_pc = pair.DexPc();
+    const bool expected = (dex_pc == 0u) || (dex_pc >= blocks[1] && dex_pc < blocks[2]);
+    EXPECT_EQ(expected, covered[dex_pc]) << dex_pc;
+  }
+}
+
+TEST_F(MiniTraceCoverageTest, DumpsOnlyDirtyMethods) {
+  using CoverageRecord = MiniTrace::CoverageRecord;
+  using CoverageSnapshot = MiniTrace::CoverageSnapshot;
+
+  // Two records laid out like InstallCoverageData does, with a word of coverage data each.
+  constexpr size_t kRecordWords = sizeof(CoverageRecord) / sizeof(uint64_t) + 1u;
+  std::vector<uint64_t> storage(2u * kRecordWords, 0u);
+  CoverageRecord* record_a = reinterpret_cast<CoverageRecord*>(&storage[0]);
+  CoverageRecord* record_b = reinterpret_cast<CoverageRecord*>(&storage[kRecordWords]);
+  record_a->size = sizeof(uint64_t);
+  record_b->size = sizeof(uint64_t);
+  uint8_t* data_a = reinterpret_cast<uint8_t*>(record_a + 1);
+  uint8_t* data_b = reinterpret_cast<uint8_t*>(record_b + 1);
+
+  auto coverage_of = [](const CoverageSnapshot& snapshot, CoverageRecord* record) {
+    for (const std::pair<CoverageRecord*, size_t>& entry : snapshot.records) {
+      if (entry.first == record) {
+        return static_cast<int>(snapshot.data[entry.second]);
+      }
+    }
+    return -1;
+  };
+
+  Thread* self = Thread::Current();
+  MiniTrace* trace = new MiniTrace(MiniTraceOptions(), nullptr, nullptr, nullptr);
+  MiniTrace::the_trace_ = trace;
+  std::unique_ptr<CoverageSnapshot> first;
+  std::unique_ptr<CoverageSnapshot> second;
+  std::unique_ptr<CoverageSnapshot> third;
+  MiniTrace::RecordExecution(data_a, 1u);
+  MiniTrace::RecordExecution(data_b, 2u);
+  {
+    ScopedObjectAccess soa(self);
+    MutexLock mu(self, trace->dump_lock_);
+    first = trace->CreateSnapshot(/* start */ false);
+  }
+  // Only the second method runs again. The first dump cleared what it took, so both of the
+  // instructions are in the second dump.
+  MiniTrace::RecordExecution(data_b, 2u);
+  MiniTrace::RecordExecution(data_b, 3u);
+  {
+    ScopedObjectAccess soa(self);
+    MutexLock mu(self, trace->dump_lock_);
+    second = trace->CreateSnapshot(/* start */ false);
+    third = trace->CreateSnapshot(/* start */ false);
+  }
+  MiniTrace::the_trace_ = nullptr;
+  delete trace;
+
+  EXPECT_EQ(2u, first->records.size());
+  EXPECT_EQ(1 << 1, coverage_of(*first, record_a));
+  EXPECT_EQ(1 << 2, coverage_of(*first, record_b));
+  EXPECT_EQ(1u, second->records.size());
+  EXPECT_EQ(-1, coverage_of(*second, record_a));
+  EXPECT_EQ(1 << 2 | 1 << 3, coverage_of(*second, record_b));
+  EXPECT_TRUE(third->records.empty());
+}
+
+}  // namespace art
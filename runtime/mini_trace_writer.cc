@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mini_trace_writer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "android-base/stringprintf.h"
+
+#include "base/bit_utils.h"
+#include "base/logging.h"
+#include "base/os.h"
+#include "base/unix_file/fd_file.h"
+#include "mem_map.h"
+
+namespace art {
+
+using android::base::StringPrintf;
+
+static uint64_t MethodKey(uint32_t checksum, uint32_t method_idx) {
+  return (static_cast<uint64_t>(checksum) << 32) | method_idx;
+}
+
+std::unique_ptr<MiniTraceRingWriter> MiniTraceRingWriter::Create(const std::string& filename,
+                                                                 size_t ring_size,
+                                                                 std::string* error_msg) {
+  uint32_t num_chunks = std::max<size_t>(ring_size / kMiniTraceChunkSize, 1u);
+  size_t file_size = sizeof(MiniTraceFileHeader) + num_chunks * kMiniTraceChunkSize;
+
+  std::unique_ptr<File> file(OS::CreateEmptyFile(filename.c_str()));
+  if (file == nullptr) {
+    *error_msg = StringPrintf("Failed to create %s: %s", filename.c_str(), strerror(errno));
+    return nullptr;
+  }
+  int result = file->SetLength(file_size);
+  if (result != 0) {
+    *error_msg = StringPrintf("Failed to resize %s: %s", filename.c_str(), strerror(-result));
+    file->Erase(/* unlink */ true);
+    return nullptr;
+  }
+  std::unique_ptr<MemMap> map(MemMap::MapFile(file_size,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_SHARED,
+                                              file->Fd(),
+                                              /* start */ 0,
+                                              /* low_4gb */ false,
+                                              filename.c_str(),
+                                              error_msg));
+  if (map == nullptr) {
+    file->Erase(/* unlink */ true);
+    return nullptr;
+  }
+  // The mapping stays valid after the file is closed.
+  if (file->FlushClose() != 0) {
+    PLOG(WARNING) << "Failed to close " << filename;
+  }
+
+  MiniTraceFileHeader* header = reinterpret_cast<MiniTraceFileHeader*>(map->Begin());
+  header->magic = kMiniTraceMagic;
+  header->version = kMiniTraceVersion;
+  header->header_size = sizeof(MiniTraceFileHeader);
+  header->pid = getpid();
+  header->chunk_size = kMiniTraceChunkSize;
+  header->num_chunks = num_chunks;
+  header->next_sequence = 1u;
+  return std::unique_ptr<MiniTraceRingWriter>(new MiniTraceRingWriter(std::move(map), num_chunks));
+}
+
+MiniTraceRingWriter::MiniTraceRingWriter(std::unique_ptr<MemMap> map, uint32_t num_chunks)
+    : map_(std::move(map)),
+      num_chunks_(num_chunks),
+      next_sequence_(1u),
+      current_chunk_(nullptr),
+      bytes_written_(0u) {}
+
+MiniTraceRingWriter::~MiniTraceRingWriter() {}
+
+MiniTraceFileHeader* MiniTraceRingWriter::GetHeader() const {
+  return reinterpret_cast<MiniTraceFileHeader*>(map_->Begin());
+}
+
+MiniTraceChunkHeader* MiniTraceRingWriter::GetChunk(uint64_t sequence) const {
+  DCHECK_NE(sequence, 0u);
+  uint8_t* chunks = map_->Begin() + sizeof(MiniTraceFileHeader);
+  return reinterpret_cast<MiniTraceChunkHeader*>(
+      chunks + ((sequence - 1u) % num_chunks_) * kMiniTraceChunkSize);
+}
+
+void MiniTraceRingWriter::StartNextChunk() {
+  uint64_t sequence = next_sequence_++;
+  MiniTraceChunkHeader* chunk = GetChunk(sequence);
+  // Readers ignore the chunk until it has its new sequence number.
+  chunk->sequence = 0u;
+  chunk->used = sizeof(MiniTraceChunkHeader);
+  chunk->sequence = sequence;
+  GetHeader()->next_sequence = next_sequence_;
+  current_chunk_ = chunk;
+}
+
+uint8_t* MiniTraceRingWriter::AllocateRecord(MiniTraceRecordType type, size_t payload_size) {
+  size_t size = RoundUp(sizeof(MiniTraceRecordHeader) + payload_size, kMiniTraceRecordAlignment);
+  if (size > kMiniTraceChunkSize - sizeof(MiniTraceChunkHeader)) {
+    LOG(WARNING) << "MiniTrace: Dropping record of " << size << " bytes";
+    return nullptr;
+  }
+  if (current_chunk_ == nullptr || current_chunk_->used + size > kMiniTraceChunkSize) {
+    StartNextChunk();
+  }
+  uint8_t* record = reinterpret_cast<uint8_t*>(current_chunk_) + current_chunk_->used;
+  memset(record, 0, size);
+  MiniTraceRecordHeader* header = reinterpret_cast<MiniTraceRecordHeader*>(record);
+  header->type = type;
+  header->size = size;
+  // The record is only visible to readers once `used` covers it, which the caller does after
+  // filling in the payload (see CommitRecord).
+  return record + sizeof(MiniTraceRecordHeader);
+}
+
+void MiniTraceRingWriter::CommitRecord(uint8_t* payload) {
+  MiniTraceRecordHeader* header =
+      reinterpret_cast<MiniTraceRecordHeader*>(payload - sizeof(MiniTraceRecordHeader));
+  current_chunk_->used += header->size;
+  bytes_written_ += header->size;
+}
+
+void MiniTraceRingWriter::Sync() {
+  if (msync(map_->Begin(), map_->Size(), MS_SYNC) != 0) {
+    PLOG(WARNING) << "MiniTrace: Failed to sync " << map_->GetName();
+  }
+}
+
+void MiniTraceRingWriter::WriteTimestamp(MiniTraceRecordType type,
+                                         uint64_t time_ms,
+                                         uint64_t epoch) {
+  DCHECK(type == kMiniTraceRecordStart || type == kMiniTraceRecordDump);
+  uint8_t* payload = AllocateRecord(type, 2 * sizeof(uint64_t));
+  if (payload != nullptr) {
+    memcpy(payload, &time_ms, sizeof(time_ms));
+    memcpy(payload + sizeof(time_ms), &epoch, sizeof(epoch));
+    CommitRecord(payload);
+  }
+}
+
+void MiniTraceRingWriter::MaybeWriteDexFile(uint32_t checksum, const char* location) {
+  auto it = dex_file_chunks_.find(checksum);
+  if (it != dex_file_chunks_.end() && IsLive(it->second)) {
+    return;
+  }
+  size_t location_size = strlen(location) + 1u;
+  uint8_t* payload = AllocateRecord(kMiniTraceRecordDexFile, sizeof(checksum) + location_size);
+  if (payload != nullptr) {
+    memcpy(payload, &checksum, sizeof(checksum));
+    memcpy(payload + sizeof(checksum), location, location_size);
+    CommitRecord(payload);
+    dex_file_chunks_[checksum] = current_chunk_->sequence;
+  }
+}
+
+bool MiniTraceRingWriter::NeedsMethodNames(uint32_t checksum, uint32_t method_idx) const {
+  auto it = method_chunks_.find(MethodKey(checksum, method_idx));
+  return it == method_chunks_.end() || !IsLive(it->second);
+}
+
+void MiniTraceRingWriter::WriteMethodNames(uint32_t checksum,
+                                           uint32_t method_idx,
+                                           const char* class_descriptor,
+                                           const char* name,
+                                           const char* signature,
+                                           const char* source_file) {
+  const char* strings[] = { class_descriptor, name, signature, source_file };
+  size_t payload_size = sizeof(checksum) + sizeof(method_idx);
+  for (const char* string : strings) {
+    payload_size += strlen(string) + 1u;
+  }
+  uint8_t* payload = AllocateRecord(kMiniTraceRecordMethod, payload_size);
+  if (payload == nullptr) {
+    return;
+  }
+  uint8_t* out = payload;
+  memcpy(out, &checksum, sizeof(checksum));
+  out += sizeof(checksum);
+  memcpy(out, &method_idx, sizeof(method_idx));
+  out += sizeof(method_idx);
+  for (const char* string : strings) {
+    size_t size = strlen(string) + 1u;
+    memcpy(out, string, size);
+    out += size;
+  }
+  CommitRecord(payload);
+  method_chunks_[MethodKey(checksum, method_idx)] = current_chunk_->sequence;
+}
+
+void MiniTraceRingWriter::WriteCoverage(uint32_t checksum,
+                                        uint32_t method_idx,
+                                        const std::vector<bool>& covered) {
+  uint32_t insns_size = covered.size();
+  size_t bitmap_size = RoundUp(insns_size, kBitsPerByte) / kBitsPerByte;
+  uint8_t* payload = AllocateRecord(kMiniTraceRecordCoverage, 3 * sizeof(uint32_t) + bitmap_size);
+  if (payload == nullptr) {
+    return;
+  }
+  memcpy(payload, &checksum, sizeof(checksum));
+  memcpy(payload + sizeof(uint32_t), &method_idx, sizeof(method_idx));
+  memcpy(payload + 2 * sizeof(uint32_t), &insns_size, sizeof(insns_size));
+  uint8_t* bitmap = payload + 3 * sizeof(uint32_t);
+  for (uint32_t i = 0; i != insns_size; ++i) {
+    if (covered[i]) {
+      bitmap[i / kBitsPerByte] |= 1u << (i % kBitsPerByte);
+    }
+  }
+  CommitRecord(payload);
+}
+
+void MiniTraceRingWriter::WriteFieldCoverage(uint32_t checksum,
+                                             uint32_t field_idx,
+                                             uint8_t flags,
+                                             const char* class_descriptor,
+                                             const char* name,
+                                             const char* type_descriptor) {
+  const char* strings[] = { class_descriptor, name, type_descriptor };
+  size_t payload_size = sizeof(checksum) + sizeof(field_idx) + sizeof(flags);
+  for (const char* string : strings) {
+    payload_size += strlen(string) + 1u;
+  }
+  uint8_t* payload = AllocateRecord(kMiniTraceRecordFieldCoverage, payload_size);
+  if (payload == nullptr) {
+    return;
+  }
+  uint8_t* out = payload;
+  memcpy(out, &checksum, sizeof(checksum));
+  out += sizeof(checksum);
+  memcpy(out, &field_idx, sizeof(field_idx));
+  out += sizeof(field_idx);
+  *out++ = flags;
+  for (const char* string : strings) {
+    size_t size = strlen(string) + 1u;
+    memcpy(out, string, size);
+    out += size;
+  }
+  CommitRecord(payload);
+}
+
+void MiniTraceRingWriter::WriteCallEdge(uint32_t caller_checksum,
+                                        uint32_t caller_method_idx,
+                                        uint32_t dex_pc,
+                                        uint32_t callee_checksum,
+                                        uint32_t callee_method_idx) {
+  const uint32_t values[] = {
+      caller_checksum, caller_method_idx, dex_pc, callee_checksum, callee_method_idx };
+  uint8_t* payload = AllocateRecord(kMiniTraceRecordCallEdge, sizeof(values));
+  if (payload != nullptr) {
+    memcpy(payload, values, sizeof(values));
+    CommitRecord(payload);
+  }
+}
+
+void MiniTraceRingWriter::WriteEvents(uint32_t tid,
+                                      uint32_t dropped,
+                                      const std::vector<MiniTraceEventRecord>& events) {
+  static constexpr size_t kMaxEventsPerRecord =
+      (kMiniTraceChunkSize - sizeof(MiniTraceChunkHeader) - sizeof(MiniTraceRecordHeader) -
+       2 * sizeof(uint32_t)) / sizeof(MiniTraceEventRecord);
+  size_t begin = 0u;
+  do {
+    size_t count = std::min(events.size() - begin, kMaxEventsPerRecord);
+    uint8_t* payload = AllocateRecord(kMiniTraceRecordEvents,
+                                      2 * sizeof(uint32_t) + count * sizeof(MiniTraceEventRecord));
+    if (payload == nullptr) {
+      return;
+    }
+    memcpy(payload, &tid, sizeof(tid));
+    memcpy(payload + sizeof(uint32_t), &dropped, sizeof(dropped));
+    if (count != 0u) {
+      memcpy(payload + 2 * sizeof(uint32_t),
+             events.data() + begin,
+             count * sizeof(MiniTraceEventRecord));
+    }
+    CommitRecord(payload);
+    // Only the first record reports the dropped events.
+    dropped = 0u;
+    begin += count;
+  } while (begin != events.size());
+}
+
+}  // namespace art
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ART_RUNTIME_MINI_TRACE_WRITER_H_
+#define ART_RUNTIME_MINI_TRACE_WRITER_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "mini_trace_format.h"
+
+namespace art {
+
+class MemMap;
+
+// Writes MiniTrace records into the memory-mapped ring file described in mini_trace_format.h.
+// The records reach the file through the page cache, so they survive the process being killed.
+// Not thread safe.
+class MiniTraceRingWriter {
+ public:
+  // Creates or truncates `filename` to hold `ring_size` bytes of chunks.
+  static std::unique_ptr<MiniTraceRingWriter> Create(const std::string& filename,
+                                                     size_t ring_size,
+                                                     std::string* error_msg);
+
+  ~MiniTraceRingWriter();
+
+  void WriteTimestamp(MiniTraceRecordType type, uint64_t time_ms, uint64_t epoch);
+
+  // Writes the location of the dex file with `checksum` unless a live chunk has it already.
+  void MaybeWriteDexFile(uint32_t checksum, const char* location);
+
+  // Whether the names of a method have to be written before its coverage.
+  bool NeedsMethodNames(uint32_t checksum, uint32_t method_idx) const;
+
+  void WriteMethodNames(uint32_t checksum,
+                        uint32_t method_idx,
+                        const char* class_descriptor,
+                        const char* name,
+                        const char* signature,
+                        const char* source_file);
+
+  void WriteCoverage(uint32_t checksum, uint32_t method_idx, const std::vector<bool>& covered);
+
+  void WriteFieldCoverage(uint32_t checksum,
+                          uint32_t field_idx,
+                          uint8_t flags,
+                          const char* class_descriptor,
+                          const char* name,
+                          const char* type_descriptor);
+
+  void WriteCallEdge(uint32_t caller_checksum,
+                     uint32_t caller_method_idx,
+                     uint32_t dex_pc,
+                     uint32_t callee_checksum,
+                     uint32_t callee_method_idx);
+
+  // Writes the events of thread `tid`, split over as many records as the chunks need.
+  void WriteEvents(uint32_t tid, uint32_t dropped, const std::vector<MiniTraceEventRecord>& events);
+
+  // Writes the records back to the file and waits for the disk.
+  void Sync();
+
+  // Bytes written since the writer was created.
+  uint64_t GetBytesWritten() const {
+    return bytes_written_;
+  }
+
+ private:
+  MiniTraceRingWriter(std::unique_ptr<MemMap> map, uint32_t num_chunks);
+
+  // Returns space for a record of `payload_size` bytes of type `type`, or null if the record
+  // cannot fit in a chunk.
+  uint8_t* AllocateRecord(MiniTraceRecordType type, size_t payload_size);
+
+  // Makes the record whose payload was returned by AllocateRecord visible to readers.
+  void CommitRecord(uint8_t* payload);
+
+  void StartNextChunk();
+
+  // Whether the chunk with `sequence` has not been overwritten yet.
+  bool IsLive(uint64_t sequence) const {
+    return sequence != 0u && sequence + num_chunks_ > next_sequence_;
+  }
+
+  MiniTraceFileHeader* GetHeader() const;
+  MiniTraceChunkHeader* GetChunk(uint64_t sequence) const;
+
+  std::unique_ptr<MemMap> map_;
+  const uint32_t num_chunks_;
+  uint64_t next_sequence_;
+  MiniTraceChunkHeader* current_chunk_;
+  uint64_t bytes_written_;
+
+  // Sequence number of the chunks holding the dex file and method name records.
+  std::unordered_map<uint32_t, uint64_t> dex_file_chunks_;
+  std::unordered_map<uint64_t, uint64_t> method_chunks_;
+
+  ART_FRIEND_TEST(MiniTraceRingWriterTest, Wraparound);
+
+  DISALLOW_COPY_AND_ASSIGN(MiniTraceRingWriter);
+};
+
+}  // namespace art
+
+#endif  // ART_RUNTIME_MINI_TRACE_WRITER_H_
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mini_trace_writer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/bit_utils.h"
+#include "base/os.h"
+#include "base/unix_file/fd_file.h"
+#include "common_runtime_test.h"
+
+namespace art {
+
+static constexpr uint32_t kChecksum = 0x12345678u;
+static constexpr const char* kLocation = "/data/app/com.example-1/base.apk";
+
+class MiniTraceRingWriterTest : public CommonRuntimeTest {
+ protected:
+  // A decoded record. Only the fields of the record's type are set.
+  struct Record {
+    uint64_t sequence;
+    uint16_t type;
+    uint32_t checksum;
+    uint32_t index;
+    std::string name;
+    std::vector<bool> covered;
+  };
+
+  // Writes the coverage of a method the way MiniTrace does, naming the method first if needed.
+  static void WriteMethod(MiniTraceRingWriter* writer,
+                          uint32_t method_idx,
+                          const std::vector<bool>& covered) {
+    writer->MaybeWriteDexFile(kChecksum, kLocation);
+    if (writer->NeedsMethodNames(kChecksum, method_idx)) {
+      writer->WriteMethodNames(kChecksum, method_idx, "LMain;", "run", "()V", "Main.java");
+    }
+    writer->WriteCoverage(kChecksum, method_idx, covered);
+  }
+
+  // Reads the records of the live chunks of `filename`, oldest chunk first.
+  static std::vector<Record> Decode(const std::string& filename) {
+    std::unique_ptr<File> file(OS::OpenFileForReading(filename.c_str()));
+    CHECK(file != nullptr);
+    std::vector<uint8_t> data(static_cast<size_t>(file->GetLength()));
+    CHECK(file->ReadFully(data.data(), data.size()));
+    MiniTraceFileHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    EXPECT_EQ(kMiniTraceMagic, header.magic);
+    EXPECT_EQ(kMiniTraceChunkSize, header.chunk_size);
+
+    std::vector<std::pair<uint64_t, const uint8_t*>> chunks;
+    for (uint32_t i = 0; i != header.num_chunks; ++i) {
+      const uint8_t* chunk = data.data() + header.header_size + i * header.chunk_size;
+      MiniTraceChunkHeader chunk_header;
+      memcpy(&chunk_header, chunk, sizeof(chunk_header));
+      if (chunk_header.sequence != 0u) {
+        chunks.emplace_back(chunk_header.sequence, chunk);
+      }
+    }
+    std::sort(chunks.begin(), chunks.end());
+
+    std::vector<Record> records;
+    for (const std::pair<uint64_t, const uint8_t*>& chunk : chunks) {
+      MiniTraceChunkHeader chunk_header;
+      memcpy(&chunk_header, chunk.second, sizeof(chunk_header));
+      for (size_t offset = sizeof(chunk_header); offset < chunk_header.used;) {
+        MiniTraceRecordHeader record_header;
+        memcpy(&record_header, chunk.second + offset, sizeof(record_header));
+        const uint8_t* payload = chunk.second + offset + sizeof(record_header);
+        Record record = { chunk.first, record_header.type, 0u, 0u, "", {} };
+        switch (record_header.type) {
+          case kMiniTraceRecordDexFile:
+            memcpy(&record.checksum, payload, sizeof(uint32_t));
+            record.name = reinterpret_cast<const char*>(payload + sizeof(uint32_t));
+            break;
+          case kMiniTraceRecordMethod:
+            memcpy(&record.checksum, payload, sizeof(uint32_t));
+            memcpy(&record.index, payload + sizeof(uint32_t), sizeof(uint32_t));
+            record.name = reinterpret_cast<const char*>(payload + 2 * sizeof(uint32_t));
+            break;
+          case kMiniTraceRecordCoverage: {
+            uint32_t insns_size;
+            memcpy(&record.checksum, payload, sizeof(uint32_t));
+            memcpy(&record.index, payload + sizeof(uint32_t), sizeof(uint32_t));
+            memcpy(&insns_size, payload + 2 * sizeof(uint32_t), sizeof(uint32_t));
+            const uint8_t* bitmap = payload + 3 * sizeof(uint32_t);
+            for (uint32_t i = 0; i != insns_size; ++i) {
+              uint8_t bit = 1u << (i % kBitsPerByte);
+              record.covered.push_back((bitmap[i / kBitsPerByte] & bit) != 0u);
+            }
+            break;
+          }
+          default:
+            break;
+        }
+        records.push_back(std::move(record));
+        EXPECT_NE(0u, record_header.size);
+        EXPECT_ALIGNED(record_header.size, kMiniTraceRecordAlignment);
+        offset += record_header.size;
+      }
+    }
+    return records;
+  }
+};
+
+TEST_F(MiniTraceRingWriterTest, Wraparound) {
+  ScratchFile file;
+  std::string error_msg;
+  std::unique_ptr<MiniTraceRingWriter> writer =
+      MiniTraceRingWriter::Create(file.GetFilename(), 2 * kMiniTraceChunkSize, &error_msg);
+  ASSERT_TRUE(writer != nullptr) << error_msg;
+
+  writer->WriteTimestamp(kMiniTraceRecordStart, /* time_ms */ 1000u, /* epoch */ 0u);
+  const std::vector<bool> covered = { true, false, true };
+  WriteMethod(writer.get(), 7u, covered);
+  EXPECT_FALSE(writer->NeedsMethodNames(kChecksum, 7u));
+
+  // Three of these fill a chunk.
+  const std::vector<bool> large(16 * KB * kBitsPerByte, true);
+  for (size_t i = 0; i != 3u; ++i) {
+    writer->WriteCoverage(kChecksum, 8u, large);
+  }
+  EXPECT_TRUE(writer->IsLive(1u));
+  EXPECT_FALSE(writer->NeedsMethodNames(kChecksum, 7u));
+
+  // The fourth starts the second chunk. The first chunk is the next one to be overwritten, so
+  // its names no longer count.
+  writer->WriteCoverage(kChecksum, 8u, large);
+  EXPECT_FALSE(writer->IsLive(1u));
+  EXPECT_TRUE(writer->IsLive(2u));
+  EXPECT_TRUE(writer->NeedsMethodNames(kChecksum, 7u));
+
+  // The seventh starts the third chunk, which overwrites the first one.
+  for (size_t i = 0; i != 3u; ++i) {
+    writer->WriteCoverage(kChecksum, 8u, large);
+  }
+  EXPECT_FALSE(writer->IsLive(0u));
+  EXPECT_TRUE(writer->IsLive(3u));
+
+  // The names are written again before the next coverage of method 7.
+  WriteMethod(writer.get(), 7u, covered);
+  EXPECT_FALSE(writer->NeedsMethodNames(kChecksum, 7u));
+  writer->Sync();
+
+  std::vector<Record> records = Decode(file.GetFilename());
+  std::vector<uint16_t> types;
+  for (const Record& record : records) {
+    types.push_back(record.type);
+  }
+  EXPECT_EQ((std::vector<uint16_t> { kMiniTraceRecordCoverage,
+                                      kMiniTraceRecordCoverage,
+                                      kMiniTraceRecordCoverage,
+                                      kMiniTraceRecordCoverage,
+                                      kMiniTraceRecordDexFile,
+                                      kMiniTraceRecordMethod,
+                                      kMiniTraceRecordCoverage }),
+            types);
+  ASSERT_EQ(7u, records.size());
+  EXPECT_EQ(2u, records[0].sequence);
+  EXPECT_EQ(3u, records[3].sequence);
+  EXPECT_EQ(3u, records[6].sequence);
+  EXPECT_EQ(large, records[0].covered);
+  EXPECT_EQ(kChecksum, records[4].checksum);
+  EXPECT_STREQ(kLocation, records[4].name.c_str());
+  EXPECT_EQ(kChecksum, records[5].checksum);
+  EXPECT_EQ(7u, records[5].index);
+  EXPECT_EQ("LMain;", records[5].name);
+  EXPECT_EQ(7u, records[6].index);
+  EXPECT_EQ(covered, records[6].covered);
+}
+
+}  // namespace art
@@ -37,6 +37,7 @@
 #include "hprof/hprof.h"
 #include "java_vm_ext.h"
 #include "jni_internal.h"
+#include "mini_trace.h"
 #include "mirror/class.h"
 #include "mirror/object_array-inl.h"
 #include "native_util.h"
@@ -135,6 +136,73 @@ static void VMDebug_startMethodTracingFilename(JNIEnv* env, jclass, jstring java
                intervalUs);
 }
 
+/*
+ * static boolean startMiniTrace(String config)
+ *
+ * Starts MiniTrace with the options in `config`, in the format of the MiniTrace config file,
+ * or with the config file of the app if `config` is null.
+ */
+static jboolean VMDebug_startMiniTrace(JNIEnv* env, jclass, jstring javaConfig) {
+  if (javaConfig == nullptr) {
+    MiniTrace::Start();
+    return MiniTrace::IsMiniTraceActive() ? JNI_TRUE : JNI_FALSE;
+  }
+
+  MiniTraceOptions options;
+  {
+    ScopedUtfChars config(env, javaConfig);
+    if (config.c_str() == nullptr) {
+      return JNI_FALSE;
+    }
+    std::string error_msg;
+    if (!MiniTrace::ParseOptions(config.c_str(), &options, &error_msg)) {
+      ScopedObjectAccess soa(env);
+      ThrowIllegalArgumentException(error_msg.c_str());
+      return JNI_FALSE;
+    }
+  }
+  return MiniTrace::Start(options) ? JNI_TRUE : JNI_FALSE;
+}
+
+static void VMDebug_stopMiniTrace(JNIEnv*, jclass) {
+  if (MiniTrace::IsMiniTraceActive()) {
+    MiniTrace::Stop();
+  }
+}
+
+static void VMDebug_resetMiniTrace(JNIEnv*, jclass) {
+  MiniTrace::ResetCoverageData();
+}
+
+/*
+ * static long nextMiniTraceEpoch()
+ *
+ * Starts a new MiniTrace epoch and hands the coverage of the previous one to the writer
+ * thread. Returns the new epoch, or -1 if no trace is active.
+ */
+static jlong VMDebug_nextMiniTraceEpoch(JNIEnv*, jclass) {
+  return MiniTrace::NextEpoch();
+}
+
+/*
+ * static void dumpMiniTraceFd(int fd)
+ *
+ * Writes the MiniTrace coverage recorded since the last dump or reset to `fd`. Throws an
+ * IOException if no trace is active or writing fails.
+ */
+static void VMDebug_dumpMiniTraceFd(JNIEnv* env, jclass, jint javaFd) {
+  if (javaFd < 0) {
+    ScopedObjectAccess soa(env);
+    ThrowIllegalArgumentException("Invalid fd");
+    return;
+  }
+  std::string error_msg;
+  if (!MiniTrace::DumpCoverageDataToFd(javaFd, &error_msg)) {
+    ScopedObjectAccess soa(env);
+    ThrowIOException("%s", error_msg.c_str());
+  }
+}
+
 static jint VMDebug_getMethodTracingMode(JNIEnv*, jclass) {
   return Trace::GetMethodTracingMode();
 }
@@ -630,8 +698,31 @@ static JNINativeMethod gMethods[] = {
   NATIVE_METHOD(VMDebug, allowHiddenApiReflectionFrom, "(Ljava/lang/Class;)V"),
 };
 
+// The MiniTrace natives are registered only where dalvik.system.VMDebug declares them, so
+// that the runtime still starts with a libcore that does not.
+static JNINativeMethod gMiniTraceMethods[] = {
+  NATIVE_METHOD(VMDebug, dumpMiniTraceFd, "(I)V"),
+  NATIVE_METHOD(VMDebug, nextMiniTraceEpoch, "()J"),
+  NATIVE_METHOD(VMDebug, resetMiniTrace, "()V"),
+  NATIVE_METHOD(VMDebug, startMiniTrace, "(Ljava/lang/String;)Z"),
+  NATIVE_METHOD(VMDebug, stopMiniTrace, "()V"),
+};
+
+static void RegisterMiniTraceNativeMethods(JNIEnv* env) {
+  ScopedLocalRef<jclass> c(env, env->FindClass("dalvik/system/VMDebug"));
+  CHECK(c.get() != nullptr);
+  for (const JNINativeMethod& method : gMiniTraceMethods) {
+    if (env->GetStaticMethodID(c.get(), method.name, method.signature) == nullptr) {
+      env->ExceptionClear();  // NoSuchMethodError.
+      continue;
+    }
+    CHECK_EQ(JNI_OK, env->RegisterNatives(c.get(), &method, 1));
+  }
+}
+
 void register_dalvik_system_VMDebug(JNIEnv* env) {
   REGISTER_NATIVE_METHODS("dalvik/system/VMDebug");
+  RegisterMiniTraceNativeMethods(env);
 }
 
 }  // namespace art
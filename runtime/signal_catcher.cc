@@ -205,16 +205,15 @@ void SignalCatcher::HandleSigQuit() {
   os << "----- end " << getpid() << " -----\n";
   Output(os.str());
 
-  LOG(INFO) << "SIGQUIT dumping coverage data begin";
-  MiniTrace::DumpCoverageData();
-  LOG(INFO) << "SIGQUIT dumping coverage data end";
+  // The coverage is written in the background so that it does not delay the ANR traces.
+  LOG(INFO) << "SIGQUIT requesting coverage data dump";
+  MiniTrace::RequestCoverageDump();
 }
 
 
 void SignalCatcher::HandleSigUsr2() {
-  LOG(INFO) << "SIGUSR2 dumping coverage data begin";
-  MiniTrace::DumpCoverageData();
-  LOG(INFO) << "SIGUSR2 dumping coverage data end";
+  LOG(INFO) << "SIGUSR2 requesting coverage data dump";
+  MiniTrace::RequestCoverageDump();
 }
 
 void SignalCatcher::HandleSigUsr1() {
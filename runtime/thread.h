@@ -87,6 +87,8 @@ class DexFile;
 class FrameIdToShadowFrame;
 class JavaVMExt;
 class JNIEnvExt;
+struct MiniTraceThreadData;
+struct TraceThreadBuffer;
 class Monitor;
 class RootVisitor;
 class ScopedObjectAccessAlreadyRunnable;
@@ -1054,7 +1056,7 @@ class Thread {
   void RemoveDebuggerShadowFrameMapping(size_t frame_id)
       REQUIRES_SHARED(Locks::mutator_lock_);
 
-  std::deque<instrumentation::InstrumentationStackFrame>* GetInstrumentationStack() {
+  instrumentation::InstrumentationStack* GetInstrumentationStack() {
     return tlsPtr_.instrumentation_stack;
   }
 
@@ -1252,6 +1254,24 @@ class Thread {
     custom_tls_ = data;
   }
 
+  // Buffers of the active MiniTrace, which owns them.
+  MiniTraceThreadData* GetMiniTraceData() const {
+    return tlsPtr_.mini_trace_data;
+  }
+
+  void SetMiniTraceData(MiniTraceThreadData* data) {
+    tlsPtr_.mini_trace_data = data;
+  }
+
+  // Records of the active method trace, which owns them.
+  TraceThreadBuffer* GetMethodTraceBuffer() const {
+    return tlsPtr_.method_trace_buffer;
+  }
+
+  void SetMethodTraceBuffer(TraceThreadBuffer* buffer) {
+    tlsPtr_.method_trace_buffer = buffer;
+  }
+
   // Returns true if the current thread is the jit sensitive thread.
   bool IsJitSensitiveThread() const {
     return this == jit_sensitive_thread_;
@@ -1571,7 +1591,8 @@ class Thread {
       mterp_alt_ibase(nullptr), thread_local_alloc_stack_top(nullptr),
       thread_local_alloc_stack_end(nullptr),
       flip_function(nullptr), method_verifier(nullptr), thread_local_mark_stack(nullptr),
-      async_exception(nullptr) {
+      async_exception(nullptr), mini_trace_data(nullptr),
+      method_trace_buffer(nullptr) {
       std::fill(held_mutexes, held_mutexes + kLockLevelCount, nullptr);
     }
 
@@ -1645,8 +1666,8 @@ class Thread {
     Context* long_jump_context;
 
     // Additional stack used by method instrumentation to store method and return pc values.
-    // Stored as a pointer since std::deque is not PACKED.
-    std::deque<instrumentation::InstrumentationStackFrame>* instrumentation_stack;
+    // Stored as a pointer since InstrumentationStack is not PACKED.
+    instrumentation::InstrumentationStack* instrumentation_stack;
 
     // JDWP invoke-during-breakpoint support.
     DebugInvokeReq* debug_invoke_req;
@@ -1731,6 +1752,12 @@ class Thread {
 
     // The pending async-exception or null.
     mirror::Throwable* async_exception;
+
+    // Per-thread buffers of the active MiniTrace or null.
+    MiniTraceThreadData* mini_trace_data;
+
+    // Records of the active method trace not copied to its buffer yet, or null.
+    TraceThreadBuffer* method_trace_buffer;
   } tlsPtr_;
 
   // Guards the 'wait_monitor_' members.
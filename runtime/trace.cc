@@ -16,12 +16,15 @@
 
 #include "trace.h"
 
+#include <algorithm>
+
 #include <sys/uio.h>
 #include <unistd.h>
 
 #include "android-base/stringprintf.h"
 
 #include "art_method-inl.h"
+#include "barrier.h"
 #include "base/casts.h"
 #include "base/enums.h"
 #include "base/os.h"
@@ -84,6 +87,62 @@ class BuildStackTraceVisitor : public StackVisitor {
   DISALLOW_COPY_AND_ASSIGN(BuildStackTraceVisitor);
 };
 
+// Sampled stacks with folded stacks keep their topmost frames only.
+static constexpr size_t kMaxSampledFrames = 128;
+
+// Walks the topmost frames of a stack into a reused vector, topmost frame first.
+class SampleStackVisitor : public StackVisitor {
+ public:
+  SampleStackVisitor(Thread* thread, std::vector<ArtMethod*>* stack)
+      : StackVisitor(thread, nullptr, StackVisitor::StackWalkKind::kIncludeInlinedFrames),
+        stack_(stack) {}
+
+  bool VisitFrame() REQUIRES_SHARED(Locks::mutator_lock_) {
+    ArtMethod* m = GetMethod();
+    // Ignore runtime frames (in particular callee save).
+    if (!m->IsRuntimeMethod()) {
+      stack_->push_back(m);
+    }
+    return stack_->size() < kMaxSampledFrames;
+  }
+
+ private:
+  std::vector<ArtMethod*>* const stack_;
+
+  DISALLOW_COPY_AND_ASSIGN(SampleStackVisitor);
+};
+
+// Counts the stack of each thread. Runs on the thread itself if it is runnable, so that only
+// one thread stops at a time, and on the sampling thread for suspended threads.
+class SampleStackCheckpoint FINAL : public Closure {
+ public:
+  explicit SampleStackCheckpoint(Trace* trace) : trace_(trace), barrier_(0) {}
+
+  void Run(Thread* thread) OVERRIDE {
+    // Note thread and self may not be equal if thread was already suspended at the point of the
+    // request.
+    Thread* self = Thread::Current();
+    {
+      ScopedObjectAccess soa(self);
+      trace_->RecordStackSample(thread);
+    }
+    barrier_.Pass(self);
+  }
+
+  void WaitForThreadsToRunThroughCheckpoint(size_t threads_running_checkpoint) {
+    Thread* self = Thread::Current();
+    ScopedThreadStateChange tsc(self, kWaitingForCheckPointsToRun);
+    barrier_.Increment(self, threads_running_checkpoint);
+  }
+
+ private:
+  Trace* const trace_;
+  // The barrier to be passed through and for the requestor to wait upon.
+  Barrier barrier_;
+
+  DISALLOW_COPY_AND_ASSIGN(SampleStackCheckpoint);
+};
+
 static const char     kTraceTokenChar             = '*';
 static const uint16_t kTraceHeaderLength          = 32;
 static const uint32_t kTraceMagicValue            = 0x574f4c53;
@@ -92,6 +151,12 @@ static const uint16_t kTraceVersionDualClock      = 3;
 static const uint16_t kTraceRecordSizeSingleClock = 10;  // using v2
 static const uint16_t kTraceRecordSizeDualClock   = 14;  // using v3 with two timestamps
 
+// Size of the per-thread record buffers, rounded down to a multiple of the record size.
+static constexpr size_t kThreadBufferSize = 4 * KB;
+
+// Number of buffers the trace buffer is split into when streaming.
+static constexpr size_t kStreamingBufferCount = 4;
+
 TraceClockSource Trace::default_clock_source_ = kDefaultTraceClockSource;
 
 Trace* volatile Trace::the_trace_ = nullptr;
@@ -126,12 +191,6 @@ uint32_t Trace::EncodeTraceMethod(ArtMethod* method) {
   return idx;
 }
 
-uint32_t Trace::EncodeTraceMethodAndAction(ArtMethod* method, TraceAction action) {
-  uint32_t tmid = (EncodeTraceMethod(method) << TraceActionBits) | action;
-  DCHECK_EQ(method, DecodeTraceMethod(tmid));
-  return tmid;
-}
-
 std::vector<ArtMethod*>* Trace::AllocStackTrace() {
   return (temp_stack_trace_.get() != nullptr)  ? temp_stack_trace_.release() :
       new std::vector<ArtMethod*>();
@@ -242,6 +301,10 @@ static void ClearThreadStackTraceAndClockBase(Thread* thread, void* arg ATTRIBUT
   delete stack_trace;
 }
 
+static void ClearThreadTraceBuffer(Thread* thread, void* arg ATTRIBUTE_UNUSED) {
+  thread->SetMethodTraceBuffer(nullptr);
+}
+
 void Trace::CompareAndUpdateStackTrace(Thread* thread,
                                        std::vector<ArtMethod*>* stack_trace) {
   CHECK_EQ(pthread_self(), sampling_pthread_);
@@ -283,6 +346,36 @@ void Trace::CompareAndUpdateStackTrace(Thread* thread,
   }
 }
 
+void Trace::RecordStackSample(Thread* thread) {
+  TraceThreadBuffer* buffer = GetThreadBuffer(thread);
+  std::vector<ArtMethod*>& sample = buffer->sample;
+  sample.clear();
+  SampleStackVisitor visitor(thread, &sample);
+  visitor.WalkStack();
+  if (sample.empty()) {
+    // Not running managed code, e.g. the sampling thread itself.
+    return;
+  }
+  auto it = buffer->stack_counts.find(sample);
+  if (it != buffer->stack_counts.end()) {
+    ++it->second;
+  } else {
+    buffer->stack_counts.emplace(sample, 1u);
+  }
+}
+
+void Trace::SampleStacks(Thread* self) {
+  SampleStackCheckpoint checkpoint(this);
+  size_t threads_running_checkpoint;
+  {
+    ScopedObjectAccess soa(self);
+    threads_running_checkpoint = Runtime::Current()->GetThreadList()->RunCheckpoint(&checkpoint);
+  }
+  if (threads_running_checkpoint != 0) {
+    checkpoint.WaitForThreadsToRunThroughCheckpoint(threads_running_checkpoint);
+  }
+}
+
 void* Trace::RunSamplingThread(void* arg) {
   Runtime* runtime = Runtime::Current();
   intptr_t interval_us = reinterpret_cast<intptr_t>(arg);
@@ -302,7 +395,9 @@ void* Trace::RunSamplingThread(void* arg) {
         break;
       }
     }
-    {
+    if (the_trace->folded_stacks_) {
+      the_trace->SampleStacks(self);
+    } else {
       // Avoid a deadlock between a thread doing garbage collection
       // and the profile sampling thread, by blocking GC when sampling
       // thread stacks (see b/73624630).
@@ -371,9 +466,14 @@ void Trace::Start(const char* trace_filename, int trace_fd, size_t buffer_size,
     if (the_trace_ != nullptr) {
       LOG(ERROR) << "Trace already in progress, ignoring this request";
     } else {
-      enable_stats = (flags && kTraceCountAllocs) != 0;
+      enable_stats = (flags & kTraceCountAllocs) != 0;
       the_trace_ = new Trace(trace_file.release(), trace_filename, buffer_size, flags, output_mode,
                              trace_mode);
+      if (output_mode == TraceOutputMode::kStreaming) {
+        CHECK_PTHREAD_CALL(pthread_create, (&the_trace_->writer_pthread_, nullptr,
+                                            &RunStreamingWriterThread, the_trace_),
+                                            "Trace writer thread");
+      }
       if (trace_mode == TraceMode::kSampling) {
         CHECK_PTHREAD_CALL(pthread_create, (&sampling_pthread_, nullptr, &RunSamplingThread,
                                             reinterpret_cast<void*>(interval_us)),
@@ -422,23 +522,31 @@ void Trace::StopTracing(bool finish_tracing, bool flush_file) {
 
   if (the_trace != nullptr) {
     stop_alloc_counting = (the_trace->flags_ & Trace::kTraceCountAllocs) != 0;
+    {
+      gc::ScopedGCCriticalSection gcs(self,
+                                      gc::kGcCauseInstrumentation,
+                                      gc::kCollectorTypeInstrumentation);
+      ScopedSuspendAll ssa(__FUNCTION__);
+
+      if (the_trace->trace_mode_ == TraceMode::kSampling) {
+        MutexLock mu(self, *Locks::thread_list_lock_);
+        runtime->GetThreadList()->ForEach(ClearThreadStackTraceAndClockBase, nullptr);
+      } else {
+        runtime->GetInstrumentation()->DisableMethodTracing(kTracerInstrumentationKey);
+        runtime->GetInstrumentation()->RemoveListener(
+            the_trace, instrumentation::Instrumentation::kMethodEntered |
+            instrumentation::Instrumentation::kMethodExited |
+            instrumentation::Instrumentation::kMethodUnwind);
+      }
+      MutexLock mu(self, *Locks::thread_list_lock_);
+      runtime->GetThreadList()->ForEach(ClearThreadTraceBuffer, nullptr);
+    }
+    // No more events are logged, the buffers of the threads are complete.
     if (finish_tracing) {
       the_trace->FinishTracing();
     }
-    gc::ScopedGCCriticalSection gcs(self,
-                                    gc::kGcCauseInstrumentation,
-                                    gc::kCollectorTypeInstrumentation);
-    ScopedSuspendAll ssa(__FUNCTION__);
-
-    if (the_trace->trace_mode_ == TraceMode::kSampling) {
-      MutexLock mu(self, *Locks::thread_list_lock_);
-      runtime->GetThreadList()->ForEach(ClearThreadStackTraceAndClockBase, nullptr);
-    } else {
-      runtime->GetInstrumentation()->DisableMethodTracing(kTracerInstrumentationKey);
-      runtime->GetInstrumentation()->RemoveListener(
-          the_trace, instrumentation::Instrumentation::kMethodEntered |
-          instrumentation::Instrumentation::kMethodExited |
-          instrumentation::Instrumentation::kMethodUnwind);
+    if (the_trace->trace_output_mode_ == TraceOutputMode::kStreaming) {
+      the_trace->StopStreamingWriter();
     }
     if (the_trace->trace_file_.get() != nullptr) {
       // Do not try to erase, so flush and close explicitly.
@@ -549,7 +657,7 @@ void Trace::Resume() {
   Runtime* runtime = Runtime::Current();
 
   // Enable count of allocs if specified in the flags.
-  bool enable_stats = (the_trace->flags_ && kTraceCountAllocs) != 0;
+  bool enable_stats = (the_trace->flags_ & kTraceCountAllocs) != 0;
 
   {
     gc::ScopedGCCriticalSection gcs(self,
@@ -595,15 +703,28 @@ TracingMode Trace::GetMethodTracingMode() {
 
 static constexpr size_t kMinBufSize = 18U;  // Trace header is up to 18B.
 
+static size_t GetTraceBufferSize(size_t buffer_size, Trace::TraceOutputMode output_mode) {
+  // Each streaming buffer holds at least a chunk of records of a thread.
+  size_t min_size = (output_mode == Trace::TraceOutputMode::kStreaming)
+      ? kStreamingBufferCount * kThreadBufferSize
+      : kMinBufSize;
+  return std::max(min_size, buffer_size);
+}
+
 Trace::Trace(File* trace_file, const char* trace_name, size_t buffer_size, int flags,
              TraceOutputMode output_mode, TraceMode trace_mode)
     : trace_file_(trace_file),
-      buf_(new uint8_t[std::max(kMinBufSize, buffer_size)]()),
+      buf_(new uint8_t[GetTraceBufferSize(buffer_size, output_mode)]()),
       flags_(flags), trace_output_mode_(output_mode), trace_mode_(trace_mode),
+      folded_stacks_(trace_mode == TraceMode::kSampling &&
+                     output_mode != TraceOutputMode::kDDMS &&
+                     (flags & kTraceFoldedStacks) != 0),
       clock_source_(default_clock_source_),
-      buffer_size_(std::max(kMinBufSize, buffer_size)),
+      buffer_size_(GetTraceBufferSize(buffer_size, output_mode)),
       start_time_(MicroTime()), clock_overhead_ns_(GetClockOverheadNanoSeconds()), cur_offset_(0),
-      overflow_(false), interval_us_(0), streaming_lock_(nullptr),
+      overflow_(false), interval_us_(0), streaming_lock_(nullptr), writer_pthread_(0U),
+      streaming_buffer_size_(0u), fill_buffer_(0u), full_buffers_(0u), stop_writer_(false),
+      dropped_records_(0u),
       unique_methods_lock_(new Mutex("unique methods lock", kTracingUniqueMethodsLock)) {
   uint16_t trace_version = GetTraceVersion(clock_source_);
   if (output_mode == TraceOutputMode::kStreaming) {
@@ -627,11 +748,17 @@ Trace::Trace(File* trace_file, const char* trace_name, size_t buffer_size, int f
   if (output_mode == TraceOutputMode::kStreaming) {
     streaming_file_name_ = trace_name;
     streaming_lock_ = new Mutex("tracing lock", LockLevel::kTracingStreamingLock);
+    streaming_cond_.reset(new ConditionVariable("tracing condition", *streaming_lock_));
     seen_threads_.reset(new ThreadIDBitSet());
+    // The header starts the first buffer.
+    streaming_buffer_size_ = buffer_size_ / kStreamingBufferCount;
+    streaming_sizes_.resize(kStreamingBufferCount, 0u);
+    streaming_sizes_[0] = kTraceHeaderLength;
   }
 }
 
 Trace::~Trace() {
+  streaming_cond_.reset();
   delete streaming_lock_;
   delete unique_methods_lock_;
 }
@@ -658,17 +785,30 @@ void Trace::DumpBuf(uint8_t* buf, size_t buf_size, TraceClockSource clock_source
 }
 
 void Trace::FinishTracing() {
+  if (folded_stacks_) {
+    FinishFoldedStacks();
+    return;
+  }
   size_t final_offset = 0;
 
   std::set<ArtMethod*> visited_methods;
   if (trace_output_mode_ == TraceOutputMode::kStreaming) {
     // Clean up.
     STLDeleteValues(&seen_methods_);
-  } else {
+  }
+  FlushThreadBuffers();
+  if (trace_output_mode_ != TraceOutputMode::kStreaming) {
     final_offset = cur_offset_.LoadRelaxed();
+    SortRecords(final_offset);
     GetVisitedMethods(final_offset, &visited_methods);
   }
 
+  size_t dropped_records = 0u;
+  if (trace_output_mode_ == TraceOutputMode::kStreaming) {
+    MutexLock mu(Thread::Current(), *streaming_lock_);
+    dropped_records = dropped_records_;
+  }
+
   // Compute elapsed time.
   uint64_t elapsed = MicroTime() - start_time_;
 
@@ -690,6 +830,8 @@ void Trace::FinishTracing() {
   if (trace_output_mode_ != TraceOutputMode::kStreaming) {
     size_t num_records = (final_offset - kTraceHeaderLength) / GetRecordSize(clock_source_);
     os << StringPrintf("num-method-calls=%zd\n", num_records);
+  } else if (dropped_records != 0u) {
+    os << StringPrintf("num-dropped-method-calls=%zu\n", dropped_records);
   }
   os << StringPrintf("clock-call-overhead-nsec=%d\n", clock_overhead_ns_);
   os << StringPrintf("vm=art\n");
@@ -744,6 +886,56 @@ void Trace::FinishTracing() {
   }
 }
 
+void Trace::FinishFoldedStacks() {
+  Thread* self = Thread::Current();
+  SafeMap<pid_t, std::string> thread_names(exited_threads_);
+  {
+    MutexLock mu(self, *Locks::thread_list_lock_);
+    for (Thread* thread : Runtime::Current()->GetThreadList()->GetList()) {
+      std::string name;
+      thread->GetThreadName(name);
+      thread_names.Overwrite(thread->GetTid(), name);
+    }
+  }
+
+  std::unordered_map<ArtMethod*, std::string> method_names;
+  std::ostringstream os;
+  {
+    MutexLock mu(self, *unique_methods_lock_);
+    for (const std::unique_ptr<TraceThreadBuffer>& buffer : thread_buffers_) {
+      if (buffer->stack_counts.empty()) {
+        continue;
+      }
+      auto name_it = thread_names.find(buffer->tid);
+      std::string thread_name = (name_it != thread_names.end())
+          ? name_it->second
+          : StringPrintf("%d", buffer->tid);
+      // Spaces and semicolons separate the fields of a line.
+      std::replace(thread_name.begin(), thread_name.end(), ' ', '_');
+      std::replace(thread_name.begin(), thread_name.end(), ';', '_');
+      for (const auto& entry : buffer->stack_counts) {
+        os << thread_name;
+        for (auto it = entry.first.rbegin(); it != entry.first.rend(); ++it) {
+          auto method_it = method_names.find(*it);
+          if (method_it == method_names.end()) {
+            method_it = method_names.emplace(*it, ArtMethod::PrettyMethod(*it, false)).first;
+          }
+          os << ';' << method_it->second;
+        }
+        os << ' ' << entry.second << '\n';
+      }
+    }
+  }
+
+  // Folded stacks are only written to files, see the constructor.
+  std::string folded(os.str());
+  if (!trace_file_->WriteFully(folded.c_str(), folded.length())) {
+    std::string detail(StringPrintf("Trace data write failed: %s", strerror(errno)));
+    PLOG(ERROR) << detail;
+    ThrowRuntimeException("%s", detail.c_str());
+  }
+}
+
 void Trace::DexPcMoved(Thread* thread ATTRIBUTE_UNUSED,
                        Handle<mirror::Object> this_object ATTRIBUTE_UNUSED,
                        ArtMethod* method,
@@ -892,37 +1084,258 @@ std::string Trace::GetMethodLine(ArtMethod* method) {
 }
 
 void Trace::WriteToBuf(const uint8_t* src, size_t src_size) {
-  int32_t old_offset = cur_offset_.LoadRelaxed();
-  int32_t new_offset = old_offset + static_cast<int32_t>(src_size);
-  if (dchecked_integral_cast<size_t>(new_offset) > buffer_size_) {
-    // Flush buffer.
-    if (!trace_file_->WriteFully(buf_.get(), old_offset)) {
-      PLOG(WARNING) << "Failed streaming a tracing event.";
+  Thread* self = Thread::Current();
+  while (src_size != 0u) {
+    if (streaming_sizes_[fill_buffer_] == streaming_buffer_size_) {
+      SwitchStreamingBuffer(self);
     }
+    size_t& fill_size = streaming_sizes_[fill_buffer_];
+    size_t size = std::min(src_size, streaming_buffer_size_ - fill_size);
+    memcpy(buf_.get() + fill_buffer_ * streaming_buffer_size_ + fill_size, src, size);
+    fill_size += size;
+    src += size;
+    src_size -= size;
+  }
+}
+
+void Trace::FlushBuf() {
+  if (streaming_sizes_[fill_buffer_] != 0u) {
+    SwitchStreamingBuffer(Thread::Current());
+  }
+}
+
+void Trace::SwitchStreamingBuffer(Thread* self) {
+  ++full_buffers_;
+  fill_buffer_ = (fill_buffer_ + 1u) % kStreamingBufferCount;
+  streaming_cond_->Broadcast(self);
+  // The next buffer is free unless all buffers are full. Traced threads only write what fits in
+  // GetStreamingSpace() and never get here with all buffers full, as they hold the mutator lock
+  // which the writer thread needs to attach and a suspend-all would wait for them. Only
+  // FinishTracing() waits for the writer, without the mutator lock.
+  while (full_buffers_ == kStreamingBufferCount) {
+    streaming_cond_->Wait(self);
+  }
+  DCHECK_EQ(streaming_sizes_[fill_buffer_], 0u);
+}
 
-    // Check whether the data is too large for the buffer, then write immediately.
-    if (src_size >= buffer_size_) {
-      if (!trace_file_->WriteFully(src, src_size)) {
-        PLOG(WARNING) << "Failed streaming a tracing event.";
+size_t Trace::GetStreamingSpace() {
+  size_t free_buffers = kStreamingBufferCount - 1u - full_buffers_;
+  return free_buffers * streaming_buffer_size_ +
+      (streaming_buffer_size_ - streaming_sizes_[fill_buffer_]);
+}
+
+void* Trace::RunStreamingWriterThread(void* arg) {
+  Runtime* runtime = Runtime::Current();
+  Trace* trace = reinterpret_cast<Trace*>(arg);
+  CHECK(runtime->AttachCurrentThread("Trace writer", true, runtime->GetSystemThreadGroup(),
+                                     !runtime->IsAotCompiler()));
+  trace->WriteStreamingBuffers(Thread::Current());
+  runtime->DetachCurrentThread();
+  return nullptr;
+}
+
+void Trace::WriteStreamingBuffers(Thread* self) {
+  while (true) {
+    size_t index;
+    size_t size;
+    {
+      MutexLock mu(self, *streaming_lock_);
+      while (full_buffers_ == 0u && !stop_writer_) {
+        streaming_cond_->Wait(self);
       }
-      cur_offset_.StoreRelease(0);  // Buffer is empty now.
-      return;
+      if (full_buffers_ == 0u) {
+        return;
+      }
+      index = (fill_buffer_ + kStreamingBufferCount - full_buffers_) % kStreamingBufferCount;
+      size = streaming_sizes_[index];
+    }
+    // The buffer is not touched by traced threads until it is free again.
+    ScopedTrace trace("Trace streaming write");
+    if (!trace_file_->WriteFully(buf_.get() + index * streaming_buffer_size_, size)) {
+      PLOG(WARNING) << "Failed streaming tracing events.";
+    }
+    {
+      MutexLock mu(self, *streaming_lock_);
+      streaming_sizes_[index] = 0u;
+      --full_buffers_;
+      streaming_cond_->Broadcast(self);
     }
+  }
+}
 
-    old_offset = 0;
-    new_offset = static_cast<int32_t>(src_size);
+void Trace::StopStreamingWriter() {
+  Thread* self = Thread::Current();
+  {
+    MutexLock mu(self, *streaming_lock_);
+    stop_writer_ = true;
+    streaming_cond_->Broadcast(self);
   }
-  cur_offset_.StoreRelease(new_offset);
-  // Fill in data.
-  memcpy(buf_.get() + old_offset, src, src_size);
+  CHECK_PTHREAD_CALL(pthread_join, (writer_pthread_, nullptr), "trace writer shutdown");
+  writer_pthread_ = 0U;
 }
 
-void Trace::FlushBuf() {
-  int32_t offset = cur_offset_.LoadRelaxed();
-  if (!trace_file_->WriteFully(buf_.get(), offset)) {
-    PLOG(WARNING) << "Failed flush the remaining data in streaming.";
+TraceThreadBuffer* Trace::GetThreadBuffer(Thread* thread) {
+  TraceThreadBuffer* buffer = thread->GetMethodTraceBuffer();
+  if (LIKELY(buffer != nullptr)) {
+    return buffer;
+  }
+  // Folded stacks log no records.
+  const size_t record_size = GetRecordSize(clock_source_);
+  const size_t capacity = folded_stacks_ ? 0u : kThreadBufferSize / record_size * record_size;
+  std::unique_ptr<TraceThreadBuffer> new_buffer(new TraceThreadBuffer(thread->GetTid(), capacity));
+  buffer = new_buffer.get();
+  Thread* self = Thread::Current();
+  {
+    MutexLock mu(self, *unique_methods_lock_);
+    thread_buffers_.push_back(std::move(new_buffer));
+  }
+  thread->SetMethodTraceBuffer(buffer);
+  return buffer;
+}
+
+bool Trace::WriteNames(Thread* thread, ArtMethod* method) {
+  std::vector<uint8_t> names;
+  const bool new_thread = RegisterThread(thread);
+  if (new_thread) {
+    // It might be better to postpone this. Threads might not have received names...
+    std::string thread_name;
+    thread->GetThreadName(thread_name);
+    uint8_t buf[7];
+    Append2LE(buf, 0);
+    buf[2] = kOpNewThread;
+    Append2LE(buf + 3, static_cast<uint16_t>(thread->GetTid()));
+    Append2LE(buf + 5, static_cast<uint16_t>(thread_name.length()));
+    names.insert(names.end(), buf, buf + sizeof(buf));
+    names.insert(names.end(), thread_name.begin(), thread_name.end());
+  }
+  const bool new_method = RegisterMethod(method);
+  if (new_method) {
+    // Write a special block with the name.
+    std::string method_line(GetMethodLine(method));
+    uint8_t buf[5];
+    Append2LE(buf, 0);
+    buf[2] = kOpNewMethod;
+    Append2LE(buf + 3, static_cast<uint16_t>(method_line.length()));
+    names.insert(names.end(), buf, buf + sizeof(buf));
+    names.insert(names.end(), method_line.begin(), method_line.end());
+  }
+  if (names.size() > GetStreamingSpace()) {
+    // Forget the names again, the next event of the thread tries to write them.
+    if (new_thread) {
+      seen_threads_->reset(thread->GetTid());
+    }
+    if (new_method) {
+      const DexFile* dex_file = method->GetDexCache()->GetDexFile();
+      seen_methods_.find(dex_file)->second->reset(method->GetDexMethodIndex());
+    }
+    return false;
+  }
+  WriteToBuf(names.data(), names.size());
+  return true;
+}
+
+bool Trace::GetMethodId(Thread* thread,
+                        TraceThreadBuffer* buffer,
+                        ArtMethod* method,
+                        uint32_t* method_id) {
+  auto it = buffer->method_ids.find(method);
+  if (LIKELY(it != buffer->method_ids.end())) {
+    *method_id = it->second;
+    return true;
+  }
+  if (trace_output_mode_ == TraceOutputMode::kStreaming) {
+    // The names go to the stream before any record of this thread using the method. The first
+    // lookup of a thread always gets here, so that the thread is named as well.
+    MutexLock mu(Thread::Current(), *streaming_lock_);
+    if (!WriteNames(thread, method)) {
+      ++dropped_records_;
+      overflow_ = true;
+      return false;
+    }
+  }
+  *method_id = EncodeTraceMethod(method) << TraceActionBits;
+  buffer->method_ids.emplace(method, *method_id);
+  return true;
+}
+
+void Trace::FlushThreadBuffer(TraceThreadBuffer* buffer, bool may_drop) {
+  if (buffer->size == 0u) {
+    return;
+  }
+  const size_t record_size = GetRecordSize(clock_source_);
+  if (trace_output_mode_ == TraceOutputMode::kStreaming) {
+    MutexLock mu(Thread::Current(), *streaming_lock_);  // To serialize writing.
+    // Drop the records rather than make a traced thread wait for the writer thread. The names
+    // the records need are in the stream already, see WriteNames().
+    if (!may_drop || buffer->size <= GetStreamingSpace()) {
+      WriteToBuf(buffer->data.get(), buffer->size);
+    } else {
+      dropped_records_ += buffer->size / record_size;
+      overflow_ = true;
+    }
+    buffer->size = 0u;
+    return;
+  }
+
+  // Reserve space for as many of the records as fit in buf_.
+  int32_t old_offset;
+  int32_t new_offset;
+  size_t size;
+  do {
+    old_offset = cur_offset_.LoadRelaxed();
+    size_t available = buffer_size_ - static_cast<size_t>(old_offset);
+    size = std::min(buffer->size, available / record_size * record_size);
+    new_offset = old_offset + static_cast<int32_t>(size);
+  } while (size != 0u &&
+           !cur_offset_.CompareAndSetWeakSequentiallyConsistent(old_offset, new_offset));
+  if (size != buffer->size) {
+    overflow_ = true;
+  }
+  memcpy(buf_.get() + old_offset, buffer->data.get(), size);
+  buffer->size = 0u;
+}
+
+void Trace::FlushThreadBuffers() {
+  std::vector<TraceThreadBuffer*> buffers;
+  {
+    MutexLock mu(Thread::Current(), *unique_methods_lock_);
+    for (const std::unique_ptr<TraceThreadBuffer>& buffer : thread_buffers_) {
+      buffers.push_back(buffer.get());
+    }
+  }
+  for (TraceThreadBuffer* buffer : buffers) {
+    FlushThreadBuffer(buffer, /* may_drop */ false);
   }
-  cur_offset_.StoreRelease(0);
+}
+
+void Trace::SortRecords(size_t end_offset) {
+  if (!UseWallClock()) {
+    // Thread CPU times are not comparable between threads.
+    return;
+  }
+  const size_t record_size = GetRecordSize(clock_source_);
+  const size_t wall_clock_offset = UseThreadCpuClock() ? 10u : 6u;
+  uint8_t* const begin = buf_.get() + kTraceHeaderLength;
+  const size_t num_records = (end_offset - kTraceHeaderLength) / record_size;
+  std::vector<std::pair<uint32_t, uint32_t>> order;  // Wall clock time and record index.
+  order.reserve(num_records);
+  for (size_t i = 0; i != num_records; ++i) {
+    uint32_t time = ReadBytes(begin + i * record_size + wall_clock_offset, sizeof(time));
+    order.emplace_back(time, i);
+  }
+  // The chunks of each thread are in order already, a stable sort keeps them so when the clock
+  // reads the same time.
+  std::stable_sort(order.begin(),
+                   order.end(),
+                   [](const std::pair<uint32_t, uint32_t>& lhs,
+                      const std::pair<uint32_t, uint32_t>& rhs) {
+                     return lhs.first < rhs.first;
+                   });
+  std::unique_ptr<uint8_t[]> sorted(new uint8_t[num_records * record_size]);
+  for (size_t i = 0; i != num_records; ++i) {
+    memcpy(sorted.get() + i * record_size, begin + order[i].second * record_size, record_size);
+  }
+  memcpy(begin, sorted.get(), num_records * record_size);
 }
 
 void Trace::LogMethodTraceEvent(Thread* thread, ArtMethod* method,
@@ -931,21 +1344,6 @@ void Trace::LogMethodTraceEvent(Thread* thread, ArtMethod* method,
   // Ensure we always use the non-obsolete version of the method so that entry/exit events have the
   // same pointer value.
   method = method->GetNonObsoleteMethod();
-  // Advance cur_offset_ atomically.
-  int32_t new_offset;
-  int32_t old_offset = 0;
-
-  // We do a busy loop here trying to acquire the next offset.
-  if (trace_output_mode_ != TraceOutputMode::kStreaming) {
-    do {
-      old_offset = cur_offset_.LoadRelaxed();
-      new_offset = old_offset + GetRecordSize(clock_source_);
-      if (static_cast<size_t>(new_offset) > buffer_size_) {
-        overflow_ = true;
-        return;
-      }
-    } while (!cur_offset_.CompareAndSetWeakSequentiallyConsistent(old_offset, new_offset));
-  }
 
   TraceAction action = kTraceMethodEnter;
   switch (event) {
@@ -962,18 +1360,20 @@ void Trace::LogMethodTraceEvent(Thread* thread, ArtMethod* method,
       UNIMPLEMENTED(FATAL) << "Unexpected event: " << event;
   }
 
-  uint32_t method_value = EncodeTraceMethodAndAction(method, action);
-
-  // Write data
-  uint8_t* ptr;
-  static constexpr size_t kPacketSize = 14U;  // The maximum size of data in a packet.
-  uint8_t stack_buf[kPacketSize];             // Space to store a packet when in streaming mode.
-  if (trace_output_mode_ == TraceOutputMode::kStreaming) {
-    ptr = stack_buf;
-  } else {
-    ptr = buf_.get() + old_offset;
+  // Records go to the buffer of the thread, which reaches buf_ or the stream a chunk at a time.
+  TraceThreadBuffer* buffer = GetThreadBuffer(thread);
+  uint32_t method_id;
+  if (!GetMethodId(thread, buffer, method, &method_id)) {
+    return;  // Dropped while streaming, the names did not fit.
+  }
+  uint32_t method_value = method_id | action;
+  DCHECK_EQ(method, DecodeTraceMethod(method_value));
+  if (buffer->size == buffer->capacity) {
+    FlushThreadBuffer(buffer, /* may_drop */ true);
   }
 
+  // Write data
+  uint8_t* ptr = buffer->data.get() + buffer->size;
   Append2LE(ptr, thread->GetTid());
   Append4LE(ptr + 2, method_value);
   ptr += 6;
@@ -985,34 +1385,7 @@ void Trace::LogMethodTraceEvent(Thread* thread, ArtMethod* method,
   if (UseWallClock()) {
     Append4LE(ptr, wall_clock_diff);
   }
-  static_assert(kPacketSize == 2 + 4 + 4 + 4, "Packet size incorrect.");
-
-  if (trace_output_mode_ == TraceOutputMode::kStreaming) {
-    MutexLock mu(Thread::Current(), *streaming_lock_);  // To serialize writing.
-    if (RegisterMethod(method)) {
-      // Write a special block with the name.
-      std::string method_line(GetMethodLine(method));
-      uint8_t buf2[5];
-      Append2LE(buf2, 0);
-      buf2[2] = kOpNewMethod;
-      Append2LE(buf2 + 3, static_cast<uint16_t>(method_line.length()));
-      WriteToBuf(buf2, sizeof(buf2));
-      WriteToBuf(reinterpret_cast<const uint8_t*>(method_line.c_str()), method_line.length());
-    }
-    if (RegisterThread(thread)) {
-      // It might be better to postpone this. Threads might not have received names...
-      std::string thread_name;
-      thread->GetThreadName(thread_name);
-      uint8_t buf2[7];
-      Append2LE(buf2, 0);
-      buf2[2] = kOpNewThread;
-      Append2LE(buf2 + 3, static_cast<uint16_t>(thread->GetTid()));
-      Append2LE(buf2 + 5, static_cast<uint16_t>(thread_name.length()));
-      WriteToBuf(buf2, sizeof(buf2));
-      WriteToBuf(reinterpret_cast<const uint8_t*>(thread_name.c_str()), thread_name.length());
-    }
-    WriteToBuf(stack_buf, sizeof(stack_buf));
-  }
+  buffer->size += GetRecordSize(clock_source_);
 }
 
 void Trace::GetVisitedMethods(size_t buf_size,
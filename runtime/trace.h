@@ -41,6 +41,37 @@ class DexFile;
 class ShadowFrame;
 class Thread;
 
+// The method trace records of one thread not yet copied to the trace buffer or stream. Records
+// are copied a chunk at a time so that threads do not contend on every event. Owned by the
+// Trace; the thread only points to it.
+struct TraceThreadBuffer {
+  TraceThreadBuffer(pid_t tid_in, size_t capacity_in)
+      : tid(tid_in), capacity(capacity_in), data(new uint8_t[capacity_in]), size(0u) {}
+
+  const pid_t tid;
+  const size_t capacity;  // A multiple of the record size.
+  const std::unique_ptr<uint8_t[]> data;
+  size_t size;
+
+  // Encoded ids of the methods traced by the thread. The methods are registered with the
+  // trace, and named in the stream when streaming, already.
+  std::unordered_map<ArtMethod*, uint32_t> method_ids;
+
+  // Folded stack sampling. The last sampled stack, topmost frame first, reused to avoid
+  // allocating for every sample, and the number of samples of each distinct stack.
+  struct StackHash {
+    size_t operator()(const std::vector<ArtMethod*>& stack) const {
+      size_t hash = stack.size();
+      for (ArtMethod* method : stack) {
+        hash = hash * 31u + reinterpret_cast<uintptr_t>(method);
+      }
+      return hash;
+    }
+  };
+  std::vector<ArtMethod*> sample;
+  std::unordered_map<std::vector<ArtMethod*>, uint32_t, StackHash> stack_counts;
+};
+
 using DexIndexBitSet = std::bitset<65536>;
 
 constexpr size_t kMaxThreadIdNumber = kIsTargetBuild ? 65536U : 1048576U;
@@ -85,6 +116,10 @@ enum TracingMode {
 // 32 bits of microseconds is 70 minutes.
 //
 // All values are stored in little-endian order.
+//
+// With kTraceFoldedStacks, a sampling trace is written as folded stacks instead, one line per
+// distinct stack of a thread, outermost frame first:
+//     <thread name>;<method>;...;<method> <number of samples>
 
 enum TraceAction {
     kTraceMethodEnter = 0x00,       // method entry
@@ -98,6 +133,8 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
  public:
   enum TraceFlag {
     kTraceCountAllocs = 1,
+    // Sampling to a file only: count the sampled stacks and write them as folded stacks.
+    kTraceFoldedStacks = 2,
   };
 
   enum class TraceOutputMode {
@@ -140,6 +177,10 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   void CompareAndUpdateStackTrace(Thread* thread, std::vector<ArtMethod*>* stack_trace)
       REQUIRES_SHARED(Locks::mutator_lock_) REQUIRES(!*unique_methods_lock_, !*streaming_lock_);
 
+  // Counts the current stack of `thread` in its buffer. `thread` is suspended or the caller.
+  void RecordStackSample(Thread* thread)
+      REQUIRES_SHARED(Locks::mutator_lock_) REQUIRES(!*unique_methods_lock_, !*streaming_lock_);
+
   // InstrumentationListener implementation.
   void MethodEntered(Thread* thread,
                      Handle<mirror::Object> this_object,
@@ -218,6 +259,12 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   // The sampling interval in microseconds is passed as an argument.
   static void* RunSamplingThread(void* arg) REQUIRES(!Locks::trace_lock_);
 
+  // The writer thread of streaming mode, writing full buffers to the file until stopped.
+  static void* RunStreamingWriterThread(void* arg);
+  void WriteStreamingBuffers(Thread* self) REQUIRES(!*streaming_lock_);
+  // Stops the writer thread once it wrote all buffers handed to it.
+  void StopStreamingWriter() REQUIRES(!*streaming_lock_);
+
   static void StopTracing(bool finish_tracing, bool flush_file)
       REQUIRES(!Locks::mutator_lock_, !Locks::thread_list_lock_, !Locks::trace_lock_)
       // There is an annoying issue with static functions that create a new object and call into
@@ -235,6 +282,42 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
                            uint32_t thread_clock_diff, uint32_t wall_clock_diff)
       REQUIRES_SHARED(Locks::mutator_lock_) REQUIRES(!*unique_methods_lock_, !*streaming_lock_);
 
+  // Returns the buffer of `thread`, which records the events of `thread` but may be used by
+  // another thread while `thread` is suspended.
+  TraceThreadBuffer* GetThreadBuffer(Thread* thread)
+      REQUIRES(!*unique_methods_lock_, !*streaming_lock_);
+
+  // Sets `method_id` to the encoded id of `method` for the records of `buffer` of `thread`,
+  // naming the thread and the method in the stream the first time the thread traces it. Returns
+  // false, counting the event as dropped, if the names do not fit in the streaming buffers.
+  bool GetMethodId(Thread* thread,
+                   TraceThreadBuffer* buffer,
+                   ArtMethod* method,
+                   uint32_t* method_id)
+      REQUIRES_SHARED(Locks::mutator_lock_) REQUIRES(!*unique_methods_lock_, !*streaming_lock_);
+
+  // Writes the names of `thread` and `method` to the stream unless they are there already.
+  // Returns false, registering neither, if they do not fit without waiting for the writer thread.
+  bool WriteNames(Thread* thread, ArtMethod* method)
+      REQUIRES_SHARED(Locks::mutator_lock_) REQUIRES(streaming_lock_, !*unique_methods_lock_);
+
+  // Appends the records of `buffer` to the trace buffer or stream and empties it. When streaming,
+  // the records are dropped if `may_drop` and the writer thread is behind.
+  void FlushThreadBuffer(TraceThreadBuffer* buffer, bool may_drop) REQUIRES(!*streaming_lock_);
+
+  // Samples the stack of every thread with a checkpoint, for folded stacks.
+  void SampleStacks(Thread* self) REQUIRES(!Locks::mutator_lock_, !*unique_methods_lock_);
+
+  // Writes the folded stacks of all threads to the trace file.
+  void FinishFoldedStacks()
+      REQUIRES_SHARED(Locks::mutator_lock_) REQUIRES(!*unique_methods_lock_);
+
+  // Flushes the buffers of all threads. No events may be logged concurrently.
+  void FlushThreadBuffers() REQUIRES(!*unique_methods_lock_, !*streaming_lock_);
+
+  // Orders the records of buf_ by wall clock time. Records of the same thread keep their order.
+  void SortRecords(size_t end_offset);
+
   // Methods to output traced methods and threads.
   void GetVisitedMethods(size_t end_offset, std::set<ArtMethod*>* visited_methods)
       REQUIRES(!*unique_methods_lock_);
@@ -249,17 +332,22 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   bool RegisterThread(Thread* thread)
       REQUIRES(streaming_lock_);
 
-  // Copy a temporary buffer to the main buffer. Used for streaming. Exposed here for lock
-  // annotation.
+  // Copy a temporary buffer to the streaming buffers, waiting for the writer thread when they
+  // are all full. Traced threads check GetStreamingSpace() first, only FinishTracing() may wait.
+  // Used for streaming. Exposed here for lock annotation.
   void WriteToBuf(const uint8_t* src, size_t src_size)
       REQUIRES(streaming_lock_);
-  // Flush the main buffer to file. Used for streaming. Exposed here for lock annotation.
+  // Hand the buffer being filled to the writer thread. Used for streaming. Exposed here for lock
+  // annotation.
   void FlushBuf()
       REQUIRES(streaming_lock_);
+  // Moves to the next streaming buffer, waiting for the writer thread to free it.
+  void SwitchStreamingBuffer(Thread* self) REQUIRES(streaming_lock_);
+  // The number of bytes that can be streamed without waiting for the writer thread. Traced
+  // threads drop what does not fit.
+  size_t GetStreamingSpace() REQUIRES(streaming_lock_);
 
   uint32_t EncodeTraceMethod(ArtMethod* method) REQUIRES(!*unique_methods_lock_);
-  uint32_t EncodeTraceMethodAndAction(ArtMethod* method, TraceAction action)
-      REQUIRES(!*unique_methods_lock_);
   ArtMethod* DecodeTraceMethod(uint32_t tmid) REQUIRES(!*unique_methods_lock_);
   std::string GetMethodLine(ArtMethod* method) REQUIRES(!*unique_methods_lock_)
       REQUIRES_SHARED(Locks::mutator_lock_);
@@ -294,6 +382,9 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   // The tracing method.
   const TraceMode trace_mode_;
 
+  // Whether samples are counted as folded stacks instead of logged as method events.
+  const bool folded_stacks_;
+
   const TraceClockSource clock_source_;
 
   // Size of buf_.
@@ -305,7 +396,7 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   // Clock overhead.
   const uint32_t clock_overhead_ns_;
 
-  // Offset into buf_.
+  // Offset into buf_. Threads reserve space for a chunk of records at a time.
   AtomicInteger cur_offset_;
 
   // Did we overflow the buffer recording traces?
@@ -320,6 +411,18 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   // Streaming mode data.
   std::string streaming_file_name_;
   Mutex* streaming_lock_;
+  // buf_ is split into buffers filled in turn. Traced threads copy to the buffer being filled,
+  // the writer thread writes the full ones, oldest first, to the file.
+  std::unique_ptr<ConditionVariable> streaming_cond_;
+  pthread_t writer_pthread_;
+  size_t streaming_buffer_size_;
+  std::vector<size_t> streaming_sizes_ GUARDED_BY(streaming_lock_);
+  size_t fill_buffer_ GUARDED_BY(streaming_lock_);
+  size_t full_buffers_ GUARDED_BY(streaming_lock_);
+  bool stop_writer_ GUARDED_BY(streaming_lock_);
+  // Records dropped rather than making the traced thread wait for the writer thread, including
+  // events whose method or thread names did not fit.
+  size_t dropped_records_ GUARDED_BY(streaming_lock_);
   std::map<const DexFile*, DexIndexBitSet*> seen_methods_;
   std::unique_ptr<ThreadIDBitSet> seen_threads_;
 
@@ -329,6 +432,16 @@ class Trace FINAL : public instrumentation::InstrumentationListener {
   std::unordered_map<ArtMethod*, uint32_t> art_method_id_map_ GUARDED_BY(unique_methods_lock_);
   std::vector<ArtMethod*> unique_methods_ GUARDED_BY(unique_methods_lock_);
 
+  // The buffers of all threads that logged events, including exited ones.
+  std::vector<std::unique_ptr<TraceThreadBuffer>> thread_buffers_ GUARDED_BY(unique_methods_lock_);
+
+  friend class TraceTest;
+  ART_FRIEND_TEST(TraceTest, FlushThreadBufferOverflow);
+  ART_FRIEND_TEST(TraceTest, FoldedStacks);
+  ART_FRIEND_TEST(TraceTest, SortRecordsByWallClock);
+  ART_FRIEND_TEST(TraceTest, StreamingDropsRecordsWhenTheWriterIsBehind);
+  ART_FRIEND_TEST(TraceTest, StreamingWritesNamesOnlyWhenTheyFit);
+
   DISALLOW_COPY_AND_ASSIGN(Trace);
 };
 
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/os.h"
+#include "base/unix_file/fd_file.h"
+#include "class_linker.h"
+#include "common_runtime_test.h"
+#include "mirror/class-inl.h"
+#include "scoped_thread_state_change-inl.h"
+#include "thread_list.h"
+
+namespace art {
+
+class TraceTest : public CommonRuntimeTest {
+ protected:
+  // The trace header, followed by dual clock records.
+  static constexpr size_t kHeaderLength = 32u;
+  static constexpr size_t kRecordSize = 14u;
+
+  void SetUp() OVERRIDE {
+    CommonRuntimeTest::SetUp();
+    saved_clock_source_ = Trace::default_clock_source_;
+    Trace::default_clock_source_ = TraceClockSource::kDual;
+  }
+
+  void TearDown() OVERRIDE {
+    Trace::default_clock_source_ = saved_clock_source_;
+    CommonRuntimeTest::TearDown();
+  }
+
+  // A method trace sent to DDMS, so that it needs no file.
+  static std::unique_ptr<Trace> CreateTrace(size_t buffer_size) {
+    return std::unique_ptr<Trace>(new Trace(/* trace_file */ nullptr,
+                                            "[DDMS]",
+                                            buffer_size,
+                                            /* flags */ 0,
+                                            Trace::TraceOutputMode::kDDMS,
+                                            Trace::TraceMode::kMethodTracing));
+  }
+
+  // A method trace streamed to `file_name`, whose writer thread is not started yet.
+  static std::unique_ptr<Trace> CreateStreamingTrace(const std::string& file_name) {
+    return std::unique_ptr<Trace>(new Trace(OS::CreateEmptyFile(file_name.c_str()),
+                                            file_name.c_str(),
+                                            /* buffer_size */ 16 * KB,
+                                            /* flags */ 0,
+                                            Trace::TraceOutputMode::kStreaming,
+                                            Trace::TraceMode::kMethodTracing));
+  }
+
+  static void StartStreamingWriter(Trace* trace) {
+    CHECK_PTHREAD_CALL(pthread_create, (&trace->writer_pthread_, nullptr,
+                                        &Trace::RunStreamingWriterThread, trace),
+                                        "Trace writer thread");
+  }
+
+  // Hands the last buffer to the writer thread, stops it and returns the streamed file.
+  static std::string FinishStreaming(Trace* trace, const std::string& file_name) {
+    {
+      MutexLock mu(Thread::Current(), *trace->streaming_lock_);
+      trace->FlushBuf();
+    }
+    trace->StopStreamingWriter();
+    EXPECT_EQ(0, trace->trace_file_->FlushCloseOrErase());
+    std::unique_ptr<File> file(OS::OpenFileForReading(file_name.c_str()));
+    std::string contents(static_cast<size_t>(file->GetLength()), '\0');
+    EXPECT_TRUE(file->ReadFully(&contents[0], contents.size()));
+    return contents;
+  }
+
+  static void AppendRecord(TraceThreadBuffer* buffer, uint32_t method_id, uint32_t wall_time) {
+    ASSERT_LE(buffer->size + kRecordSize, buffer->capacity);
+    uint8_t* record = buffer->data.get() + buffer->size;
+    const uint32_t values[] = { method_id, /* thread time */ 0u, wall_time };
+    record[0] = static_cast<uint8_t>(buffer->tid);
+    record[1] = static_cast<uint8_t>(buffer->tid >> 8);
+    for (size_t i = 0; i != arraysize(values); ++i) {
+      for (size_t j = 0; j != 4u; ++j) {
+        record[2u + 4u * i + j] = static_cast<uint8_t>(values[i] >> (8u * j));
+      }
+    }
+    buffer->size += kRecordSize;
+  }
+
+  // Returns the thread id and method id of the records in the trace buffer.
+  static std::vector<std::pair<uint32_t, uint32_t>> GetRecords(Trace* trace) {
+    std::vector<std::pair<uint32_t, uint32_t>> records;
+    const size_t end = static_cast<size_t>(trace->cur_offset_.LoadRelaxed());
+    for (size_t offset = kHeaderLength; offset != end; offset += kRecordSize) {
+      const uint8_t* record = trace->buf_.get() + offset;
+      uint32_t tid = record[0] | (record[1] << 8);
+      uint32_t method_id = record[2] | (record[3] << 8) | (record[4] << 16) | (record[5] << 24);
+      records.emplace_back(tid, method_id);
+    }
+    return records;
+  }
+
+  TraceClockSource saved_clock_source_;
+};
+
+TEST_F(TraceTest, FlushThreadBufferOverflow) {
+  // Room for three records, the rest of the buffer of the thread is dropped.
+  std::unique_ptr<Trace> trace = CreateTrace(kHeaderLength + 3u * kRecordSize);
+  TraceThreadBuffer buffer(/* tid */ 1, 8u * kRecordSize);
+  for (uint32_t i = 0; i != 5u; ++i) {
+    AppendRecord(&buffer, i << 2, i);
+  }
+  trace->FlushThreadBuffer(&buffer, /* may_drop */ true);
+  EXPECT_EQ(0u, buffer.size);
+  EXPECT_TRUE(trace->overflow_);
+  using Records = std::vector<std::pair<uint32_t, uint32_t>>;
+  EXPECT_EQ((Records { {1u, 0u}, {1u, 4u}, {1u, 8u} }), GetRecords(trace.get()));
+
+  // A full trace buffer takes no more records.
+  AppendRecord(&buffer, 12u, 5u);
+  trace->FlushThreadBuffer(&buffer, /* may_drop */ true);
+  EXPECT_EQ(0u, buffer.size);
+  EXPECT_EQ(3u, GetRecords(trace.get()).size());
+}
+
+TEST_F(TraceTest, SortRecordsByWallClock) {
+  std::unique_ptr<Trace> trace = CreateTrace(4 * KB);
+  TraceThreadBuffer first(/* tid */ 1, 8u * kRecordSize);
+  TraceThreadBuffer second(/* tid */ 2, 8u * kRecordSize);
+  AppendRecord(&first, 4u, 10u);
+  AppendRecord(&first, 8u, 30u);
+  AppendRecord(&first, 12u, 30u);
+  AppendRecord(&first, 16u, 50u);
+  AppendRecord(&second, 4u, 20u);
+  AppendRecord(&second, 8u, 30u);
+  AppendRecord(&second, 12u, 40u);
+  // Chunks are copied a thread at a time.
+  trace->FlushThreadBuffer(&first, /* may_drop */ true);
+  trace->FlushThreadBuffer(&second, /* may_drop */ true);
+  EXPECT_FALSE(trace->overflow_);
+
+  trace->SortRecords(trace->cur_offset_.LoadRelaxed());
+  // Records with the same time keep the order they were flushed in.
+  using Records = std::vector<std::pair<uint32_t, uint32_t>>;
+  EXPECT_EQ((Records { {1u, 4u}, {2u, 4u}, {1u, 8u}, {1u, 12u}, {2u, 8u}, {2u, 12u}, {1u, 16u} }),
+            GetRecords(trace.get()));
+}
+
+TEST_F(TraceTest, StreamingDropsRecordsWhenTheWriterIsBehind) {
+  ScratchFile file;
+  std::unique_ptr<Trace> trace = CreateStreamingTrace(file.GetFilename());
+  // Without the writer thread, the buffers have room for the header and eleven chunks of 100
+  // records. Traced threads do not wait for space, they drop the other chunks.
+  TraceThreadBuffer buffer(/* tid */ 1, 100u * kRecordSize);
+  for (size_t chunk = 0; chunk != 20u; ++chunk) {
+    for (uint32_t i = 0; i != 100u; ++i) {
+      AppendRecord(&buffer, i << 2, i);
+    }
+    trace->FlushThreadBuffer(&buffer, /* may_drop */ true);
+    EXPECT_EQ(0u, buffer.size);
+  }
+  {
+    MutexLock mu(Thread::Current(), *trace->streaming_lock_);
+    EXPECT_EQ(9u * 100u, trace->dropped_records_);
+    EXPECT_EQ(16 * KB - kHeaderLength - 11u * 100u * kRecordSize, trace->GetStreamingSpace());
+  }
+  EXPECT_TRUE(trace->overflow_);
+
+  // Back-pressure: flushing at the end waits for the writer thread and loses nothing more.
+  StartStreamingWriter(trace.get());
+  for (uint32_t i = 0; i != 100u; ++i) {
+    AppendRecord(&buffer, i << 2, i);
+  }
+  trace->FlushThreadBuffer(&buffer, /* may_drop */ false);
+  std::string contents = FinishStreaming(trace.get(), file.GetFilename());
+  EXPECT_EQ(kHeaderLength + 12u * 100u * kRecordSize, contents.size());
+  MutexLock mu(Thread::Current(), *trace->streaming_lock_);
+  EXPECT_EQ(9u * 100u, trace->dropped_records_);
+}
+
+TEST_F(TraceTest, StreamingWritesNamesOnlyWhenTheyFit) {
+  ScratchFile file;
+  std::unique_ptr<Trace> trace = CreateStreamingTrace(file.GetFilename());
+  Thread* self = Thread::Current();
+  {
+    MutexLock mu(self, *trace->streaming_lock_);
+    std::vector<uint8_t> filler(trace->GetStreamingSpace(), 0u);
+    trace->WriteToBuf(filler.data(), filler.size());
+  }
+
+  TraceThreadBuffer buffer(self->GetTid(), 8u * kRecordSize);
+  {
+    ScopedObjectAccess soa(self);
+    ArtMethod* method = class_linker_->FindSystemClass(self, "Ljava/lang/Object;")
+        ->FindClassMethod("hashCode", "()I", kRuntimePointerSize);
+    ASSERT_TRUE(method != nullptr);
+    // The names do not fit, so the event is dropped and the names are not registered.
+    uint32_t method_id;
+    EXPECT_FALSE(trace->GetMethodId(self, &buffer, method, &method_id));
+    EXPECT_TRUE(buffer.method_ids.empty());
+    MutexLock mu(self, *trace->streaming_lock_);
+    EXPECT_EQ(1u, trace->dropped_records_);
+    EXPECT_FALSE((*trace->seen_threads_)[self->GetTid()]);
+    EXPECT_TRUE(trace->overflow_);
+  }
+
+  // Let the writer thread free the buffers, the next event writes the names.
+  StartStreamingWriter(trace.get());
+  {
+    MutexLock mu(self, *trace->streaming_lock_);
+    trace->FlushBuf();
+  }
+  {
+    ScopedObjectAccess soa(self);
+    ArtMethod* method = class_linker_->FindSystemClass(self, "Ljava/lang/Object;")
+        ->FindClassMethod("hashCode", "()I", kRuntimePointerSize);
+    uint32_t method_id;
+    EXPECT_TRUE(trace->GetMethodId(self, &buffer, method, &method_id));
+    EXPECT_EQ(1u, buffer.method_ids.size());
+  }
+  std::string contents = FinishStreaming(trace.get(), file.GetFilename());
+  EXPECT_NE(std::string::npos, contents.find("\tjava.lang.Object\thashCode\t()I\t", 16 * KB));
+  MutexLock mu(self, *trace->streaming_lock_);
+  EXPECT_EQ(1u, trace->dropped_records_);
+}
+
+TEST_F(TraceTest, FoldedStacks) {
+  ScratchFile file;
+  std::unique_ptr<Trace> trace(new Trace(OS::CreateEmptyFile(file.GetFilename().c_str()),
+                                         file.GetFilename().c_str(),
+                                         /* buffer_size */ 4 * KB,
+                                         Trace::kTraceFoldedStacks,
+                                         Trace::TraceOutputMode::kFile,
+                                         Trace::TraceMode::kSampling));
+  ASSERT_TRUE(trace->folded_stacks_);
+
+  // Every thread samples its stack in a checkpoint.
+  Thread* self = Thread::Current();
+  trace->SampleStacks(self);
+  std::list<Thread*> threads;
+  {
+    MutexLock mu(self, *Locks::thread_list_lock_);
+    threads = Runtime::Current()->GetThreadList()->GetList();
+  }
+  {
+    MutexLock mu(self, *trace->unique_methods_lock_);
+    EXPECT_EQ(threads.size(), trace->thread_buffers_.size());
+  }
+  TraceThreadBuffer* buffer = self->GetMethodTraceBuffer();
+  ASSERT_TRUE(buffer != nullptr);
+
+  {
+    ScopedObjectAccess soa(self);
+    mirror::Class* object = class_linker_->FindSystemClass(self, "Ljava/lang/Object;");
+    ArtMethod* hash_code = object->FindClassMethod("hashCode", "()I", kRuntimePointerSize);
+    ArtMethod* to_string =
+        object->FindClassMethod("toString", "()Ljava/lang/String;", kRuntimePointerSize);
+    // Topmost frame first, the output starts at the bottom of the stack.
+    buffer->stack_counts[std::vector<ArtMethod*> { hash_code, to_string }] += 3u;
+    trace->FinishFoldedStacks();
+  }
+  {
+    MutexLock mu(self, *Locks::thread_list_lock_);
+    for (Thread* thread : Runtime::Current()->GetThreadList()->GetList()) {
+      thread->SetMethodTraceBuffer(nullptr);
+    }
+  }
+  EXPECT_EQ(0, trace->trace_file_->FlushCloseOrErase());
+
+  std::string thread_name;
+  self->GetThreadName(thread_name);
+  std::replace(thread_name.begin(), thread_name.end(), ' ', '_');
+  std::replace(thread_name.begin(), thread_name.end(), ';', '_');
+  std::unique_ptr<File> in(OS::OpenFileForReading(file.GetFilename().c_str()));
+  std::string contents(static_cast<size_t>(in->GetLength()), '\0');
+  ASSERT_TRUE(in->ReadFully(&contents[0], contents.size()));
+  // Other threads may have sampled managed frames, e.g. the daemons.
+  const std::string line =
+      thread_name + ";java.lang.Object.toString;java.lang.Object.hashCode 3\n";
+  EXPECT_TRUE(contents.compare(0, line.size(), line) == 0 ||
+              contents.find("\n" + line) != std::string::npos) << contents;
+}
+
+}  // namespace art
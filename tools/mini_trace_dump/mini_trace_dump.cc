@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Converts a binary MiniTrace coverage file (see runtime/mini_trace_format.h) back to the text
+// layout of /data/mini_trace_<uid>_coverage.dat:
+//   DexFile <dex checksum>   <location>
+//   Method  <method>   <class>   <name>   <signature>   <source file>
+//   <method>   <code units>   <coverage bits>
+// where <method> is <dex checksum>:<method index>. The DexFile and Method rows of a method
+// precede the first row referring to it.
+//
+// Event files are printed one event per line:
+//   Event   <tid>   <timestamp>   <type>   <method>   <class>   <name>   <signature>
+//   Dropped <tid>   <number of events dropped before the following ones>
+//
+// Field coverage is printed like the text layout prints it:
+//   Field   <class>   <name>   <type>   <read><written>
+//
+// Call edges are printed like the text layout prints them:
+//   Call    <caller>   <dex pc>   <callee>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "mini_trace_format.h"
+
+namespace art {
+
+struct MethodNames {
+  std::string class_descriptor;
+  std::string name;
+  std::string signature;
+  std::string source_file;
+};
+
+class MiniTraceDump {
+ public:
+  explicit MiniTraceDump(std::vector<char>&& contents) : contents_(std::move(contents)) {}
+
+  bool Dump(FILE* out) {
+    if (!FindChunks()) {
+      return false;
+    }
+    // Method names may be written after the oldest surviving coverage of the method, collect
+    // them before printing anything.
+    for (const MiniTraceChunkHeader* chunk : chunks_) {
+      if (!VisitRecords(chunk, /* out */ nullptr)) {
+        return false;
+      }
+    }
+    for (const MiniTraceChunkHeader* chunk : chunks_) {
+      if (!VisitRecords(chunk, out)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  static uint64_t MethodKey(uint32_t checksum, uint32_t method_idx) {
+    return (static_cast<uint64_t>(checksum) << 32) | method_idx;
+  }
+
+  template <typename T>
+  static T Read(const char* data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  // Reads a NUL-terminated string from [*data, end).
+  static bool ReadString(const char** data, const char* end, std::string* result) {
+    const char* terminator = std::find(*data, end, '\0');
+    if (terminator == end) {
+      return false;
+    }
+    result->assign(*data, terminator);
+    *data = terminator + 1;
+    return true;
+  }
+
+  bool FindChunks() {
+    if (contents_.size() < sizeof(MiniTraceFileHeader)) {
+      fprintf(stderr, "File too small for the header\n");
+      return false;
+    }
+    header_ = Read<MiniTraceFileHeader>(contents_.data());
+    if (header_.magic != kMiniTraceMagic) {
+      fprintf(stderr, "Not a MiniTrace coverage file\n");
+      return false;
+    }
+    if (header_.version != kMiniTraceVersion) {
+      fprintf(stderr, "Unsupported version %u\n", header_.version);
+      return false;
+    }
+    if (header_.header_size < sizeof(MiniTraceFileHeader) ||
+        header_.chunk_size < sizeof(MiniTraceChunkHeader) ||
+        header_.chunk_size % kMiniTraceRecordAlignment != 0 ||
+        header_.header_size + static_cast<uint64_t>(header_.num_chunks) * header_.chunk_size >
+            contents_.size()) {
+      fprintf(stderr, "Truncated or corrupt file\n");
+      return false;
+    }
+    for (uint32_t i = 0; i != header_.num_chunks; ++i) {
+      const char* chunk = contents_.data() + header_.header_size + i * header_.chunk_size;
+      const MiniTraceChunkHeader* chunk_header =
+          reinterpret_cast<const MiniTraceChunkHeader*>(chunk);
+      // Skip chunks that were never written or that were being started when the process died.
+      if (chunk_header->sequence != 0u &&
+          chunk_header->used >= sizeof(MiniTraceChunkHeader) &&
+          chunk_header->used <= header_.chunk_size) {
+        chunks_.push_back(chunk_header);
+      }
+    }
+    std::sort(chunks_.begin(),
+              chunks_.end(),
+              [](const MiniTraceChunkHeader* lhs, const MiniTraceChunkHeader* rhs) {
+                return lhs->sequence < rhs->sequence;
+              });
+    return true;
+  }
+
+  // Collects the method names if `out` is null, prints the text layout otherwise.
+  bool VisitRecords(const MiniTraceChunkHeader* chunk, FILE* out) {
+    const char* begin = reinterpret_cast<const char*>(chunk);
+    const char* end = begin + chunk->used;
+    const char* record = begin + sizeof(MiniTraceChunkHeader);
+    while (record < end) {
+      if (static_cast<size_t>(end - record) < sizeof(MiniTraceRecordHeader)) {
+        fprintf(stderr, "Truncated record in chunk %llu\n",
+                static_cast<unsigned long long>(chunk->sequence));  // NOLINT [runtime/int]
+        return false;
+      }
+      MiniTraceRecordHeader header = Read<MiniTraceRecordHeader>(record);
+      if (header.size < sizeof(MiniTraceRecordHeader) ||
+          header.size > static_cast<size_t>(end - record)) {
+        fprintf(stderr, "Corrupt record in chunk %llu\n",
+                static_cast<unsigned long long>(chunk->sequence));  // NOLINT [runtime/int]
+        return false;
+      }
+      const char* payload = record + sizeof(MiniTraceRecordHeader);
+      const char* payload_end = record + header.size;
+      bool ok = (out == nullptr) ? CollectRecord(header.type, payload, payload_end)
+                                 : PrintRecord(header.type, payload, payload_end, out);
+      if (!ok) {
+        fprintf(stderr, "Corrupt record of type %u in chunk %llu\n",
+                header.type,
+                static_cast<unsigned long long>(chunk->sequence));  // NOLINT [runtime/int]
+        return false;
+      }
+      record = payload_end;
+    }
+    return true;
+  }
+
+  bool CollectRecord(uint16_t type, const char* payload, const char* end) {
+    if (type == kMiniTraceRecordDexFile) {
+      if (static_cast<size_t>(end - payload) < sizeof(uint32_t)) {
+        return false;
+      }
+      const char* data = payload + sizeof(uint32_t);
+      return ReadString(&data, end, &dex_locations_[Read<uint32_t>(payload)]);
+    }
+    if (type != kMiniTraceRecordMethod) {
+      return true;
+    }
+    if (static_cast<size_t>(end - payload) < 2 * sizeof(uint32_t)) {
+      return false;
+    }
+    uint32_t checksum = Read<uint32_t>(payload);
+    uint32_t method_idx = Read<uint32_t>(payload + sizeof(uint32_t));
+    const char* data = payload + 2 * sizeof(uint32_t);
+    MethodNames names;
+    if (!ReadString(&data, end, &names.class_descriptor) ||
+        !ReadString(&data, end, &names.name) ||
+        !ReadString(&data, end, &names.signature) ||
+        !ReadString(&data, end, &names.source_file)) {
+      return false;
+    }
+    method_names_[MethodKey(checksum, method_idx)] = std::move(names);
+    return true;
+  }
+
+  static const char* GetEventName(uint8_t type) {
+    switch (type) {
+      case kMiniTraceEventMethodEntered: return "MethodEntered";
+      case kMiniTraceEventMethodExited: return "MethodExited";
+      case kMiniTraceEventMethodUnwind: return "MethodUnwind";
+      case kMiniTraceEventExceptionThrown: return "ExceptionThrown";
+      case kMiniTraceEventExceptionHandled: return "ExceptionHandled";
+      case kMiniTraceEventInvokeVirtualOrInterface: return "InvokeVirtualOrInterface";
+      case kMiniTraceEventFieldRead: return "FieldRead";
+      case kMiniTraceEventFieldWritten: return "FieldWritten";
+      default: return "?";
+    }
+  }
+
+  const MethodNames& GetMethodNames(uint32_t checksum, uint32_t method_idx) const {
+    auto it = method_names_.find(MethodKey(checksum, method_idx));
+    static const MethodNames kUnknown = { "?", "?", "?", "?" };
+    return (it != method_names_.end()) ? it->second : kUnknown;
+  }
+
+  // Prints the DexFile and Method rows naming a method unless they were printed already.
+  void PrintMethodNames(uint32_t checksum, uint32_t method_idx, FILE* out) {
+    if (printed_dex_files_.insert(checksum).second) {
+      auto it = dex_locations_.find(checksum);
+      fprintf(out, "DexFile\t%08x\t%s\n",
+              checksum,
+              (it != dex_locations_.end()) ? it->second.c_str() : "?");
+    }
+    if (printed_methods_.insert(MethodKey(checksum, method_idx)).second) {
+      const MethodNames& names = GetMethodNames(checksum, method_idx);
+      fprintf(out, "Method\t%08x:%u\t%s\t%s\t%s\t%s\n",
+              checksum,
+              method_idx,
+              names.class_descriptor.c_str(),
+              names.name.c_str(),
+              names.signature.c_str(),
+              names.source_file.c_str());
+    }
+  }
+
+  bool PrintEvents(const char* payload, const char* end, FILE* out) {
+    if (static_cast<size_t>(end - payload) < 2 * sizeof(uint32_t)) {
+      return false;
+    }
+    uint32_t tid = Read<uint32_t>(payload);
+    uint32_t dropped = Read<uint32_t>(payload + sizeof(uint32_t));
+    if (dropped != 0u) {
+      fprintf(out, "Dropped\t%u\t%u\n", tid, dropped);
+    }
+    // The padding of the record is shorter than an event.
+    static_assert(kMiniTraceRecordAlignment <= sizeof(MiniTraceEventRecord),
+                  "Padding could be taken for an event");
+    for (const char* event = payload + 2 * sizeof(uint32_t);
+         static_cast<size_t>(end - event) >= sizeof(MiniTraceEventRecord);
+         event += sizeof(MiniTraceEventRecord)) {
+      MiniTraceEventRecord record = Read<MiniTraceEventRecord>(event);
+      const MethodNames& names = GetMethodNames(record.checksum, record.method_idx);
+      fprintf(out, "Event\t%u\t%llu\t%s\t%08x:%u\t%s\t%s\t%s\n",
+              tid,
+              static_cast<unsigned long long>(record.timestamp),  // NOLINT [runtime/int]
+              GetEventName(record.type),
+              record.checksum,
+              record.method_idx,
+              names.class_descriptor.c_str(),
+              names.name.c_str(),
+              names.signature.c_str());
+    }
+    return true;
+  }
+
+  bool PrintRecord(uint16_t type, const char* payload, const char* end, FILE* out) {
+    switch (type) {
+      case kMiniTraceRecordStart:
+      case kMiniTraceRecordDump: {
+        if (static_cast<size_t>(end - payload) < sizeof(uint64_t)) {
+          return false;
+        }
+        fprintf(out, "%s\t%u\t%llu",
+                (type == kMiniTraceRecordStart) ? "Start" : "Dump",
+                header_.pid,
+                static_cast<unsigned long long>(Read<uint64_t>(payload)));  // NOLINT [runtime/int]
+        if (static_cast<size_t>(end - payload) >= 2 * sizeof(uint64_t)) {
+          fprintf(out, "\t%llu",
+                  static_cast<unsigned long long>(  // NOLINT [runtime/int]
+                      Read<uint64_t>(payload + sizeof(uint64_t))));
+        }
+        fputc('\n', out);
+        return true;
+      }
+      case kMiniTraceRecordCoverage: {
+        if (static_cast<size_t>(end - payload) < 3 * sizeof(uint32_t)) {
+          return false;
+        }
+        uint32_t checksum = Read<uint32_t>(payload);
+        uint32_t method_idx = Read<uint32_t>(payload + sizeof(uint32_t));
+        uint32_t insns_size = Read<uint32_t>(payload + 2 * sizeof(uint32_t));
+        const uint8_t* bits = reinterpret_cast<const uint8_t*>(payload + 3 * sizeof(uint32_t));
+        if ((insns_size + 7u) / 8u > static_cast<size_t>(end - payload) - 3 * sizeof(uint32_t)) {
+          return false;
+        }
+        PrintMethodNames(checksum, method_idx, out);
+        fprintf(out, "%08x:%u\t%u\t", checksum, method_idx, insns_size);
+        std::string covered(insns_size, '0');
+        for (uint32_t i = 0; i != insns_size; ++i) {
+          if ((bits[i / 8u] & (1u << (i % 8u))) != 0) {
+            covered[i] = '1';
+          }
+        }
+        fprintf(out, "%s\n", covered.c_str());
+        return true;
+      }
+      case kMiniTraceRecordEvents:
+        return PrintEvents(payload, end, out);
+      case kMiniTraceRecordFieldCoverage: {
+        if (static_cast<size_t>(end - payload) < 2 * sizeof(uint32_t) + 1u) {
+          return false;
+        }
+        uint8_t flags = static_cast<uint8_t>(payload[2 * sizeof(uint32_t)]);
+        const char* data = payload + 2 * sizeof(uint32_t) + 1u;
+        std::string class_descriptor;
+        std::string name;
+        std::string type_descriptor;
+        if (!ReadString(&data, end, &class_descriptor) ||
+            !ReadString(&data, end, &name) ||
+            !ReadString(&data, end, &type_descriptor)) {
+          return false;
+        }
+        fprintf(out, "Field\t%s\t%s\t%s\t%d%d\n",
+                class_descriptor.c_str(),
+                name.c_str(),
+                type_descriptor.c_str(),
+                (flags & kMiniTraceFieldRead) != 0 ? 1 : 0,
+                (flags & kMiniTraceFieldWritten) != 0 ? 1 : 0);
+        return true;
+      }
+      case kMiniTraceRecordCallEdge: {
+        if (static_cast<size_t>(end - payload) < 5 * sizeof(uint32_t)) {
+          return false;
+        }
+        uint32_t values[5];
+        memcpy(values, payload, sizeof(values));
+        PrintMethodNames(values[0], values[1], out);
+        PrintMethodNames(values[3], values[4], out);
+        fprintf(out, "Call\t%08x:%u\t%u\t%08x:%u\n",
+                values[0],
+                values[1],
+                values[2],
+                values[3],
+                values[4]);
+        return true;
+      }
+      default:
+        // Names were collected already. Also skips records added by later runtimes.
+        return true;
+    }
+  }
+
+  const std::vector<char> contents_;
+  MiniTraceFileHeader header_;
+  std::vector<const MiniTraceChunkHeader*> chunks_;
+  std::map<uint64_t, MethodNames> method_names_;
+  std::map<uint32_t, std::string> dex_locations_;
+  // The names printed so far.
+  std::set<uint32_t> printed_dex_files_;
+  std::set<uint64_t> printed_methods_;
+};
+
+static int MiniTraceDumpMain(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <mini_trace_coverage.bin>\n", argv[0]);
+    return 2;
+  }
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  std::vector<char> contents((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+  MiniTraceDump dump(std::move(contents));
+  return dump.Dump(stdout) ? 0 : 1;
+}
+
+}  // namespace art
+
+int main(int argc, char** argv) {
+  return art::MiniTraceDumpMain(argc, argv);
+}
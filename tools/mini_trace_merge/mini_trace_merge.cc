@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Merges MiniTrace text coverage files from any number of processes and runs: the
+// /data/mini_trace_<uid>_coverage.dat files, the output of mini_trace_dump for binary files, or
+// the output of this tool.
+//
+// Methods are identified by <dex checksum>:<method index>, which is the same in every process
+// loading the dex file, and are named by the Method rows preceding their first use. Fields are
+// identified by class, name and type. The files are read line by line by a pool of threads and
+// memory grows with the number of distinct methods, not with the size of the files.
+//
+// Usage: mini_trace_merge [--jobs=<n>] [--merged=<file>] [--lcov=<file>] <coverage file>...
+//
+//   --jobs     number of files read at the same time, the number of CPUs by default.
+//   --merged   writes the union in the text layout.
+//   --lcov     writes an lcov tracefile with one function per method. Coverage files have no
+//              line numbers, so functions are at line 0 and there is no line coverage.
+//
+// A summary is printed to stdout. Only methods that executed are dumped, so the share of
+// covered code units is relative to those methods.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mini_trace_format.h"
+
+namespace art {
+
+// Flags of merged fields, the characters of the text layout.
+static constexpr uint8_t kFieldRead = 1;
+static constexpr uint8_t kFieldWritten = 2;
+
+struct MethodNames {
+  std::string class_name;
+  std::string name;
+  std::string signature;
+  std::string source_file;
+};
+
+// Methods are keyed by dex checksum in the high and method index in the low 32 bits.
+static uint64_t MethodKey(uint32_t checksum, uint32_t method_idx) {
+  return (static_cast<uint64_t>(checksum) << 32) | method_idx;
+}
+
+// Parses <dex checksum>:<method index>.
+static bool ParseMethodId(const std::string& id, uint64_t* key) {
+  char* end;
+  unsigned long checksum = strtoul(id.c_str(), &end, 16);  // NOLINT [runtime/int]
+  if (end == id.c_str() || *end != ':' || checksum > 0xffffffffu) {
+    return false;
+  }
+  const char* index = end + 1;
+  unsigned long method_idx = strtoul(index, &end, 10);  // NOLINT [runtime/int]
+  if (end == index || *end != '\0' || method_idx > 0xffffffffu) {
+    return false;
+  }
+  *key = MethodKey(static_cast<uint32_t>(checksum), static_cast<uint32_t>(method_idx));
+  return true;
+}
+
+// The union of the coverage read by one thread.
+struct Coverage {
+  std::unordered_map<uint64_t, std::vector<bool>> methods;
+  std::unordered_map<uint64_t, MethodNames> method_names;
+  std::unordered_map<uint32_t, std::string> dex_locations;
+  // Keyed by class, name and type separated by tabs.
+  std::unordered_map<std::string, uint8_t> fields;
+
+  uint64_t lines = 0u;
+  uint64_t malformed_lines = 0u;
+  uint64_t starts = 0u;
+  uint64_t dumps = 0u;
+  uint64_t method_rows = 0u;
+
+  void MergeFrom(Coverage&& other) {
+    for (auto& entry : other.methods) {
+      auto it = methods.find(entry.first);
+      if (it == methods.end()) {
+        methods.emplace(entry.first, std::move(entry.second));
+        continue;
+      }
+      // Rows of a different size are malformed, as within one thread.
+      std::vector<bool>& covered = it->second;
+      const std::vector<bool>& other_covered = entry.second;
+      if (other_covered.size() != covered.size()) {
+        ++malformed_lines;
+        continue;
+      }
+      for (size_t i = 0; i != covered.size(); ++i) {
+        if (other_covered[i]) {
+          covered[i] = true;
+        }
+      }
+    }
+    for (auto& entry : other.method_names) {
+      method_names.emplace(entry.first, std::move(entry.second));
+    }
+    for (auto& entry : other.dex_locations) {
+      dex_locations.emplace(entry.first, std::move(entry.second));
+    }
+    for (const auto& entry : other.fields) {
+      fields[entry.first] |= entry.second;
+    }
+    lines += other.lines;
+    malformed_lines += other.malformed_lines;
+    starts += other.starts;
+    dumps += other.dumps;
+    method_rows += other.method_rows;
+  }
+};
+
+// Splits `line` at the tabs into `fields`, reusing their storage.
+static void SplitLine(const std::string& line, std::vector<std::string>* fields) {
+  size_t count = 0u;
+  size_t start = 0u;
+  while (true) {
+    size_t end = line.find('\t', start);
+    if (count == fields->size()) {
+      fields->emplace_back();
+    }
+    (*fields)[count++].assign(line, start, (end == std::string::npos) ? std::string::npos
+                                                                      : end - start);
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1u;
+  }
+  fields->resize(count);
+}
+
+class CoverageReader {
+ public:
+  explicit CoverageReader(Coverage* coverage) : coverage_(coverage) {}
+
+  bool Read(const char* filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+      fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+      return false;
+    }
+    uint32_t magic = 0u;
+    if (in.read(reinterpret_cast<char*>(&magic), sizeof(magic)) && magic == kMiniTraceMagic) {
+      fprintf(stderr, "%s is a binary coverage file, convert it with mini_trace_dump\n", filename);
+      return false;
+    }
+    in.clear();
+    in.seekg(0);
+
+    std::string line;
+    while (std::getline(in, line)) {
+      ++coverage_->lines;
+      if (!ReadLine(line)) {
+        ++coverage_->malformed_lines;
+      }
+    }
+    if (in.bad()) {
+      fprintf(stderr, "Failed to read %s: %s\n", filename, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  bool ReadLine(const std::string& line) {
+    if (line.empty()) {
+      return true;
+    }
+    SplitLine(line, &fields_);
+    const std::string& kind = fields_[0];
+    if (kind == "Start") {
+      ++coverage_->starts;
+      return fields_.size() >= 3u;
+    } else if (kind == "Dump") {
+      ++coverage_->dumps;
+      return fields_.size() >= 3u;
+    } else if (kind == "DexFile") {
+      return ReadDexFile();
+    } else if (kind == "Method") {
+      return ReadMethodNames();
+    } else if (kind == "Field") {
+      return ReadField();
+    } else if (kind == "Call" || kind == "Event" || kind == "Dropped") {
+      // Not merged.
+      return true;
+    } else {
+      return ReadMethod();
+    }
+  }
+
+  // DexFile  <dex checksum>  <location>
+  bool ReadDexFile() {
+    if (fields_.size() != 3u) {
+      return false;
+    }
+    char* end;
+    unsigned long checksum = strtoul(fields_[1].c_str(), &end, 16);  // NOLINT [runtime/int]
+    if (fields_[1].empty() || *end != '\0' || checksum > 0xffffffffu) {
+      return false;
+    }
+    coverage_->dex_locations.emplace(static_cast<uint32_t>(checksum), fields_[2]);
+    return true;
+  }
+
+  // Method  <method>  <class>  <name>  <signature>  <source file>
+  bool ReadMethodNames() {
+    uint64_t key;
+    if (fields_.size() != 6u || !ParseMethodId(fields_[1], &key)) {
+      return false;
+    }
+    if (coverage_->method_names.find(key) == coverage_->method_names.end()) {
+      MethodNames names;
+      names.class_name = fields_[2];
+      names.name = fields_[3];
+      names.signature = fields_[4];
+      names.source_file = fields_[5];
+      coverage_->method_names.emplace(key, std::move(names));
+    }
+    return true;
+  }
+
+  // <method>  <code units>  <covered>
+  bool ReadMethod() {
+    uint64_t key;
+    if (fields_.size() != 3u || !ParseMethodId(fields_[0], &key)) {
+      return false;
+    }
+    const std::string& size = fields_[1];
+    const std::string& bits = fields_[2];
+    char* end;
+    unsigned long code_units = strtoul(size.c_str(), &end, 10);  // NOLINT [runtime/int]
+    if (size.empty() || *end != '\0' || code_units != bits.size()) {
+      return false;
+    }
+    auto it = coverage_->methods.find(key);
+    if (it == coverage_->methods.end()) {
+      it = coverage_->methods.emplace(key, std::vector<bool>(code_units, false)).first;
+    } else if (it->second.size() != code_units) {
+      return false;
+    }
+    std::vector<bool>& covered = it->second;
+    for (size_t i = 0; i != bits.size(); ++i) {
+      if (bits[i] == '1') {
+        covered[i] = true;
+      } else if (bits[i] != '0') {
+        return false;
+      }
+    }
+    ++coverage_->method_rows;
+    return true;
+  }
+
+  // Field  <class>  <name>  <type>  <read><written>
+  bool ReadField() {
+    if (fields_.size() != 5u || fields_[4].size() != 2u) {
+      return false;
+    }
+    const std::string& flags = fields_[4];
+    key_.assign(fields_[1]).append(1, '\t').append(fields_[2]).append(1, '\t').append(fields_[3]);
+    uint8_t& merged = coverage_->fields[key_];
+    if (flags[0] == '1') {
+      merged |= kFieldRead;
+    }
+    if (flags[1] == '1') {
+      merged |= kFieldWritten;
+    }
+    return true;
+  }
+
+  Coverage* const coverage_;
+  std::vector<std::string> fields_;
+  std::string key_;
+};
+
+template <typename Map>
+static std::vector<typename Map::const_iterator> SortedEntries(const Map& map) {
+  std::vector<typename Map::const_iterator> entries;
+  entries.reserve(map.size());
+  for (auto it = map.begin(); it != map.end(); ++it) {
+    entries.push_back(it);
+  }
+  std::sort(entries.begin(),
+            entries.end(),
+            [](typename Map::const_iterator lhs, typename Map::const_iterator rhs) {
+              return lhs->first < rhs->first;
+            });
+  return entries;
+}
+
+static size_t CountCovered(const std::vector<bool>& covered) {
+  return std::count(covered.begin(), covered.end(), true);
+}
+
+static bool WriteMerged(const Coverage& coverage, const char* filename) {
+  FILE* out = fopen(filename, "w");
+  if (out == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  // All names precede the coverage rows.
+  for (const auto& it : SortedEntries(coverage.dex_locations)) {
+    fprintf(out, "DexFile\t%08x\t%s\n", it->first, it->second.c_str());
+  }
+  const auto methods = SortedEntries(coverage.methods);
+  for (const auto& it : methods) {
+    auto names = coverage.method_names.find(it->first);
+    if (names != coverage.method_names.end()) {
+      fprintf(out, "Method\t%08x:%u\t%s\t%s\t%s\t%s\n",
+              static_cast<uint32_t>(it->first >> 32),
+              static_cast<uint32_t>(it->first),
+              names->second.class_name.c_str(),
+              names->second.name.c_str(),
+              names->second.signature.c_str(),
+              names->second.source_file.c_str());
+    }
+  }
+  std::string bits;
+  for (const auto& it : methods) {
+    const std::vector<bool>& covered = it->second;
+    bits.assign(covered.size(), '0');
+    for (size_t i = 0; i != covered.size(); ++i) {
+      if (covered[i]) {
+        bits[i] = '1';
+      }
+    }
+    fprintf(out, "%08x:%u\t%zu\t%s\n",
+            static_cast<uint32_t>(it->first >> 32),
+            static_cast<uint32_t>(it->first),
+            covered.size(),
+            bits.c_str());
+  }
+  for (const auto& it : SortedEntries(coverage.fields)) {
+    fprintf(out, "Field\t%s\t%d%d\n",
+            it->first.c_str(),
+            (it->second & kFieldRead) != 0 ? 1 : 0,
+            (it->second & kFieldWritten) != 0 ? 1 : 0);
+  }
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+// Returns the path of the source file of `pretty_class`, e.g. com/example/Main.java for
+// com.example.Main$1 in Main.java.
+static std::string GetSourcePath(const std::string& pretty_class, const std::string& source_file) {
+  size_t package_end = pretty_class.rfind('.');
+  std::string path;
+  if (package_end != std::string::npos) {
+    path = pretty_class.substr(0, package_end + 1u);
+    std::replace(path.begin(), path.end(), '.', '/');
+  }
+  if (!source_file.empty()) {
+    return path + source_file;
+  }
+  // No debug info, use the outermost class.
+  size_t name_start = (package_end == std::string::npos) ? 0u : package_end + 1u;
+  size_t name_end = pretty_class.find('$', name_start);
+  return path + pretty_class.substr(name_start, name_end - name_start) + ".java";
+}
+
+static bool WriteLcov(const Coverage& coverage, const char* filename) {
+  struct Function {
+    std::string name;
+    bool executed;
+  };
+  std::map<std::string, std::vector<Function>> source_files;
+  for (const auto& entry : coverage.methods) {
+    Function function;
+    function.executed = CountCovered(entry.second) != 0u;
+    auto names = coverage.method_names.find(entry.first);
+    if (names == coverage.method_names.end()) {
+      // The Method row was lost, e.g. with the start of a truncated file.
+      char id[32];
+      snprintf(id, sizeof(id), "%08x:%u",
+               static_cast<uint32_t>(entry.first >> 32),
+               static_cast<uint32_t>(entry.first));
+      function.name = id;
+      source_files["?"].push_back(std::move(function));
+      continue;
+    }
+    const MethodNames& method = names->second;
+    function.name = method.class_name + '.' + method.name + method.signature;
+    source_files[GetSourcePath(method.class_name, method.source_file)].push_back(
+        std::move(function));
+  }
+
+  FILE* out = fopen(filename, "w");
+  if (out == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  for (auto& entry : source_files) {
+    std::vector<Function>& functions = entry.second;
+    std::sort(functions.begin(),
+              functions.end(),
+              [](const Function& lhs, const Function& rhs) { return lhs.name < rhs.name; });
+    fprintf(out, "TN:\nSF:%s\n", entry.first.c_str());
+    size_t hit = 0u;
+    for (const Function& function : functions) {
+      fprintf(out, "FN:0,%s\n", function.name.c_str());
+    }
+    for (const Function& function : functions) {
+      fprintf(out, "FNDA:%d,%s\n", function.executed ? 1 : 0, function.name.c_str());
+      hit += function.executed ? 1u : 0u;
+    }
+    fprintf(out, "FNF:%zu\nFNH:%zu\nend_of_record\n", functions.size(), hit);
+  }
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static void PrintSummary(const Coverage& coverage, size_t num_files) {
+  uint64_t code_units = 0u;
+  uint64_t covered_code_units = 0u;
+  size_t unnamed_methods = 0u;
+  for (const auto& entry : coverage.methods) {
+    code_units += entry.second.size();
+    covered_code_units += CountCovered(entry.second);
+    if (coverage.method_names.find(entry.first) == coverage.method_names.end()) {
+      ++unnamed_methods;
+    }
+  }
+  size_t fields_read = 0u;
+  size_t fields_written = 0u;
+  for (const auto& entry : coverage.fields) {
+    fields_read += ((entry.second & kFieldRead) != 0) ? 1u : 0u;
+    fields_written += ((entry.second & kFieldWritten) != 0) ? 1u : 0u;
+  }
+  printf("Files\t%zu\n", num_files);
+  printf("Lines\t%llu\n", static_cast<unsigned long long>(coverage.lines));  // NOLINT [runtime/int]
+  printf("Malformed lines\t%llu\n",
+         static_cast<unsigned long long>(coverage.malformed_lines));  // NOLINT [runtime/int]
+  printf("Traces\t%llu\n",
+         static_cast<unsigned long long>(coverage.starts));  // NOLINT [runtime/int]
+  printf("Dumps\t%llu\n", static_cast<unsigned long long>(coverage.dumps));  // NOLINT [runtime/int]
+  printf("Method rows\t%llu\n",
+         static_cast<unsigned long long>(coverage.method_rows));  // NOLINT [runtime/int]
+  printf("Dex files\t%zu\n", coverage.dex_locations.size());
+  printf("Methods\t%zu\tunnamed %zu\n", coverage.methods.size(), unnamed_methods);
+  printf("Code units\t%llu/%llu\t%.1f%%\n",
+         static_cast<unsigned long long>(covered_code_units),  // NOLINT [runtime/int]
+         static_cast<unsigned long long>(code_units),  // NOLINT [runtime/int]
+         (code_units != 0u) ? 100.0 * covered_code_units / code_units : 0.0);
+  printf("Fields\t%zu\tread %zu\twritten %zu\n",
+         coverage.fields.size(),
+         fields_read,
+         fields_written);
+}
+
+static void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--jobs=<n>] [--merged=<file>] [--lcov=<file>] <coverage file>...\n",
+          program);
+}
+
+static int MiniTraceMergeMain(int argc, char** argv) {
+  size_t jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  const char* merged_filename = nullptr;
+  const char* lcov_filename = nullptr;
+  std::vector<const char*> filenames;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--jobs=", strlen("--jobs=")) == 0) {
+      char* end;
+      jobs = strtoul(arg + strlen("--jobs="), &end, 10);
+      if (*end != '\0' || jobs == 0u) {
+        fprintf(stderr, "Invalid %s\n", arg);
+        return 2;
+      }
+    } else if (strncmp(arg, "--merged=", strlen("--merged=")) == 0) {
+      merged_filename = arg + strlen("--merged=");
+    } else if (strncmp(arg, "--lcov=", strlen("--lcov=")) == 0) {
+      lcov_filename = arg + strlen("--lcov=");
+    } else if (arg[0] == '-' && arg[1] == '-') {
+      Usage(argv[0]);
+      return 2;
+    } else {
+      filenames.push_back(arg);
+    }
+  }
+  if (filenames.empty()) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  // Each thread merges whole files into its own coverage, the results are merged at the end.
+  jobs = std::min(jobs, filenames.size());
+  std::vector<Coverage> coverages(jobs);
+  std::atomic<size_t> next_file(0u);
+  std::atomic<bool> failed(false);
+  auto read_files = [&](Coverage* coverage) {
+    CoverageReader reader(coverage);
+    for (size_t i = next_file++; i < filenames.size(); i = next_file++) {
+      if (!reader.Read(filenames[i])) {
+        failed = true;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < jobs; ++i) {
+    threads.emplace_back(read_files, &coverages[i]);
+  }
+  read_files(&coverages[0]);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  if (failed) {
+    return 1;
+  }
+  for (size_t i = 1; i < jobs; ++i) {
+    coverages[0].MergeFrom(std::move(coverages[i]));
+    coverages[i] = Coverage();
+  }
+  const Coverage& coverage = coverages[0];
+
+  if (merged_filename != nullptr && !WriteMerged(coverage, merged_filename)) {
+    return 1;
+  }
+  if (lcov_filename != nullptr && !WriteLcov(coverage, lcov_filename)) {
+    return 1;
+  }
+  PrintSummary(coverage, filenames.size());
+  return 0;
+}
+
+}  // namespace art
+
+int main(int argc, char** argv) {
+  return art::MiniTraceMergeMain(argc, argv);
+}